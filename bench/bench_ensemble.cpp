@@ -0,0 +1,102 @@
+// Benchmark an ensemble of projections that differ in condom use from 2015, run
+// with EnsembleRunner on 1 to max_threads threads, against setting up and running
+// a separate projection for each member. EnsembleRunner::run_branches projects
+// the years before 2015 once for all workers.
+// Usage: bench_ensemble [members] [max_threads]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "synthetic_projection.h"
+
+typedef DP::Projection projection_t;
+typedef DP::EnsembleRunner<projection_t> runner_t;
+
+const int YEAR_FIRST = 1970, YEAR_VARIED = 2015, YEAR_FINAL = 2030;
+const char* UPD_FILENAME = "bench_ensemble.upd";
+
+void set_member(projection_t& proj, const int m) {
+	for (int t = YEAR_VARIED - YEAR_FIRST; t < proj.num_years(); ++t)
+		proj.dat.condom_freq(t, DP::BOND_CASUAL, 0.3 + 0.5 * m / 100.0);
+}
+
+// New infections and PLHIV aged 15+
+void extract(const projection_t& proj, const int t, double* out) {
+	out[0] = out[1] = 0.0;
+	for (int u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+		for (int b = 0; b < DP::N_AGE_ADULT; ++b)
+			for (int r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+				out[0] += proj.dat.new_hiv_infections(t, u, b + DP::AGE_ADULT_MIN, r);
+				for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+					for (int d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d)
+						out[1] += proj.pop.adult_hiv(t, u, b, r, h, d);
+			}
+}
+
+void print_run(const char* method, const int threads, const std::chrono::steady_clock::duration elapsed, const double t_ref,
+               const runner_t& runner, const std::vector<double>& ref) {
+	const int members(runner.num_members()), num_years(runner.results().shape()[1]);
+	double err(0.0);
+	for (int m = 0; m < members; ++m)
+		for (int t = 0; t < num_years; ++t)
+			for (int k = 0; k < 2; ++k)
+				err = std::max(err, std::fabs(runner.result(m, t, k) - ref[2 * (m * num_years + t) + k]));
+	const double t_run = std::chrono::duration<double>(elapsed).count() / members;
+	printf("%-22s %8d %12.3f %8.2fx  max abs diff %.1e\n", method, threads, t_run, t_ref / t_run, err);
+}
+
+int main(int argc, char** argv) {
+	const int members = (argc > 1) ? atoi(argv[1]) : 16;
+	const int max_threads = (argc > 2) ? atoi(argv[2]) : std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+	const int num_years(YEAR_FINAL - YEAR_FIRST + 1);
+	std::vector<double> ref(members * num_years * 2);
+	double out[2];
+
+	write_synthetic_upd(UPD_FILENAME);
+
+	// Reference: a new projection for each member
+	auto t0 = std::chrono::steady_clock::now();
+	for (int m = 0; m < members; ++m) {
+		std::unique_ptr<projection_t> proj(new projection_t(YEAR_FIRST, YEAR_FINAL));
+		SyntheticInputs inputs(num_years);
+		setup_synthetic_projection(*proj, inputs, UPD_FILENAME);
+		set_member(*proj, m);
+		proj->project(YEAR_FINAL);
+		for (int t = 0; t < num_years; ++t) {
+			extract(*proj, t, out);
+			ref[2 * (m * num_years + t)] = out[0];
+			ref[2 * (m * num_years + t) + 1] = out[1];
+		}
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	printf("%-22s %8s %12s %9s\n", "method", "threads", "s/member", "speedup");
+	const double t_ref = std::chrono::duration<double>(t1 - t0).count() / members;
+	printf("%-22s %8d %12.3f %8.2fx\n", "separate projections", 1, t_ref, 1.0);
+
+	for (int n = 1; n <= max_threads; n *= 2) {
+		std::vector<SyntheticInputs> inputs(n, SyntheticInputs(num_years));
+		t0 = std::chrono::steady_clock::now();
+		runner_t runner(YEAR_FIRST, YEAR_FINAL, 2, [&](projection_t& proj, const int w) {
+			setup_synthetic_projection(proj, inputs[w], UPD_FILENAME);
+		}, n);
+		runner.run(members, set_member, extract);
+		t1 = std::chrono::steady_clock::now();
+		print_run("EnsembleRunner", n, t1 - t0, t_ref, runner, ref);
+
+		std::vector<SyntheticInputs> inputs_branched(n, SyntheticInputs(num_years));
+		t0 = std::chrono::steady_clock::now();
+		runner_t branched(YEAR_FIRST, YEAR_FINAL, 2, [&](projection_t& proj, const int w) {
+			setup_synthetic_projection(proj, inputs_branched[w], UPD_FILENAME);
+		}, n);
+		branched.run_branches(YEAR_VARIED, members, set_member, extract);
+		t1 = std::chrono::steady_clock::now();
+		print_run("run_branches", n, t1 - t0, t_ref, branched, ref);
+	}
+
+	std::remove(UPD_FILENAME);
+	return 0;
+}
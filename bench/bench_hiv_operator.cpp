@@ -0,0 +1,70 @@
+// Benchmark for the sparse adult HIV transition operator used in each HIV time step.
+// Usage: bench_hiv_operator [repetitions]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <DPHivOperator.h>
+
+int main(int argc, char** argv) {
+	const int reps = (argc > 1) ? atoi(argv[1]) : 200000;
+
+	std::mt19937_64 rng(20240125);
+	std::uniform_real_distribution<double> unif(0.0, 1.0);
+	DP::HivStepRates rates = {};
+	DP::HivOperator op;
+	static DP::HivOperator::block_t x, y, dx, dth;
+
+	for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+		rates.prog[h] = unif(rng);
+		rates.dist[h] = unif(rng);
+		rates.mort[h] = 0.1 * unif(rng);
+		rates.mort_scale[h] = unif(rng);
+		rates.off_out[h] = rates.prog[h] + rates.mort_scale[h] * rates.mort[h];
+		rates.uptake[h] = unif(rng);
+		for (int k = 0; k < DP::N_ART; ++k) {
+			rates.art_mort[h][k] = 0.01 * unif(rng);
+			rates.art_out[h][k] = rates.art_mort[h][k] + 2.0;
+		}
+	}
+	rates.art_flow[0] = rates.art_flow[1] = 2.0;
+	rates.art_exit = 0.05;
+
+	for (int i = 0; i < DP::N_HIV_CELL; ++i)
+		for (int l = 0; l < DP::N_HIV_LANE; ++l)
+			x[i][l] = unif(rng);
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int k = 0; k < reps; ++k) {
+		rates.uptake[k % DP::N_HIV_ADULT] += 1e-12; // defeat loop-invariant hoisting
+		op.assemble(rates);
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	printf("%-10s %10.1f ns/call  %d nonzeros\n", "assemble", std::chrono::duration<double, std::nano>(t1 - t0).count() / reps, op.num_nonzero());
+
+	for (int nlane = DP::N_POP; nlane <= DP::N_HIV_LANE; nlane += DP::N_POP) {
+		t0 = std::chrono::steady_clock::now();
+		for (int k = 0; k < reps; ++k) {
+			x[k % DP::N_HIV_CELL][0] += 1e-12;
+			op.apply(x, dx, nlane);
+		}
+		t1 = std::chrono::steady_clock::now();
+		const double t_apply = std::chrono::duration<double, std::nano>(t1 - t0).count() / reps;
+		printf("apply   %2d lanes %6.1f ns/call  %5.2f ns/compartment\n", nlane, t_apply, t_apply / nlane);
+	}
+
+	const char* names[] = {"euler", "exponential"};
+	for (int method = DP::INTEGRATOR_EULER; method <= DP::INTEGRATOR_EXPONENTIAL; ++method) {
+		op.update_exposure(DP::HIV_STEP_SIZE, static_cast<DP::integrator_t>(method));
+		t0 = std::chrono::steady_clock::now();
+		for (int k = 0; k < reps; ++k) {
+			std::memcpy(y, x, sizeof(y)); // restart from x so the population does not decay to zero
+			op.advance(y, dth, DP::N_HIV_LANE);
+		}
+		t1 = std::chrono::steady_clock::now();
+		printf("advance %-11s %6.1f ns/call\n", names[method], std::chrono::duration<double, std::nano>(t1 - t0).count() / reps);
+	}
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+// Benchmark full projections with each memory layout for adults living with HIV.
+// Usage: bench_layouts [repetitions]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "synthetic_projection.h"
+
+const int YEAR_FIRST = 1970, YEAR_FINAL = 2030;
+const char* UPD_FILENAME = "bench_layouts.upd";
+
+// Project reps times and return seconds per projection. PLHIV and new infections
+// by year are stored in out for comparison between layouts
+template<DP::hiv_layout_t layout, typename value_t>
+double run(const int reps, std::vector<double>& out) {
+	typedef DP::ProjectionT<DP::ProjectionOptions<DP::CD4_SCHEME_DEFAULT, DP::INCIDENCE_RUNTIME, 0, true, layout>, value_t> projection_t;
+	projection_t proj(YEAR_FIRST, YEAR_FINAL);
+	SyntheticInputs inputs(proj.num_years());
+	setup_synthetic_projection(proj, inputs, UPD_FILENAME);
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int k = 0; k < reps; ++k) {
+		proj.invalidate(-1);
+		proj.project(YEAR_FINAL);
+	}
+	auto t1 = std::chrono::steady_clock::now();
+
+	out.assign(2 * proj.num_years(), 0.0);
+	for (int t = 0; t < proj.num_years(); ++t)
+		for (int u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+			for (int b = 0; b < DP::N_AGE_ADULT; ++b)
+				for (int r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+					out[2 * t + 1] += proj.dat.new_hiv_infections(t, u, b + DP::AGE_ADULT_MIN, r);
+					for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+						for (int d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d)
+							out[2 * t] += proj.pop.adult_hiv(t, u, b, r, h, d);
+				}
+
+	return std::chrono::duration<double>(t1 - t0).count() / reps;
+}
+
+double max_rel_diff(const std::vector<double>& x, const std::vector<double>& y) {
+	double err = 0.0;
+	for (std::size_t i = 0; i < x.size(); ++i)
+		if (y[i] > 0.0)
+			err = std::max(err, std::fabs(x[i] - y[i]) / y[i]);
+	return err;
+}
+
+int main(int argc, char** argv) {
+	const int reps = (argc > 1) ? atoi(argv[1]) : 1;
+	const char* names[] = {"compartment", "cell-major", "care-major"};
+	std::vector<double> ref, out;
+	double t_ref, t;
+
+	write_synthetic_upd(UPD_FILENAME);
+
+	printf("%-12s %-6s %10s %9s %13s\n", "layout", "type", "s/proj", "speedup", "max rel diff");
+	t_ref = run<DP::HIV_LAYOUT_COMPARTMENT, double>(reps, ref);
+	printf("%-12s %-6s %10.3f %8.2fx %13.2e\n", names[DP::HIV_LAYOUT_COMPARTMENT], "double", t_ref, 1.0, 0.0);
+	t = run<DP::HIV_LAYOUT_CELL_MAJOR, double>(reps, out);
+	printf("%-12s %-6s %10.3f %8.2fx %13.2e\n", names[DP::HIV_LAYOUT_CELL_MAJOR], "double", t, t_ref / t, max_rel_diff(out, ref));
+	t = run<DP::HIV_LAYOUT_CARE_MAJOR, double>(reps, out);
+	printf("%-12s %-6s %10.3f %8.2fx %13.2e\n", names[DP::HIV_LAYOUT_CARE_MAJOR], "double", t, t_ref / t, max_rel_diff(out, ref));
+	t = run<DP::HIV_LAYOUT_COMPARTMENT, float>(reps, out);
+	printf("%-12s %-6s %10.3f %8.2fx %13.2e\n", names[DP::HIV_LAYOUT_COMPARTMENT], "float", t, t_ref / t, max_rel_diff(out, ref));
+	t = run<DP::HIV_LAYOUT_CELL_MAJOR, float>(reps, out);
+	printf("%-12s %-6s %10.3f %8.2fx %13.2e\n", names[DP::HIV_LAYOUT_CELL_MAJOR], "float", t, t_ref / t, max_rel_diff(out, ref));
+	t = run<DP::HIV_LAYOUT_CARE_MAJOR, float>(reps, out);
+	printf("%-12s %-6s %10.3f %8.2fx %13.2e\n", names[DP::HIV_LAYOUT_CARE_MAJOR], "float", t, t_ref / t, max_rel_diff(out, ref));
+
+	std::remove(UPD_FILENAME);
+	return 0;
+}
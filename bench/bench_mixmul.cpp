@@ -0,0 +1,76 @@
+// Benchmark for the age mixing matrix-vector kernel used in the force of infection.
+// Usage: bench_mixmul [repetitions]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <DPConst.h>
+#include <DPKernels.h>
+
+// Unpadded loop equivalent to the force of infection calculation before vectorization
+void mixmul_reference(const double* mat, const double* x0, const double* x1, double* y0, double* y1, const int nrow, const int ncol, const int lda) {
+	for (int i = 0; i < nrow; ++i) {
+		y0[i] = y1[i] = 0.0;
+		for (int j = 0; j < ncol; ++j) {
+			y0[i] += mat[i * lda + j] * x0[j];
+			y1[i] += mat[i * lda + j] * x1[j];
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	const int nrow = DP::N_AGE_ADULT, ncol = DP::kernel_pad(DP::N_AGE_ADULT);
+	const int reps = (argc > 1) ? atoi(argv[1]) : 200000;
+	const char* names[] = {"scalar", "avx2", "avx512"};
+
+	std::mt19937_64 rng(20240125);
+	std::uniform_real_distribution<double> unif(0.0, 1.0);
+	std::vector<double> mat(nrow * ncol, 0.0), x0(ncol, 0.0), x1(ncol, 0.0);
+	std::vector<double> y0(nrow), y1(nrow), z0(nrow), z1(nrow);
+
+	for (int i = 0; i < nrow; ++i)
+		for (int j = 0; j < nrow; ++j)
+			mat[i * ncol + j] = unif(rng);
+	for (int j = 0; j < nrow; ++j) {
+		x0[j] = unif(rng);
+		x1[j] = unif(rng);
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int k = 0; k < reps; ++k) {
+		x0[k % nrow] += 1e-12; // defeat loop-invariant hoisting
+		mixmul_reference(mat.data(), x0.data(), x1.data(), z0.data(), z1.data(), nrow, nrow, ncol);
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	const double t_ref = std::chrono::duration<double, std::nano>(t1 - t0).count() / reps;
+	printf("%-10s %10.1f ns/call\n", "reference", t_ref);
+
+	for (int isa = DP::KERNEL_SCALAR; isa <= DP::KERNEL_AVX512; ++isa) {
+		if (!DP::kernel_supported(static_cast<DP::kernel_isa_t>(isa))) {
+			printf("%-10s not supported\n", names[isa]);
+			continue;
+		}
+		DP::mixmul_kernel_t mixmul = DP::mixmul_kernel(static_cast<DP::kernel_isa_t>(isa));
+		t0 = std::chrono::steady_clock::now();
+		for (int k = 0; k < reps; ++k) {
+			x0[k % nrow] += 1e-12;
+			mixmul(mat.data(), x0.data(), x1.data(), y0.data(), y1.data(), nrow, ncol);
+		}
+		t1 = std::chrono::steady_clock::now();
+
+		mixmul_reference(mat.data(), x0.data(), x1.data(), z0.data(), z1.data(), nrow, nrow, ncol);
+		mixmul(mat.data(), x0.data(), x1.data(), y0.data(), y1.data(), nrow, ncol);
+		double err = 0.0;
+		for (int i = 0; i < nrow; ++i)
+			err = std::max(err, std::max(std::fabs(y0[i] - z0[i]) / z0[i], std::fabs(y1[i] - z1[i]) / z1[i]));
+
+		const double t_isa = std::chrono::duration<double, std::nano>(t1 - t0).count() / reps;
+		printf("%-10s %10.1f ns/call  speedup %5.2fx  max rel err %.2e\n", names[isa], t_isa, t_ref / t_isa, err);
+	}
+
+	printf("selected:  %s\n", names[DP::kernel_best()]);
+	return 0;
+}
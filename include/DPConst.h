@@ -209,47 +209,101 @@ namespace DP {
 	const int N_STI = STI_MAX - STI_MIN + 1;
 
 	// +=+ Time steps per year for HIV dynamics +=+
+	// These are defaults, see ModelData::hiv_time_steps()
 	const int HIV_TIME_STEPS = 10;
 	const double HIV_STEP_SIZE = 1.0 / HIV_TIME_STEPS;
 
+	// Methods for integrating adult HIV progression, mortality and ART flows over a time step
+	enum integrator_t {
+		INTEGRATOR_EULER       = 0, // forward Euler
+		INTEGRATOR_EXPONENTIAL = 1  // exits from each compartment decay exponentially, split by competing risks
+	};
+
+	// Memory layouts for adults living with HIV (Population::adult_hiv). Accessors
+	// take indices in the same order with every layout
+	enum hiv_layout_t {
+		HIV_LAYOUT_COMPARTMENT = 0, // [t][s][a][r][h][d]: CD4 and care status innermost (DPDefs.h ordering)
+		HIV_LAYOUT_CELL_MAJOR  = 1, // [t][s][a][h][d][r]: risk groups innermost within each sex and age
+		HIV_LAYOUT_CARE_MAJOR  = 2  // [t][d][h][s][a][r]: care status and CD4 outermost within each year
+	};
+
+	// Status codes returned by ProjectionT::save_snapshot and ProjectionT::load_snapshot
+	enum snapshot_status_t {
+		SNAPSHOT_OK             =  0,
+		SNAPSHOT_IO_ERROR       = -1, // the stream or file could not be read or written
+		SNAPSHOT_BAD_FORMAT     = -2, // not a snapshot, or written by an unsupported version
+		SNAPSHOT_INCOMPATIBLE   = -3, // projection years, options or storage type differ
+		SNAPSHOT_INPUT_MISMATCH = -4, // model inputs through the snapshot year differ
+		SNAPSHOT_NOT_PROJECTED  = -5  // no projected year is available to save
+	};
+
 	// +=+ Constants for dynamics assumptions +==================================+
 
-	// Bounds on CD4 cell counts in adults living with HIV
+	// Sources of adult HIV incidence
+	enum incidence_model_t {
+		INCIDENCE_RUNTIME     = 0, // chosen at runtime by ModelData::direct_incidence()
+		INCIDENCE_DIRECT      = 1, // incidence is a model input
+		INCIDENCE_MECHANISTIC = 2  // incidence is calculated from sexual transmission
+	};
+
+	// Adult CD4 categories are interpreted according to a CD4 scheme. Projections
+	// are specialized on the scheme at compile time (see ProjectionOptions), so
+	// both schemes can be used in the same program. Defining SPECTRUM_CD4 makes
+	// CD4_SPECTRUM the default scheme.
+	enum cd4_scheme_t {
+		CD4_GOALS    = 0, // Goals categories: primary infection, >500, [350,500), [200,350), [100,200), [50,100), [0,50)
+		CD4_SPECTRUM = 1  // Spectrum categories: >500, [350,500), [250,350), [200,250), [100, 200), [50, 100), [0,50)
+	};
+
 #ifndef SPECTRUM_CD4
-	const int CD4_ADULT_LOWER[N_HIV_ADULT] = { 500, 500, 350, 200, 100,  50,  0 };
-	const int CD4_ADULT_UPPER[N_HIV_ADULT] = { 999, 999, 500, 350, 200, 100, 50 };
+	const cd4_scheme_t CD4_SCHEME_DEFAULT = CD4_GOALS;
 #else
-	// Enabling SPECTRUM_CD4 changed the interpretation of adult CD4 categories
-	// to match Spectrum categories: >500, [350,500), [250,350), [200,250), [100, 200), [50, 100), [0,50)
-	const int CD4_ADULT_LOWER[N_HIV_ADULT] = { 500, 350, 250, 200, 100,  50,  0 };
-	const int CD4_ADULT_UPPER[N_HIV_ADULT] = { 999, 500, 350, 250, 200, 100, 50 };
+	const cd4_scheme_t CD4_SCHEME_DEFAULT = CD4_SPECTRUM;
 #endif
 
-#ifndef SPECTRUM_CD4
-	// adults who initiate ART while in stage h and ART duration d return to 
-	// infection stage ART_EXIT_STAGE[h][d] at ART interruption. We use -1 as the 
-	// destination for people off ART (d=DTX_UNAWARE, d=DTX_AWARE, d=DTX_PREV_TX) as
-	// ART interruption is not valid in those states
-	const int ART_EXIT_STAGE[N_HIV_ADULT][N_DTX] = {
-		{-1, -1, -1, HIV_GEQ_500, HIV_GEQ_500, HIV_GEQ_500}, // baseline h=HIV_PRIMARY
-		{-1, -1, -1, HIV_GEQ_500, HIV_GEQ_500, HIV_GEQ_500}, // baseline h=HIV_GEQ_500
-		{-1, -1, -1, HIV_350_500, HIV_350_500, HIV_GEQ_500}, // baseline h=HIV_350_500 
-		{-1, -1, -1, HIV_200_350, HIV_200_350, HIV_350_500}, // baseline h=HIV_200_350 
-		{-1, -1, -1, HIV_100_200, HIV_100_200, HIV_200_350}, // baseline h=HIV_100_200 
-		{-1, -1, -1, HIV_050_100, HIV_050_100, HIV_100_200}, // baseline h=HIV_050_100 
-		{-1, -1, -1, HIV_000_050, HIV_000_050, HIV_050_100}, // baseline h=HIV_000_050 
+	// Constants that depend on the CD4 scheme. CD4_LOWER and CD4_UPPER are bounds
+	// on CD4 cell counts in adults living with HIV. Adults who initiate ART while
+	// in stage h and ART duration d return to infection stage ART_EXIT_STAGE[h][d]
+	// at ART interruption. We use -1 as the destination for people off ART
+	// (d=DTX_UNAWARE, d=DTX_AWARE, d=DTX_PREV_TX) as ART interruption is not valid
+	// in those states
+	template<cd4_scheme_t scheme>
+	struct Cd4Scheme;
+
+	template<>
+	struct Cd4Scheme<CD4_GOALS> {
+		static constexpr int CD4_LOWER[N_HIV_ADULT] = { 500, 500, 350, 200, 100,  50,  0 };
+		static constexpr int CD4_UPPER[N_HIV_ADULT] = { 999, 999, 500, 350, 200, 100, 50 };
+		static constexpr int ART_EXIT_STAGE[N_HIV_ADULT][N_DTX] = {
+			{-1, -1, -1, HIV_GEQ_500, HIV_GEQ_500, HIV_GEQ_500}, // baseline h=HIV_PRIMARY
+			{-1, -1, -1, HIV_GEQ_500, HIV_GEQ_500, HIV_GEQ_500}, // baseline h=HIV_GEQ_500
+			{-1, -1, -1, HIV_350_500, HIV_350_500, HIV_GEQ_500}, // baseline h=HIV_350_500 
+			{-1, -1, -1, HIV_200_350, HIV_200_350, HIV_350_500}, // baseline h=HIV_200_350 
+			{-1, -1, -1, HIV_100_200, HIV_100_200, HIV_200_350}, // baseline h=HIV_100_200 
+			{-1, -1, -1, HIV_050_100, HIV_050_100, HIV_100_200}, // baseline h=HIV_050_100 
+			{-1, -1, -1, HIV_000_050, HIV_000_050, HIV_050_100}, // baseline h=HIV_000_050 
+		};
 	};
-#else
-	const int ART_EXIT_STAGE[N_HIV_ADULT][N_DTX] = {
-		{-1, -1, -1, HIV_PRIMARY, HIV_PRIMARY, HIV_PRIMARY}, // Goals HIV_PRIMARY represents Spectrum CD4>500
-		{-1, -1, -1, HIV_GEQ_500, HIV_GEQ_500, HIV_PRIMARY}, // Goals HIV_GEQ_500 represents Spectrum 350-500
-		{-1, -1, -1, HIV_350_500, HIV_350_500, HIV_GEQ_500}, // Goals HIV_350_500 represents Spectrum 250-350
-		{-1, -1, -1, HIV_200_350, HIV_200_350, HIV_350_500}, // Goals HIV_200_350 represents Spectrum 200-250
-		{-1, -1, -1, HIV_100_200, HIV_100_200, HIV_200_350}, // Goals HIV_100_200 represents Spectrum 100-200
-		{-1, -1, -1, HIV_050_100, HIV_050_100, HIV_100_200}, // Goals HIV_050_100 represents Spectrum  50-100
-		{-1, -1, -1, HIV_000_050, HIV_000_050, HIV_050_100}, // Goals HIV_000_050 represents Spectrum   0-50
+
+	template<>
+	struct Cd4Scheme<CD4_SPECTRUM> {
+		static constexpr int CD4_LOWER[N_HIV_ADULT] = { 500, 350, 250, 200, 100,  50,  0 };
+		static constexpr int CD4_UPPER[N_HIV_ADULT] = { 999, 500, 350, 250, 200, 100, 50 };
+		static constexpr int ART_EXIT_STAGE[N_HIV_ADULT][N_DTX] = {
+			{-1, -1, -1, HIV_PRIMARY, HIV_PRIMARY, HIV_PRIMARY}, // Goals HIV_PRIMARY represents Spectrum CD4>500
+			{-1, -1, -1, HIV_GEQ_500, HIV_GEQ_500, HIV_PRIMARY}, // Goals HIV_GEQ_500 represents Spectrum 350-500
+			{-1, -1, -1, HIV_350_500, HIV_350_500, HIV_GEQ_500}, // Goals HIV_350_500 represents Spectrum 250-350
+			{-1, -1, -1, HIV_200_350, HIV_200_350, HIV_350_500}, // Goals HIV_200_350 represents Spectrum 200-250
+			{-1, -1, -1, HIV_100_200, HIV_100_200, HIV_200_350}, // Goals HIV_100_200 represents Spectrum 100-200
+			{-1, -1, -1, HIV_050_100, HIV_050_100, HIV_100_200}, // Goals HIV_050_100 represents Spectrum  50-100
+			{-1, -1, -1, HIV_000_050, HIV_000_050, HIV_050_100}, // Goals HIV_000_050 represents Spectrum   0-50
+		};
 	};
-#endif
+
+	// CD4 constants for the default scheme
+	inline constexpr const int (&CD4_ADULT_LOWER)[N_HIV_ADULT] = Cd4Scheme<CD4_SCHEME_DEFAULT>::CD4_LOWER;
+	inline constexpr const int (&CD4_ADULT_UPPER)[N_HIV_ADULT] = Cd4Scheme<CD4_SCHEME_DEFAULT>::CD4_UPPER;
+	inline constexpr const int (&ART_EXIT_STAGE)[N_HIV_ADULT][N_DTX] = Cd4Scheme<CD4_SCHEME_DEFAULT>::ART_EXIT_STAGE;
 
 	// constant array used to assign partnership types for non-marital, non-cohabiting
 	// partnerships based on sex and behavioral risk group. We use BOND_SAME for
@@ -1,11 +1,19 @@
 #ifndef DPDATA_H
 #define DPDATA_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
 #include <boost/multi_array.hpp>
 #include <string>
 #include <vector>
 #include <GBDemogInterp.h>
+#include <GBUtil.h>
 #include <DPDefs.h>
+#include <DPDemography.h>
 #include <DPUPDData.h>
 
 namespace DP {
@@ -18,7 +26,8 @@ namespace DP {
 		ModelData(const int year_start, const int year_final);
 		~ModelData();
 
-		// Initialize should only initialize model inputs, not model output
+		// Initialize should only initialize model inputs, not model output.
+		// Demographic inputs are read into a new DemographyInputs instance
 		void initialize(const std::string &upd_filename);
 
 		// +=+ Batch initialization +=+
@@ -45,6 +54,23 @@ namespace DP {
 		inline const int year_final() const { return _year_final; }
 		inline const int num_years() const { return _num_years; }
 
+		/// Hash of the model inputs that can affect a projection through time index
+		/// time_end: inputs for times 0 to time_end, and inputs that do not vary over
+		/// time. Model outputs are not included. Used to check that a projection
+		/// snapshot was made with the same inputs
+		std::uint64_t input_hash(const int time_end) const;
+
+		// +=+ Change tracking +=+
+		// Input setters record the earliest time index whose inputs changed value.
+		// Inputs that do not vary over time are recorded at time 0, as are
+		// initialize() and share_*() calls. ProjectionT::project() resumes from the
+		// earliest changed year and then clears the record. Changes written directly
+		// to shared input memory are not tracked; call ProjectionT::invalidate() after those
+		static constexpr int NO_CHANGE = std::numeric_limits<int>::max();
+		inline int changed_time() const {return _changed_time;}
+		inline void mark_changed(const int t) {_changed_time = std::min(_changed_time, t);}
+		inline void clear_changes() {_changed_time = NO_CHANGE;}
+
 		// +=+ Memory transfer +=+
 		// Goals ARM core does not manage its own memory for larger arrays. The functions below
 		// transfer memory to the ModelData object for specific uses.
@@ -78,61 +104,69 @@ namespace DP {
 		/// @param ptr_needle_sharing pointer to the proportion of PWID who share needles by year
 		void share_pwid_risk(double* ptr_pwid_infection_force, double* ptr_needle_sharing);
 
+		/// Use demographic inputs shared with other projections. The instance is not
+		/// modified: demographic setters copy it before changing a value
+		/// @param demography demographic inputs with the same years as this projection
+		void share_demography(const std::shared_ptr<const DemographyInputs>& demography);
+
+		/// Demographic inputs, for sharing with other projections
+		inline std::shared_ptr<const DemographyInputs> demography() const {return _demography;}
+
 		// +=+ Accessors +=+
 		// In accessors, time t=0 denotes year year_start
-		inline double basepop(const int s, const int a) const {return _basepop[s][a];}
+		inline double basepop(const int s, const int a) const {return _demography->basepop(s, a);}
 
-		inline double migration(const int t, const int s, const int a) {return _migration[t][s][a];}
-		inline void migration(const int t, const int s, const int a, const double value) {_migration[t][s][a] = value;}
+		inline double migration(const int t, const int s, const int a) const {return _demography->migration(t, s, a);}
+		inline void migration(const int t, const int s, const int a, const double value) {if (value != migration(t, s, a)) {own_demography().migration(t, s, a, value); mark_changed(t);}}
  
-		inline double lx(const int t, const int s, const int a) const {return _lx[t][s][a];}
-		inline double ex(const int t, const int s, const int a) const {return _ex[t][s][a];}
-		inline double Sx(const int t, const int s, const int a) const {return _Sx[t][s][a];}
+		inline double lx(const int t, const int s, const int a) const {return _demography->lx(t, s, a);}
+		inline double ex(const int t, const int s, const int a) const {return _demography->ex(t, s, a);}
+		inline double Sx(const int t, const int s, const int a) const {return _demography->Sx(t, s, a);}
 
-		inline double tfr(const int t) const {return _tfr[t];}
-		inline void tfr(const int t, const double value) {_tfr[t] = value;}
+		inline double tfr(const int t) const {return _demography->tfr(t);}
+		inline void tfr(const int t, const double value) {if (value != tfr(t)) {own_demography().tfr(t, value); mark_changed(t);}}
 
-		inline double srb(const int t) const {return _srb[t];}
-		inline void srb(const int t, const double value) {_srb[t] = value;}
+		inline double srb(const int t) const {return _demography->srb(t);}
+		inline void srb(const int t, const double value) {if (value != srb(t)) {own_demography().srb(t, value); mark_changed(t);}}
 
 		inline double uptake_male_circumcision(const int t, const int a) const {return _uptake_male_circumcision[t][a];}
-		inline void uptake_male_circumcision(const int t, const int a, const double value) {_uptake_male_circumcision[t][a] = value;}
+		inline void uptake_male_circumcision(const int t, const int a, const double value) {set_input(_uptake_male_circumcision[t][a], value, t);}
 
 		inline double debut_prop(const int s) const {return _debut_prop[s];}
-		inline void debut_prop(const int s, const double value) {_debut_prop[s] = value;}
+		inline void debut_prop(const int s, const double value) {set_input(_debut_prop[s], value, 0);}
 
 		inline double union_prop(const int s) const {return _union_prop[s];}
-		inline void union_prop(const int s, const double value) {_union_prop[s] = value;}
+		inline void union_prop(const int s, const double value) {set_input(_union_prop[s], value, 0);}
 
 		inline double split_prop() const {return _split_prop;}
-		inline void split_prop(const double value) {_split_prop = value;}
+		inline void split_prop(const double value) {set_input(_split_prop, value, 0);}
 
 		inline double prop_debut_in_union(const int s) const {return _prop_debut_in_union[s];}
-		inline void prop_debut_in_union(const int s, const double value) {_prop_debut_in_union[s] = value;}
+		inline void prop_debut_in_union(const int s, const double value) {set_input(_prop_debut_in_union[s], value, 0);}
 
 		// r must be DP::POP_MSM, DP::POP_TGW, DP::POP_FSW, DP::POP_KEY, or DP::POP_PWID
 		inline double keypop_exit_prop(const int s, const int r) const {return _keypop_exit_prop[s][r - DP::POP_KEY_MIN];}
-		inline void keypop_exit_prop(const int s, const int r, const double value) {_keypop_exit_prop[s][r - DP::POP_KEY_MIN] = value;}
+		inline void keypop_exit_prop(const int s, const int r, const double value) {set_input(_keypop_exit_prop[s][r - DP::POP_KEY_MIN], value, 0);}
 
 		// r must be DP::POP_MSM, DP::POP_TGW, DP::POP_FSW, DP::POP_KEY, or DP::POP_PWID
 		inline double keypop_size(const int s, const int r) const {return _keypop_size[s][r - DP::POP_KEY_MIN];}
-		inline void keypop_size(const int s, const int r, const double value) {_keypop_size[s][r - DP::POP_KEY_MIN] = value;}
+		inline void keypop_size(const int s, const int r, const double value) {set_input(_keypop_size[s][r - DP::POP_KEY_MIN], value, 0);}
 
 		// r must be DP::POP_MSM, DP::POP_TGW, DP::POP_FSW, DP::POP_KEY, or DP::POP_PWID
 		inline bool keypop_stay(const int s, const int r) const {return _keypop_stay[s][r - DP::POP_KEY_MIN];}
-		inline void keypop_stay(const int s, const int r, const bool value) {_keypop_stay[s][r - DP::POP_KEY_MIN] = value;}
+		inline void keypop_stay(const int s, const int r, const bool value) {set_input(_keypop_stay[s][r - DP::POP_KEY_MIN], value, 0);}
 
 		// r must be DP::POP_MSM, DP::POP_TGW, DP::POP_FSW, DP::POP_KEY, or DP::POP_PWID
 		inline double keypop_age_dist(const int s, const int a, const int r) const {return _keypop_age_dist[s][a][r - DP::POP_KEY_MIN];}
-		inline void keypop_age_dist(const int s, const int a, const int r, const double value) {_keypop_age_dist[s][a][r - DP::POP_KEY_MIN] = value;}
+		inline void keypop_age_dist(const int s, const int a, const int r, const double value) {set_input(_keypop_age_dist[s][a][r - DP::POP_KEY_MIN], value, 0);}
 
 		// r must be DP::POP_MSM, DP::POP_TGW, DP::POP_FSW, DP::POP_KEY, or DP::POP_PWID
 		inline double keypop_married(const int s, const int r) const {return _keypop_married[s][r - DP::POP_KEY_MIN];}
-		inline void keypop_married(const int s, const int r, const double value) {_keypop_married[s][r - DP::POP_KEY_MIN] = value;}
+		inline void keypop_married(const int s, const int r, const double value) {set_input(_keypop_married[s][r - DP::POP_KEY_MIN], value, 0);}
 
 		// Access using age 15 <= a < 50
-		inline double pasfrs(const int t, const int a) const {return _pasfrs[t][a - DP::AGE_BIRTH_MIN];}
-		inline void pasfrs(const int t, const int a, const double value) {_pasfrs[t][a - DP::AGE_BIRTH_MIN] = value;}
+		inline double pasfrs(const int t, const int a) const {return _demography->pasfrs(t, a);}
+		inline void pasfrs(const int t, const int a, const double value) {if (value != pasfrs(t, a)) {own_demography().pasfrs(t, a, value); mark_changed(t);}}
 
 		inline double births(const int t, const int s) const {return (*_births)[t][s];}
 		inline void births(const int t, const int s, const popsize_t value) {(*_births)[t][s] = value;}
@@ -151,116 +185,171 @@ namespace DP {
 		inline void new_hiv_infections(const int t, const int s, const int a, const int r, const double value) {(*_new_hiv_infections)[t][s][a][r] = value;}
 
 		inline bool direct_incidence() const {return _direct_incidence;}
-		inline void direct_incidence(const bool value) {_direct_incidence = value;}
+		inline void direct_incidence(const bool value) {set_input(_direct_incidence, value, 0);}
 
 		inline double incidence(const int t) const {return _incidence[t];}
-		inline void incidence(const int t, const double value) {_incidence[t] = value;}
+		inline void incidence(const int t, const double value) {set_input(_incidence[t], value, t);}
 
 		inline double irr_sex(const int t) const {return _irr_sex[t];}
-		inline void irr_sex(const int t, const double value) {_irr_sex[t] = value;}
+		inline void irr_sex(const int t, const double value) {set_input(_irr_sex[t], value, t);}
 
 		inline double irr_age(const int t, const int s, const int a) const {return _irr_age[t][s][a];}
-		inline void irr_age(const int t, const int s, const int a, const double value) {_irr_age[t][s][a] = value;}
+		inline void irr_age(const int t, const int s, const int a, const double value) {set_input(_irr_age[t][s][a], value, t);}
 
 		inline double irr_pop(const int t, const int s, const int r) const {return _irr_pop[t][s][r];}
-		inline void irr_pop(const int t, const int s, const int r, const double value) {_irr_pop[t][s][r] = value;}
+		inline void irr_pop(const int t, const int s, const int r, const double value) {set_input(_irr_pop[t][s][r], value, t);}
 
 		// This should be relative to the epidemic start year (e.g., seed_time=5 for a projection
 		// that starts in 1970 and epidemic that starts in 1975)
 		inline int seed_time() const {return _seed_time;}
-		inline void seed_time(const int time) {_seed_time = time;}
+		inline void seed_time(const int time) {set_input(_seed_time, time, 0);}
 
 		inline double seed_prevalence() const {return _seed_prev;}
-		inline void seed_prevalence(const double prev) {_seed_prev = prev;}
+		inline void seed_prevalence(const double prev) {set_input(_seed_prev, prev, 0);}
 
 		inline double partner_rate(const int t, const int s, const int a, const int r) const {return (*_partner_rate)[t][s][a][r];}
-		inline void partner_rate(const int t, const int s, const int a, const int r, const double value) {(*_partner_rate)[t][s][a][r] = value;}
+		inline void partner_rate(const int t, const int s, const int a, const int r, const double value) {set_input((*_partner_rate)[t][s][a][r], value, t);}
 
 		inline double partner_preference_age(const int s1, const int a1, const int s2, const int a2) const {return (*_partner_preference_age)[s1][a1][s2][a2];}
-		inline void partner_preference_age(const int s1, const int a1, const int s2, const int a2, const double value) {(*_partner_preference_age)[s1][a1][s2][a2] = value;}
+		inline void partner_preference_age(const int s1, const int a1, const int s2, const int a2, const double value) {set_input((*_partner_preference_age)[s1][a1][s2][a2], value, 0);}
 
 		inline double partner_assortativity(const int s, const int r) const {return (*_partner_assortativity)[s][r];}
-		inline void partner_assortativity(const int s, const int r, const double value) {(*_partner_assortativity)[s][r] = value;}
+		inline void partner_assortativity(const int s, const int r, const double value) {set_input((*_partner_assortativity)[s][r], value, 0);}
 
 		inline int mix_structure(const int s1, const int r1, const int s2, const int r2) const {return _mix_structure[s1][r1][s2][r2];}
-		inline void mix_structure(const int s1, const int r1, const int s2, const int r2, const int value) {_mix_structure[s1][r1][s2][r2] = value;}
+		inline void mix_structure(const int s1, const int r1, const int s2, const int r2, const int value) {set_input(_mix_structure[s1][r1][s2][r2], value, 0); index_mix_structure();}
+
+		// Sparse index of the groups (s2,r2) that can form non-marital partnerships
+		// with (s1,r1), stored in compressed sparse row format. This is updated whenever
+		// mix_structure changes. A pair is included only if both groups may get partners
+		// from each other, since partnerships are balanced between the two. Usage:
+		// for (k = mix_index_begin(s1, r1); k < mix_index_end(s1, r1); ++k) {
+		//   s2 = mix_index_sex(k);
+		//   r2 = mix_index_pop(k);
+		// }
+		inline int mix_index_begin(const int s, const int r) const {return _mix_index_row[s * DP::N_POP + r];}
+		inline int mix_index_end(const int s, const int r) const {return _mix_index_row[s * DP::N_POP + r + 1];}
+		inline int mix_index_sex(const int k) const {return _mix_index_sex[k];}
+		inline int mix_index_pop(const int k) const {return _mix_index_pop[k];}
+
+		// Toggle whether mixing between behavioral risk groups is recalculated at
+		// every HIV time step (false, default) or only at the first step of each year (true).
+		// Partnerships remain balanced either way, since balancing by age is still done every step
+		inline bool mix_balance_annual() const {return _mix_balance_annual;}
+		inline void mix_balance_annual(const bool value) {set_input(_mix_balance_annual, value, 0);}
+
+		// Width in years of the age bands used to calculate the force of infection from
+		// sexual transmission. The default width of 1 uses single ages. Wider bands give
+		// a faster approximate model, e.g. for early iterations of model fitting. See
+		// README.md for accuracy. Throws std::invalid_argument if width < 1
+		inline int transmission_age_band() const {return _transmission_age_band;}
+		inline void transmission_age_band(const int width) {
+			if (width < 1) throw std::invalid_argument("Transmission age band width must be at least 1 year");
+			set_input(_transmission_age_band, width, 0);
+		}
 
 		inline double sex_acts(const int bond) const {return _sex_acts[bond];}
-		inline void sex_acts(const int bond, const double value) {_sex_acts[bond] = value;}
+		inline void sex_acts(const int bond, const double value) {set_input(_sex_acts[bond], value, 0);}
 
 		inline double condom_freq(const int t, const int bond) const {return _condom_freq[t][bond];}
-		inline void condom_freq(const int t, const int bond, const double value) {_condom_freq[t][bond] = value;}
+		inline void condom_freq(const int t, const int bond, const double value) {set_input(_condom_freq[t][bond], value, t);}
 
 		inline double sti_prev(const int t, const int s, const int a, const int r) const {return _sti_prev[t][s][a][r];}
-		inline void sti_prev(const int t, const int s, const int a, const int r, const double value) {_sti_prev[t][s][a][r] = value;}
+		inline void sti_prev(const int t, const int s, const int a, const int r, const double value) {set_input(_sti_prev[t][s][a][r], value, t);}
 
 		inline double pwid_infection_force(const int t, const int s) const {return (*_pwid_infection_force)[t][s];}
-		inline void pwid_infection_force(const int t, const int s, const double value) {(*_pwid_infection_force)[t][s] = value;}
+		inline void pwid_infection_force(const int t, const int s, const double value) {set_input((*_pwid_infection_force)[t][s], value, t);}
 
 		inline double pwid_needle_sharing(const int t) const {return (*_pwid_needle_sharing)[t];}
-		inline void pwid_needle_sharing(const int t, const double value) {(*_pwid_needle_sharing)[t] = value;}
+		inline void pwid_needle_sharing(const int t, const double value) {set_input((*_pwid_needle_sharing)[t], value, t);}
 
 		inline double hiv_dist(const int s, const int a, const int h) const {return _hiv_dist[s][a][h];}
-		inline void hiv_dist(const int s, const int a, const int h, const double value) {_hiv_dist[s][a][h] = value;}
+		inline void hiv_dist(const int s, const int a, const int h, const double value) {set_input(_hiv_dist[s][a][h], value, 0);}
 
 		inline double hiv_prog(const int s, const int a, const int h) const {return _hiv_prog[s][a][h];}
-		inline void hiv_prog(const int s, const int a, const int h, const double value) {_hiv_prog[s][a][h] = value;}
+		inline void hiv_prog(const int s, const int a, const int h, const double value) {set_input(_hiv_prog[s][a][h], value, 0);}
 
 		inline double hiv_mort(const int s, const int a, const int h) const {return _hiv_mort[s][a][h];}
-		inline void hiv_mort(const int s, const int a, const int h, const double value) {_hiv_mort[s][a][h] = value;}
+		inline void hiv_mort(const int s, const int a, const int h, const double value) {set_input(_hiv_mort[s][a][h], value, 0);}
 
 		// transmission risk per sex act, indexed by HIV- partner sex s_neg and HIV+ partner sex s_pos, HIV stage h, and viral load status v
 		// h is stage_t (primary/chronic/symptomatic stages), not hiv_t (CD4 stages)
 		inline double hiv_risk_per_act(const int s_neg, const int s_pos, const int h, const int v) const {return _hiv_transmit[s_neg][s_pos][h][v];}
-		inline void hiv_risk_per_act(const int s_neg, const int s_pos, const int h, const int v, const double value) {_hiv_transmit[s_neg][s_pos][h][v] = value;}
+		inline void hiv_risk_per_act(const int s_neg, const int s_pos, const int h, const int v, const double value) {set_input(_hiv_transmit[s_neg][s_pos][h][v], value, 0); update_log_escape();}
+
+		// Log-probabilities of escaping infection per sex act without and with a condom,
+		// log(1-p) and log(1-p*effect_condom), where p is the per-act risk adjusted for STI
+		// symptom status. Each table is indexed [s_neg][s_pos][h][v][z] and stored contiguously
+		// with z varying fastest. These are updated whenever hiv_risk_per_act, effect_sti_hivpos,
+		// effect_sti_hivneg, or effect_condom change, so the probability of transmission per
+		// partnership only requires exp of a linear combination of these tables
+		inline double log_escape(const int s_neg, const int s_pos, const int h, const int v, const int z) const {return _log_escape[s_neg][s_pos][h][v][z];}
+		inline double log_escape_condom(const int s_neg, const int s_pos, const int h, const int v, const int z) const {return _log_escape_condom[s_neg][s_pos][h][v][z];}
+		inline const double* log_escape() const {return &_log_escape[0][0][0][0][0];}
+		inline const double* log_escape_condom() const {return &_log_escape_condom[0][0][0][0][0];}
 
 		inline double art_mort_adult(const int t, const int s, const int a, const int h, const int d) const {return _art_mort_adult[t][s][a][h][d];}
-		inline void art_mort_adult(const int t, const int s, const int a, const int h, const int d, const double value)  {_art_mort_adult[t][s][a][h][d] = value;}
+		inline void art_mort_adult(const int t, const int s, const int a, const int h, const int d, const double value)  {set_input(_art_mort_adult[t][s][a][h][d], value, t);}
 
 		inline double art_num_adult(const int t, const int s) const {return _art_num_adult[t][s];}
-		inline void art_num_adult(const int t, const int s, const double value) {_art_num_adult[t][s] = value;}
+		inline void art_num_adult(const int t, const int s, const double value) {set_input(_art_num_adult[t][s], value, t);}
 
 		inline double art_prop_adult(const int t, const int s) const {return _art_prop_adult[t][s];}
-		inline void art_prop_adult(const int t, const int s, const double value) {_art_prop_adult[t][s] = value;}
+		inline void art_prop_adult(const int t, const int s, const double value) {set_input(_art_prop_adult[t][s], value, t);}
 
 		inline double art_exit_adult(const int t, const int s) const {return _art_exit_adult[t][s];}
-		inline void art_exit_adult(const int t, const int s, const double value) {_art_exit_adult[t][s] = value;}
+		inline void art_exit_adult(const int t, const int s, const double value) {set_input(_art_exit_adult[t][s], value, t);}
 
 		inline double art_suppressed_adult(const int t, const int s, const int a) const {return _art_suppressed_adult[t][s][a];}
-		inline void art_suppressed_adult(const int t, const int s, const int a, const double value) {_art_suppressed_adult[t][s][a] = value;}
+		inline void art_suppressed_adult(const int t, const int s, const int a, const double value) {set_input(_art_suppressed_adult[t][s][a], value, t);}
 
 		inline int art_first_eligible_stage_adult(const int t) const {return _art_first_eligible_stage_adult[t];}
-		inline void art_first_eligible_stage_adult(const int t, const int h) {_art_first_eligible_stage_adult[t] = h;}
+		inline void art_first_eligible_stage_adult(const int t, const int h) {set_input(_art_first_eligible_stage_adult[t], h, t);}
 
 		inline double art_mort_weight() const {return _art_mort_weight;}
-		inline void art_mort_weight(const double value) {_art_mort_weight = value;}
+		inline void art_mort_weight(const double value) {set_input(_art_mort_weight, value, 0);}
 
 		inline double art_flow(const int d) const {return _art_flow[d-DP::DTX_ART_MIN];}
-		inline void art_flow(const int d, const double value) {_art_flow[d-DP::DTX_ART_MIN] = value;}
+		inline void art_flow(const int d, const double value) {set_input(_art_flow[d-DP::DTX_ART_MIN], value, 0);}
+
+		// Number of HIV time steps per year, DP::HIV_TIME_STEPS by default. Fewer steps
+		// give faster projections; use INTEGRATOR_EXPONENTIAL to keep accuracy with 2-4 steps.
+		// Throws std::invalid_argument if value < 1
+		inline int hiv_time_steps() const {return _hiv_time_steps;}
+		inline void hiv_time_steps(const int value) {
+			if (value < 1) throw std::invalid_argument("Number of HIV time steps per year must be at least 1");
+			set_input(_hiv_time_steps, value, 0);
+		}
+		inline double hiv_step_size() const {return 1.0 / _hiv_time_steps;}
+
+		// Method used to integrate adult HIV progression, mortality and ART flows
+		// over each HIV time step, INTEGRATOR_EULER by default
+		inline integrator_t hiv_integrator() const {return _hiv_integrator;}
+		inline void hiv_integrator(const integrator_t value) {set_input(_hiv_integrator, value, 0);}
 
 		inline double frr_age_no_art(const int t, const int a) const {return _frr_age_no_art[t][a];}
-		inline void frr_age_no_art(const int t, const int a, const double value) {_frr_age_no_art[t][a] = value;}
+		inline void frr_age_no_art(const int t, const int a, const double value) {set_input(_frr_age_no_art[t][a], value, t);}
 
 		inline double frr_age_on_art(const int a) const {return _frr_age_on_art[a];}
-		inline void frr_age_on_art(const int a, const double value) {_frr_age_on_art[a] = value;}
+		inline void frr_age_on_art(const int a, const double value) {set_input(_frr_age_on_art[a], value, 0);}
 
 		inline double frr_cd4_no_art(const int h) const {return _frr_cd4_no_art[h];}
-		inline void frr_cd4_no_art(const int h, const double value) {_frr_cd4_no_art[h] = value;}
+		inline void frr_cd4_no_art(const int h, const double value) {set_input(_frr_cd4_no_art[h], value, 0);}
 
 		inline double clhiv_agein(const int t, const int s, const int h, const int d) const {return _clhiv_agein[t][s][h][d];}
-		inline void clhiv_agein(const int t, const int s, const int h, const int d, const double value) {_clhiv_agein[t][s][h][d] = value;}
+		inline void clhiv_agein(const int t, const int s, const int h, const int d, const double value) {set_input(_clhiv_agein[t][s][h][d], value, t);}
 
 		inline double effect_sti_hivpos() const {return _effect_sti_hivpos;}
-		inline void effect_sti_hivpos(const double value) {_effect_sti_hivpos = value;}
+		inline void effect_sti_hivpos(const double value) {set_input(_effect_sti_hivpos, value, 0); update_log_escape();}
 
 		inline double effect_sti_hivneg() const {return _effect_sti_hivneg;}
-		inline void effect_sti_hivneg(const double value) {_effect_sti_hivneg = value;}
+		inline void effect_sti_hivneg(const double value) {set_input(_effect_sti_hivneg, value, 0); update_log_escape();}
 
 		inline double effect_vmmc() const {return _effect_vmmc;}
-		inline void effect_vmmc(const double value) {_effect_vmmc = value;}
+		inline void effect_vmmc(const double value) {set_input(_effect_vmmc, value, 0);}
 
 		inline double effect_condom() const {return _effect_condom;}
-		inline void effect_condom(const double value) {_effect_condom = value;}
+		inline void effect_condom(const double value) {set_input(_effect_condom, value, 0); update_log_escape();}
 
 	private:
 		// Model inputs
@@ -268,14 +357,9 @@ namespace DP {
 		int _year_final;
 		int _num_years;
 
-		sex_age_t      _basepop;
-		year_sex_age_t _lx;
-		year_sex_age_t _ex;
-		year_sex_age_t _Sx;
-		time_series_t  _tfr;
-		time_series_t  _srb;
-		year_age_t     _pasfrs;
-		year_sex_age_t _migration;
+		// Demographic inputs, possibly shared with other projections. Only modified
+		// through own_demography()
+		std::shared_ptr<DemographyInputs> _demography;
 
 		year_age_t     _uptake_male_circumcision;
 
@@ -316,6 +400,11 @@ namespace DP {
 		// value=1 : group (s1,r1) may get partners from (s2,r2)
 		// value=2 : group (s1,r1) prefers partners from (s2,r2)
 		int _mix_structure[DP::N_SEX][DP::N_POP][DP::N_SEX][DP::N_POP];
+		int _mix_index_row[DP::N_SEX * DP::N_POP + 1];
+		int _mix_index_sex[DP::N_SEX * DP::N_POP * DP::N_SEX * DP::N_POP];
+		int _mix_index_pop[DP::N_SEX * DP::N_POP * DP::N_SEX * DP::N_POP];
+		bool _mix_balance_annual; // toggle for annual vs. per-step risk group mixing calculation
+		int _transmission_age_band; // age band width for the force of infection calculation
 
 		// Model inputs - sexual behavior within partnerships
 		double _sex_acts[DP::N_BOND]; // sex acts per partner per year
@@ -337,6 +426,8 @@ namespace DP {
 
 		// Model inputs - HIV transmission probability per sex act
 		double _hiv_transmit[DP::N_SEX][DP::N_SEX][DP::N_STAGE][DP::N_VL];
+		double _log_escape[DP::N_SEX][DP::N_SEX][DP::N_STAGE][DP::N_VL][DP::N_STI];        // log(1-p) by STI symptom status
+		double _log_escape_condom[DP::N_SEX][DP::N_SEX][DP::N_STAGE][DP::N_VL][DP::N_STI]; // log(1-p*effect_condom) by STI symptom status
 
 		// Model inputs - adult ART
 		year_sex_age_hiv_dtx_t _art_mort_adult;  // mortality rates on ART
@@ -345,6 +436,8 @@ namespace DP {
 		year_sex_t             _art_exit_adult;  // ART interruption rates
 		year_sex_age_t         _art_suppressed_adult; // proportion on ART who are virally suppressed
 		double                 _art_flow[DP::N_ART]; // flow rates between ART duration categories
+		int                    _hiv_time_steps; // number of HIV time steps per year
+		integrator_t           _hiv_integrator; // integration method for adult HIV flows
 		double                 _art_mort_weight; // weight placed on expected mortality when allocating ART
 
 		time_series_int_t      _art_first_eligible_stage_adult; // index of the earliest HIV stage that is eligible for ART by CD4 count threshold
@@ -369,6 +462,26 @@ namespace DP {
 		time_series_ref_t* _births_exposed;
 
 		year_sex_age_pop_ref_t* _new_hiv_infections;
+
+		// Rebuild the sparse index of _mix_structure
+		void index_mix_structure();
+
+		// Recalculate _log_escape and _log_escape_condom
+		void update_log_escape();
+
+		// Earliest time index with changed inputs, or NO_CHANGE
+		int _changed_time;
+
+		// Demographic inputs for modification, copied first if they are shared
+		DemographyInputs& own_demography();
+
+		// Store an input and record time t as changed if the value differs
+		template<typename T, typename U>
+		inline void set_input(T& x, const U value, const int t) {if (x != value) {x = value; mark_changed(t);}}
+
+		// Add times 0 to time_end of an array indexed by time first to hash
+		template<typename array_t>
+		static void hash_years(GB::fnv1a_hash& hash, const array_t& x, const int time_end);
 	};
 
 	template<typename popsize_t>
@@ -377,14 +490,7 @@ namespace DP {
 			_year_final(year_final),
 			_num_years(year_final - year_start + 1),
 
-			_basepop(sex_age_t(boost::extents[DP::N_SEX][DP::N_AGE])),
-			_lx(year_sex_age_t(boost::extents[year_final - year_start + 1][DP::N_SEX][DP::N_AGE])),
-			_ex(year_sex_age_t(boost::extents[year_final - year_start + 1][DP::N_SEX][DP::N_AGE])),
-			_Sx(year_sex_age_t(boost::extents[year_final - year_start + 1][DP::N_SEX][DP::N_AGE + 1])),
-			_tfr(time_series_t(year_final - year_start + 1)),
-			_srb(time_series_t(year_final - year_start + 1)),
-			_pasfrs(year_age_t(boost::extents[year_final - year_start + 1][DP::N_AGE_BIRTH])),
-			_migration(year_sex_age_t(boost::extents[year_final - year_start + 1][DP::N_SEX][DP::N_AGE])),
+			_demography(std::make_shared<DemographyInputs>(year_start, year_final)),
 
 			_uptake_male_circumcision(year_age_t(boost::extents[year_final - year_start + 1][DP::N_AGE])),
 	
@@ -401,6 +507,9 @@ namespace DP {
 
 			_sti_prev(year_sex_age_pop_t(boost::extents[year_final - year_start + 1][DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP])),
 
+			_pwid_infection_force(NULL),
+			_pwid_needle_sharing(NULL),
+
 			_hiv_dist(sex_age_hiv_t(boost::extents[DP::N_SEX][DP::N_AGE][DP::N_HIV])),
 			_hiv_prog(sex_age_hiv_t(boost::extents[DP::N_SEX][DP::N_AGE][DP::N_HIV])),
 			_hiv_mort(sex_age_hiv_t(boost::extents[DP::N_SEX][DP::N_AGE][DP::N_HIV])),
@@ -420,11 +529,44 @@ namespace DP {
 			_births_exposed(NULL),
 			_deaths(year_sex_age_t(boost::extents[year_final - year_start + 1][DP::N_SEX][DP::N_AGE])),
 			_popsize(year_sex_age_t(boost::extents[year_final - year_start + 1][DP::N_SEX][DP::N_AGE])),
-			_new_hiv_infections(NULL)
+			_new_hiv_infections(NULL),
+			_changed_time(0)
 	{
 		art_flow(DP::DTX_ART1, 2.0); // 6 months in 1st ART state [0,6)  months
 		art_flow(DP::DTX_ART2, 2.0); // 6 months in 2nd ART state [6,12) months
 		art_flow(DP::DTX_ART3, 0.0); // absorbing state [12,\infty) months
+		hiv_time_steps(DP::HIV_TIME_STEPS);
+		hiv_integrator(DP::INTEGRATOR_EULER);
+		mix_balance_annual(false);
+		transmission_age_band(1);
+
+		// Scalar inputs start at zero so that input_hash() is reproducible when
+		// inputs a projection does not use are never set
+		std::fill_n(_debut_prop, DP::N_SEX, 0.0);
+		std::fill_n(_union_prop, DP::N_SEX, 0.0);
+		std::fill_n(_prop_debut_in_union, DP::N_SEX, 0.0);
+		std::fill_n(&_keypop_exit_prop[0][0], DP::N_SEX * DP::N_POP_KEY, 0.0);
+		std::fill_n(&_keypop_size[0][0], DP::N_SEX * DP::N_POP_KEY, 0.0);
+		std::fill_n(&_keypop_stay[0][0], DP::N_SEX * DP::N_POP_KEY, false);
+		std::fill_n(&_keypop_age_dist[0][0][0], DP::N_SEX * DP::N_AGE_ADULT * DP::N_POP_KEY, 0.0);
+		std::fill_n(&_keypop_married[0][0], DP::N_SEX * DP::N_POP_KEY, 0.0);
+		std::fill_n(_sex_acts, DP::N_BOND, 0.0);
+		std::fill_n(_frr_age_on_art, DP::N_AGE_BIRTH, 0.0);
+		std::fill_n(_frr_cd4_no_art, DP::N_HIV_ADULT, 0.0);
+		_split_prop = 0.0;
+		_direct_incidence = false;
+		_seed_time = 0;
+		_seed_prev = 0.0;
+		_art_mort_weight = 0.0;
+		_effect_vmmc = 0.0;
+
+		std::fill_n(&_hiv_transmit[0][0][0][0], DP::N_SEX * DP::N_SEX * DP::N_STAGE * DP::N_VL, 0.0);
+		_effect_sti_hivpos = 1.0;
+		_effect_sti_hivneg = 1.0;
+		_effect_condom = 0.0;
+		update_log_escape();
+		std::fill_n(&_mix_structure[0][0][0][0], DP::N_SEX * DP::N_POP * DP::N_SEX * DP::N_POP, 0);
+		index_mix_structure();
 	}
 
 	template<typename popsize_t>
@@ -439,55 +581,26 @@ namespace DP {
 
 	template<typename popsize_t>
 	void ModelData<popsize_t>::initialize(const std::string &upd_filename) {
-		const int year_upd[4] = {1970, 1975, 1980, 1985}; // years when basepop is defined in UPD files
-		int time_upd, time_dat, s, a, i;
-		double wgt1, wgt2;
-		UPDData upd;
-
-		upd.read(upd_filename);
-
-		// Calculate baseyear population by linearly interpolating between surrounding upd base populations
-		if (_year_first >= year_upd[0] && _year_first < year_upd[1])
-			i = 0;
-		else if (_year_first >= year_upd[1] && _year_first < year_upd[2])
-			i = 1;
-		else
-			i = 2;
-
-		wgt2 = (_year_first - year_upd[i]) / static_cast<double>(year_upd[i+1] - year_upd[i]);
-		wgt1 = 1.0 - wgt2;
-
-		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
-			for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a) {
-				_basepop[s][a] = wgt1 * upd.basepop(i,s,a) + wgt2 * upd.basepop(i+1,s,a);
-			}
-		}
-
-		for (time_dat = 0; time_dat < _num_years; ++time_dat) {
-			time_upd = time_dat + _year_first - UPDData::UPD_YEAR_START;
-
-			_tfr[time_dat] = upd.tfr(time_upd);
-			_srb[time_dat] = upd.srb(time_upd);
-
-			for (a = DP::AGE_BIRTH_MIN; a <= DP::AGE_BIRTH_MAX; ++a) {
-				_pasfrs[time_dat][a - DP::AGE_BIRTH_MIN] = upd.pasfrs(time_upd,a);
-			}
-
-			for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
-				for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a) {
-					_lx[time_dat][s][a] = upd.lx(time_upd,s,a);
-					_ex[time_dat][s][a] = upd.ex(time_upd,s,a);
-					
+		std::shared_ptr<DemographyInputs> demography(std::make_shared<DemographyInputs>(_year_first, _year_final));
+		demography->initialize(upd_filename);
+		_demography = demography;
+		mark_changed(0);
+	}
 
-					_migration[time_dat][s][a] = upd.migration(time_upd,s,a);
-				}
-			}
+	template<typename popsize_t>
+	void ModelData<popsize_t>::share_demography(const std::shared_ptr<const DemographyInputs>& demography) {
+		if (demography->year_first() != _year_first || demography->year_final() != _year_final)
+			throw std::invalid_argument("Shared demographic inputs must have the same years as the projection");
+		// Held as non-const so that own_demography() can modify it once no longer shared
+		_demography = std::const_pointer_cast<DemographyInputs>(demography);
+		mark_changed(0);
+	}
 
-			for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
-				for (a = DP::AGE_MIN; a <= DP::AGE_MAX + 1; ++a)
-					_Sx[time_dat][s][a] = upd.Sx(time_upd,s,a);
-			}
-		}
+	template<typename popsize_t>
+	DemographyInputs& ModelData<popsize_t>::own_demography() {
+		if (_demography.use_count() > 1)
+			_demography = std::make_shared<DemographyInputs>(*_demography);
+		return *_demography;
 	}
 
 	template<typename popsize_t>
@@ -546,6 +659,136 @@ namespace DP {
 		}
 	}
 
+	template<typename popsize_t>
+	void ModelData<popsize_t>::index_mix_structure() {
+		int s1, r1, s2, r2, k(0);
+		for (s1 = DP::SEX_MIN; s1 <= DP::SEX_MAX; ++s1)
+			for (r1 = DP::POP_MIN; r1 <= DP::POP_MAX; ++r1) {
+				_mix_index_row[s1 * DP::N_POP + r1] = k;
+				if (r1 < DP::N_POP_SEX[s1])
+					for (s2 = DP::SEX_MIN; s2 <= DP::SEX_MAX; ++s2)
+						for (r2 = DP::POP_MIN; r2 < DP::N_POP_SEX[s2]; ++r2)
+							if (DP::BOND_TYPE[s1][r1][s2][r2] >= 0 && _mix_structure[s1][r1][s2][r2] > 0 && _mix_structure[s2][r2][s1][r1] > 0) {
+								_mix_index_sex[k] = s2;
+								_mix_index_pop[k] = r2;
+								++k;
+							}
+			}
+		_mix_index_row[DP::N_SEX * DP::N_POP] = k;
+	}
+
+	template<typename popsize_t>
+	void ModelData<popsize_t>::update_log_escape() {
+		// log(1-p). Transmission is certain when p >= 1, so the lowest finite double is
+		// used instead of -inf: zero acts then still give a zero probability of
+		// transmission, where 0 * -inf would be NaN
+		const auto log_escape_prob = [](const double p) {return p < 1.0 ? log1p(-p) : std::numeric_limits<double>::lowest();};
+		double per_act[DP::N_STI];
+		int s_neg, s_pos, h, v, z;
+		for (s_neg = DP::SEX_MIN; s_neg <= DP::SEX_MAX; ++s_neg)
+			for (s_pos = DP::SEX_MIN; s_pos <= DP::SEX_MAX; ++s_pos)
+				for (h = 0; h < DP::N_STAGE; ++h)
+					for (v = 0; v < DP::N_VL; ++v) {
+						per_act[DP::STI_NONE] = _hiv_transmit[s_neg][s_pos][h][v];
+						per_act[DP::STI_HIVN] = per_act[DP::STI_NONE] * _effect_sti_hivneg / (1.0 - per_act[DP::STI_NONE] + per_act[DP::STI_NONE] * _effect_sti_hivneg);
+						per_act[DP::STI_HIVP] = per_act[DP::STI_NONE] * _effect_sti_hivpos / (1.0 - per_act[DP::STI_NONE] + per_act[DP::STI_NONE] * _effect_sti_hivpos);
+						per_act[DP::STI_BOTH] = std::max(per_act[DP::STI_HIVN], per_act[DP::STI_HIVP]); // like doi:10.1136/sti.2006.023531, we assume the only bigger STI effect applies
+						for (z = 0; z < DP::N_STI; ++z) {
+							_log_escape[s_neg][s_pos][h][v][z] = log_escape_prob(per_act[z]);
+							_log_escape_condom[s_neg][s_pos][h][v][z] = log_escape_prob(per_act[z] * _effect_condom);
+						}
+					}
+	}
+
+	template<typename popsize_t>
+	template<typename array_t>
+	void ModelData<popsize_t>::hash_years(GB::fnv1a_hash& hash, const array_t& x, const int time_end) {
+		hash.update(x.data(), (time_end + 1) * (x.num_elements() / x.size()));
+	}
+
+	template<typename popsize_t>
+	std::uint64_t ModelData<popsize_t>::input_hash(const int time_end) const {
+		GB::fnv1a_hash hash;
+		const bool shared[5] = {_partner_rate != NULL, _partner_preference_age != NULL, _partner_assortativity != NULL,
+		                        _pwid_infection_force != NULL, _pwid_needle_sharing != NULL};
+
+		hash.update(&_year_first, 1);
+		hash.update(&time_end, 1);
+
+		// Demography
+		hash.update(_demography->_basepop.data(), _demography->_basepop.num_elements());
+		hash_years(hash, _demography->_lx, time_end);
+		hash_years(hash, _demography->_ex, time_end);
+		hash_years(hash, _demography->_Sx, time_end);
+		hash.update(_demography->_tfr.data(), time_end + 1);
+		hash.update(_demography->_srb.data(), time_end + 1);
+		hash_years(hash, _demography->_pasfrs, time_end);
+		hash_years(hash, _demography->_migration, time_end);
+		hash_years(hash, _uptake_male_circumcision, time_end);
+
+		// Behavioral risk groups
+		hash.update(_debut_prop, DP::N_SEX);
+		hash.update(_union_prop, DP::N_SEX);
+		hash.update(&_split_prop, 1);
+		hash.update(_prop_debut_in_union, DP::N_SEX);
+		hash.update(&_keypop_exit_prop[0][0], DP::N_SEX * DP::N_POP_KEY);
+		hash.update(&_keypop_size[0][0], DP::N_SEX * DP::N_POP_KEY);
+		hash.update(&_keypop_stay[0][0], DP::N_SEX * DP::N_POP_KEY);
+		hash.update(&_keypop_age_dist[0][0][0], DP::N_SEX * DP::N_AGE_ADULT * DP::N_POP_KEY);
+		hash.update(&_keypop_married[0][0], DP::N_SEX * DP::N_POP_KEY);
+
+		// Incidence
+		hash.update(&_direct_incidence, 1);
+		hash.update(_incidence.data(), time_end + 1);
+		hash.update(_irr_sex.data(), time_end + 1);
+		hash_years(hash, _irr_age, time_end);
+		hash_years(hash, _irr_pop, time_end);
+		hash.update(&_seed_time, 1);
+		hash.update(&_seed_prev, 1);
+
+		// Sexual behavior and transmission
+		hash.update(shared, 5);
+		if (_partner_rate) hash_years(hash, *_partner_rate, time_end);
+		if (_partner_preference_age) hash.update(_partner_preference_age->data(), _partner_preference_age->num_elements());
+		if (_partner_assortativity) hash.update(_partner_assortativity->data(), _partner_assortativity->num_elements());
+		hash.update(&_mix_structure[0][0][0][0], DP::N_SEX * DP::N_POP * DP::N_SEX * DP::N_POP);
+		hash.update(&_mix_balance_annual, 1);
+		hash.update(&_transmission_age_band, 1);
+		hash.update(_sex_acts, DP::N_BOND);
+		hash_years(hash, _condom_freq, time_end);
+		hash_years(hash, _sti_prev, time_end);
+		hash.update(&_effect_sti_hivpos, 1);
+		hash.update(&_effect_sti_hivneg, 1);
+		if (_pwid_infection_force) hash_years(hash, *_pwid_infection_force, time_end);
+		if (_pwid_needle_sharing) hash_years(hash, *_pwid_needle_sharing, time_end);
+		hash.update(&_hiv_transmit[0][0][0][0], DP::N_SEX * DP::N_SEX * DP::N_STAGE * DP::N_VL);
+
+		// HIV natural history and ART
+		hash.update(_hiv_dist.data(), _hiv_dist.num_elements());
+		hash.update(_hiv_prog.data(), _hiv_prog.num_elements());
+		hash.update(_hiv_mort.data(), _hiv_mort.num_elements());
+		hash_years(hash, _art_mort_adult, time_end);
+		hash_years(hash, _art_num_adult, time_end);
+		hash_years(hash, _art_prop_adult, time_end);
+		hash_years(hash, _art_exit_adult, time_end);
+		hash_years(hash, _art_suppressed_adult, time_end);
+		hash.update(_art_flow, DP::N_ART);
+		hash.update(&_hiv_time_steps, 1);
+		hash.update(&_hiv_integrator, 1);
+		hash.update(&_art_mort_weight, 1);
+		hash.update(_art_first_eligible_stage_adult.data(), time_end + 1);
+
+		// Fertility, children and interventions
+		hash_years(hash, _frr_age_no_art, time_end);
+		hash.update(_frr_age_on_art, DP::N_AGE_BIRTH);
+		hash.update(_frr_cd4_no_art, DP::N_HIV_ADULT);
+		hash_years(hash, _clhiv_agein, time_end);
+		hash.update(&_effect_vmmc, 1);
+		hash.update(&_effect_condom, 1);
+
+		return hash.value();
+	}
+
 	template<typename popsize_t>
 	void ModelData<popsize_t>::share_births(double* ptr_births) {
 		_births = new year_sex_ref_t(ptr_births, boost::extents[year_final() - year_first() + 1][DP::N_SEX]);
@@ -563,21 +806,25 @@ namespace DP {
 
 	template<typename popsize_t>
 	void ModelData<popsize_t>::share_partner_rate(double* ptr_partner_rate) {
+		mark_changed(0);
 		_partner_rate = new year_sex_age_pop_ref_t(ptr_partner_rate, boost::extents[year_final() - year_first() + 1][DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP]);
 	}
 
 	template<typename popsize_t>
 	void ModelData<popsize_t>::share_age_mixing(double* ptr_mix) {
+		mark_changed(0);
 		_partner_preference_age = new array4d_ref_t(ptr_mix, boost::extents[DP::N_SEX][DP::N_AGE_ADULT][DP::N_SEX][DP::N_AGE_ADULT]);
 	}
 
 	template<typename popsize_t>
 	void ModelData<popsize_t>::share_pop_assortativity(double* ptr_assort) {
+		mark_changed(0);
 		_partner_assortativity = new sex_pop_ref_t(ptr_assort, boost::extents[DP::N_SEX][DP::N_POP]);
 	}
 
 	template<typename popsize_t>
 	void ModelData<popsize_t>::share_pwid_risk(double* ptr_pwid_infection_force, double* ptr_needle_sharing) {
+		mark_changed(0);
 		_pwid_infection_force = new year_sex_ref_t(ptr_pwid_infection_force, boost::extents[year_final() - year_first() + 1][DP::N_SEX]);
 		_pwid_needle_sharing  = new time_series_ref_t(ptr_needle_sharing, boost::extents[year_final() - year_first() + 1]);
 	}
@@ -0,0 +1,143 @@
+#ifndef DPDEMOGRAPHY_H
+#define DPDEMOGRAPHY_H
+
+#include <string>
+#include <boost/multi_array.hpp>
+#include <DPConst.h>
+#include <DPDefs.h>
+#include <DPUPDData.h>
+
+namespace DP {
+
+	template<typename popsize_t> class ModelData;
+
+	/// Demographic inputs to a projection: base-year population, life tables,
+	/// fertility and net migration. These usually come from a UPD file and are
+	/// the same for every projection of a country, so projections with the same
+	/// years can share one instance with ModelData::share_demography(). ModelData
+	/// does not modify a shared instance: its demographic setters copy it first.
+	class DemographyInputs {
+	public:
+		DemographyInputs(const int year_first, const int year_final);
+
+		// Read inputs from a UPD file, interpolating the base-year population
+		// between the years when it is defined. Returns 0 on success, <0 on failure
+		int initialize(const std::string& upd_filename);
+
+		inline int year_first() const {return _year_first;}
+		inline int year_final() const {return _year_final;}
+		inline int num_years() const {return _num_years;}
+
+		// Accessors. In accessors, time t=0 denotes year year_first
+		inline double basepop(const int s, const int a) const {return _basepop[s][a];}
+		inline void basepop(const int s, const int a, const double value) {_basepop[s][a] = value;}
+
+		inline double lx(const int t, const int s, const int a) const {return _lx[t][s][a];}
+		inline void lx(const int t, const int s, const int a, const double value) {_lx[t][s][a] = value;}
+
+		inline double ex(const int t, const int s, const int a) const {return _ex[t][s][a];}
+		inline void ex(const int t, const int s, const int a, const double value) {_ex[t][s][a] = value;}
+
+		inline double Sx(const int t, const int s, const int a) const {return _Sx[t][s][a];}
+		inline void Sx(const int t, const int s, const int a, const double value) {_Sx[t][s][a] = value;}
+
+		inline double tfr(const int t) const {return _tfr[t];}
+		inline void tfr(const int t, const double value) {_tfr[t] = value;}
+
+		inline double srb(const int t) const {return _srb[t];}
+		inline void srb(const int t, const double value) {_srb[t] = value;}
+
+		// Access using age 15 <= a < 50
+		inline double pasfrs(const int t, const int a) const {return _pasfrs[t][a - DP::AGE_BIRTH_MIN];}
+		inline void pasfrs(const int t, const int a, const double value) {_pasfrs[t][a - DP::AGE_BIRTH_MIN] = value;}
+
+		inline double migration(const int t, const int s, const int a) const {return _migration[t][s][a];}
+		inline void migration(const int t, const int s, const int a, const double value) {_migration[t][s][a] = value;}
+
+	private:
+		template<typename popsize_t> friend class ModelData; // for input_hash()
+
+		int _year_first;
+		int _year_final;
+		int _num_years;
+
+		sex_age_t      _basepop;
+		year_sex_age_t _lx;
+		year_sex_age_t _ex;
+		year_sex_age_t _Sx;
+		time_series_t  _tfr;
+		time_series_t  _srb;
+		year_age_t     _pasfrs;
+		year_sex_age_t _migration;
+	};
+
+	inline DemographyInputs::DemographyInputs(const int year_first, const int year_final)
+		: _year_first(year_first),
+			_year_final(year_final),
+			_num_years(year_final - year_first + 1),
+			_basepop(sex_age_t(boost::extents[DP::N_SEX][DP::N_AGE])),
+			_lx(year_sex_age_t(boost::extents[year_final - year_first + 1][DP::N_SEX][DP::N_AGE])),
+			_ex(year_sex_age_t(boost::extents[year_final - year_first + 1][DP::N_SEX][DP::N_AGE])),
+			_Sx(year_sex_age_t(boost::extents[year_final - year_first + 1][DP::N_SEX][DP::N_AGE + 1])),
+			_tfr(time_series_t(year_final - year_first + 1)),
+			_srb(time_series_t(year_final - year_first + 1)),
+			_pasfrs(year_age_t(boost::extents[year_final - year_first + 1][DP::N_AGE_BIRTH])),
+			_migration(year_sex_age_t(boost::extents[year_final - year_first + 1][DP::N_SEX][DP::N_AGE])) {
+	}
+
+	inline int DemographyInputs::initialize(const std::string& upd_filename) {
+		const int year_upd[4] = {1970, 1975, 1980, 1985}; // years when basepop is defined in UPD files
+		int time_upd, time_dat, s, a, i, errcode;
+		double wgt1, wgt2;
+		UPDData upd;
+
+		errcode = upd.read(upd_filename);
+		if (errcode < 0) return errcode;
+
+		// Calculate baseyear population by linearly interpolating between surrounding upd base populations
+		if (_year_first >= year_upd[0] && _year_first < year_upd[1])
+			i = 0;
+		else if (_year_first >= year_upd[1] && _year_first < year_upd[2])
+			i = 1;
+		else
+			i = 2;
+
+		wgt2 = (_year_first - year_upd[i]) / static_cast<double>(year_upd[i+1] - year_upd[i]);
+		wgt1 = 1.0 - wgt2;
+
+		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
+			for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a) {
+				_basepop[s][a] = wgt1 * upd.basepop(i,s,a) + wgt2 * upd.basepop(i+1,s,a);
+			}
+		}
+
+		for (time_dat = 0; time_dat < _num_years; ++time_dat) {
+			time_upd = time_dat + _year_first - UPDData::UPD_YEAR_START;
+
+			_tfr[time_dat] = upd.tfr(time_upd);
+			_srb[time_dat] = upd.srb(time_upd);
+
+			for (a = DP::AGE_BIRTH_MIN; a <= DP::AGE_BIRTH_MAX; ++a) {
+				_pasfrs[time_dat][a - DP::AGE_BIRTH_MIN] = upd.pasfrs(time_upd,a);
+			}
+
+			for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
+				for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a) {
+					_lx[time_dat][s][a] = upd.lx(time_upd,s,a);
+					_ex[time_dat][s][a] = upd.ex(time_upd,s,a);
+					_migration[time_dat][s][a] = upd.migration(time_upd,s,a);
+				}
+			}
+
+			for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
+				for (a = DP::AGE_MIN; a <= DP::AGE_MAX + 1; ++a)
+					_Sx[time_dat][s][a] = upd.Sx(time_upd,s,a);
+			}
+		}
+
+		return 0;
+	}
+
+} // END namespace DP
+
+#endif // DPDEMOGRAPHY_H
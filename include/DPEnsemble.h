@@ -0,0 +1,243 @@
+#ifndef DPENSEMBLE_H
+#define DPENSEMBLE_H
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/multi_array.hpp>
+#include <DPConst.h>
+#include <DPOutputSink.h>
+
+namespace DP {
+
+	/// Runs an ensemble of projections that differ in a few inputs, such as draws
+	/// of fitted parameters, on a pool of worker threads. Each worker owns one
+	/// projection, set up once and reused for every member the worker runs, so
+	/// memory and setup time scale with the number of threads rather than the
+	/// number of members. Inputs that do not vary can also be shared between
+	/// workers with ModelData::share_demography() and ModelData::share_*().
+	///
+	/// For each member, the worker's projection is passed to the member function,
+	/// which must set every input that varies between members: values set for the
+	/// previous member are kept otherwise. Members are then projected to the final
+	/// year, resuming from the earliest year with changed inputs (see
+	/// ModelData::changed_time()), and the extract function copies outputs for
+	/// each year into results() as the year is projected. Years a member does not
+	/// project again keep the outputs of the worker's previous member, which had
+	/// the same inputs up to those years. Results do not depend on the number of
+	/// threads or the order members are run in.
+	///
+	/// Scenarios that only differ from a branch year onwards can be run with
+	/// run_branches(), which projects the years before the branch year once and
+	/// copies that state to every worker as a snapshot, so each member only
+	/// projects its own years from the branch year. Branches are still projected
+	/// separately after the branch year.
+	/// @tparam projection_t projection type, usually an instance of ProjectionT
+	template<typename projection_t>
+	class EnsembleRunner {
+	public:
+		// Set up the projection owned by a worker: storage, UPD inputs and shared
+		// inputs or outputs. Called once per worker, in worker order
+		typedef std::function<void(projection_t& proj, const int worker)> init_t;
+
+		// Set the inputs of one ensemble member. Called on a worker thread
+		typedef std::function<void(projection_t& proj, const int member)> member_t;
+
+		// Copy outputs for year time of a projected member to out[0..num_outputs()-1].
+		// Called on a worker thread from an output sink right after year time is
+		// projected, so proj.pop and proj.dth hold years time and time-1 only, as
+		// with rolling storage (see OutputSink::record())
+		typedef std::function<void(const projection_t& proj, const int time, double* out)> extract_t;
+
+		// Results indexed by [member][time][output]
+		typedef boost::multi_array<double, 3> results_t;
+
+		/// @param year_first   first year of each projection
+		/// @param year_final   final year of each projection
+		/// @param num_outputs  number of outputs copied by the extract function per year
+		/// @param init         function that sets up each worker's projection
+		/// @param num_threads  number of worker threads. If 0, one per hardware thread
+		EnsembleRunner(const int year_first, const int year_final, const int num_outputs, const init_t& init, const int num_threads = 0);
+
+		// Project members 0 to num_members-1 and store their outputs in results().
+		// Rethrows the first exception thrown by a member, after all workers stop
+		void run(const int num_members, const member_t& member, const extract_t& extract);
+
+		// Project members 0 to num_members-1 that share inputs before year_branch.
+		// Worker 0 projects the years before year_branch once from the first year,
+		// and its state in year_branch-1 is copied to the other workers as a
+		// snapshot (see ProjectionT::save_snapshot()). Outputs before year_branch
+		// are extracted once as they are projected and copied to every member. The member function must not change
+		// inputs before year_branch. Workers must have the same inputs before
+		// year_branch, or a std::runtime_error is thrown. Year callbacks and sinks
+		// see years before year_branch on worker 0 only
+		void run_branches(const int year_branch, const int num_members, const member_t& member, const extract_t& extract);
+
+		inline int num_threads() const {return _workers.size();}
+		inline int num_outputs() const {return _num_outputs;}
+		inline int num_members() const {return _results.shape()[0];}
+
+		inline const results_t& results() const {return _results;}
+		inline double result(const int member, const int time, const int output) const {return _results[member][time][output];}
+
+		// Projection owned by a worker, for inspection between calls to run()
+		inline projection_t& worker(const int w) {return *_workers[w];}
+
+	private:
+		// Sink that extracts outputs for each year a worker projects
+		class ExtractSink : public OutputSink<projection_t> {
+		public:
+			ExtractSink(const extract_t& extract, const int num_years, const int num_outputs)
+				: _extract(extract),
+				  _rows(boost::extents[num_years][num_outputs]) {}
+
+			void record(const projection_t& proj, const int time) override {_extract(proj, time, &_rows[time][0]);}
+
+			inline double row(const int time, const int k) const {return _rows[time][k];}
+
+		private:
+			const extract_t& _extract;
+			boost::multi_array<double, 2> _rows;
+		};
+
+		// Run members on all workers, projecting and extracting from time_branch.
+		// If snapshot is not null, workers other than 0 load it first
+		void run_members(const int num_members, const int time_branch, const std::string* snapshot, const member_t& member, const extract_t& extract);
+
+		// Run members taken from next on worker w until none are left
+		void run_worker(const int w, std::atomic<int>& next, const int time_branch, const std::string* snapshot, const member_t& member, const extract_t& extract);
+
+		int _num_outputs;
+		std::vector<std::unique_ptr<projection_t>> _workers;
+		results_t _results;
+
+		std::mutex _error_mutex;
+		std::exception_ptr _error;
+	};
+
+	template<typename projection_t>
+	EnsembleRunner<projection_t>::EnsembleRunner(const int year_first, const int year_final, const int num_outputs, const init_t& init, const int num_threads)
+		: _num_outputs(num_outputs),
+		  _results(boost::extents[0][0][0]) {
+		const int n(num_threads > 0 ? num_threads : std::max(static_cast<int>(std::thread::hardware_concurrency()), 1));
+
+		if (num_outputs < 1)
+			throw std::invalid_argument("EnsembleRunner needs at least one output");
+
+		_workers.reserve(n);
+		for (int w(0); w < n; ++w) {
+			_workers.emplace_back(new projection_t(year_first, year_final));
+			init(*_workers.back(), w);
+		}
+	}
+
+	template<typename projection_t>
+	void EnsembleRunner<projection_t>::run(const int num_members, const member_t& member, const extract_t& extract) {
+		run_members(num_members, 0, nullptr, member, extract);
+	}
+
+	template<typename projection_t>
+	void EnsembleRunner<projection_t>::run_branches(const int year_branch, const int num_members, const member_t& member, const extract_t& extract) {
+		projection_t& proj(*_workers[0]);
+		const int time_branch(year_branch - proj.year_first());
+		std::ostringstream out;
+		std::string snapshot;
+		ExtractSink sink(extract, proj.num_years(), _num_outputs);
+		int m, t, k;
+
+		if (time_branch < 1 || time_branch >= proj.num_years())
+			throw std::invalid_argument("EnsembleRunner branch year must be after the first year and no later than the final year");
+
+		// Project and extract the shared years once. Every shared year is projected
+		// again so the sink sees it, since rolling storage only keeps the last two
+		proj.invalidate(proj.year_first() - 1);
+		proj.add_sink(&sink);
+		try {
+			proj.project(year_branch - 1);
+		} catch (...) {
+			proj.remove_sink(&sink);
+			throw;
+		}
+		proj.remove_sink(&sink);
+		if (proj.save_snapshot(out) != DP::SNAPSHOT_OK)
+			throw std::runtime_error("EnsembleRunner could not save the projection before the branch year");
+		snapshot = out.str();
+
+		run_members(num_members, time_branch, &snapshot, member, extract);
+
+		for (m = 0; m < num_members; ++m)
+			for (t = 0; t < time_branch; ++t)
+				for (k = 0; k < _num_outputs; ++k)
+					_results[m][t][k] = sink.row(t, k);
+	}
+
+	template<typename projection_t>
+	void EnsembleRunner<projection_t>::run_members(const int num_members, const int time_branch, const std::string* snapshot, const member_t& member, const extract_t& extract) {
+		const int num_years(_workers[0]->num_years());
+		std::atomic<int> next(0);
+		std::vector<std::thread> threads;
+		int w;
+
+		// Results are allocated before workers start, and each member writes only its own slice
+		if (num_members != static_cast<int>(_results.shape()[0]) || num_years != static_cast<int>(_results.shape()[1]))
+			_results.resize(boost::extents[num_members][num_years][_num_outputs]);
+
+		_error = nullptr;
+		threads.reserve(num_threads() - 1);
+		for (w = 1; w < num_threads(); ++w)
+			threads.emplace_back(&EnsembleRunner::run_worker, this, w, std::ref(next), time_branch, snapshot, std::cref(member), std::cref(extract));
+		run_worker(0, next, time_branch, snapshot, member, extract);
+		for (std::thread& thread : threads)
+			thread.join();
+
+		if (_error) std::rethrow_exception(_error);
+	}
+
+	template<typename projection_t>
+	void EnsembleRunner<projection_t>::run_worker(const int w, std::atomic<int>& next, const int time_branch, const std::string* snapshot, const member_t& member, const extract_t& extract) {
+		projection_t& proj(*_workers[w]);
+		const int num_members(_results.shape()[0]);
+		ExtractSink sink(extract, proj.num_years(), _num_outputs);
+		int m, t, k;
+
+		proj.add_sink(&sink);
+		try {
+			if (snapshot && w > 0) {
+				std::istringstream in(*snapshot);
+				if (proj.load_snapshot(in) != DP::SNAPSHOT_OK)
+					throw std::runtime_error("EnsembleRunner workers have different inputs before the branch year");
+			}
+
+			// The sink only sees years that are projected, so the first member on
+			// this worker projects every year from time_branch. Later members keep
+			// the rows of earlier years they do not project again
+			proj.invalidate(proj.year_first() + time_branch - 1);
+
+			while ((m = next++) < num_members) {
+				member(proj, m);
+				if (proj.dat.changed_time() < time_branch)
+					throw std::invalid_argument("EnsembleRunner member changed inputs before the branch year");
+				proj.project(proj.year_final());
+				for (t = time_branch; t < proj.num_years(); ++t)
+					for (k = 0; k < _num_outputs; ++k)
+						_results[m][t][k] = sink.row(t, k);
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(_error_mutex);
+			if (!_error) _error = std::current_exception();
+			next = num_members; // stop other workers after their current member
+		}
+		proj.remove_sink(&sink);
+	}
+
+} // END namespace DP
+
+#endif // DPENSEMBLE_H
@@ -0,0 +1,223 @@
+#ifndef DPHIVOPERATOR_H
+#define DPHIVOPERATOR_H
+
+#include <cmath>
+#include <DPConst.h>
+
+namespace DP {
+
+	// Number of CD4 category and care status cells in one adult compartment
+	const int N_HIV_CELL = DP::N_HIV_ADULT * DP::N_DTX;
+
+	// Maximum number of compartments an HivOperator is applied to at once. This
+	// covers all behavioral risk groups and male circumcision states of one sex
+	const int N_HIV_LANE = 2 * DP::N_POP;
+
+	// Flow rates for one sex and age during one HIV time step
+	struct HivStepRates {
+		double prog[DP::N_HIV_ADULT];                // disease progression off ART
+		double dist[DP::N_HIV_ADULT];                // CD4 distribution after primary infection
+		double mort[DP::N_HIV_ADULT];                // HIV-related mortality off ART
+		double mort_scale[DP::N_HIV_ADULT];          // off-ART mortality scale factor for ART coverage
+		double off_out[DP::N_HIV_ADULT];             // exits off ART, excluding ART uptake
+		double uptake[DP::N_HIV_ADULT];              // ART uptake
+		double art_mort[DP::N_HIV_ADULT][DP::N_ART]; // mortality on ART
+		double art_out[DP::N_HIV_ADULT][DP::N_ART];  // exits on ART
+		double art_flow[DP::N_ART];                  // flows between ART duration categories
+		double art_exit;                             // ART interruption
+	};
+
+	/// Sparse transition operator for adults living with HIV.
+	///
+	/// Within an HIV time step, disease progression, HIV-related mortality, ART
+	/// uptake, ART duration flows and ART interruption are linear in the
+	/// population of one sex and age. HivOperator stores that system as a sparse
+	/// N_HIV_CELL by N_HIV_CELL matrix A, with cells indexed by h * N_DTX + d for
+	/// CD4 category h and care status d, so that dx/dt = A x. The sparsity
+	/// pattern does not depend on the rates.
+	///
+	/// Populations passed to apply() are stored cell-major, with up to N_HIV_LANE
+	/// compartments (risk groups and circumcision states) as the innermost
+	/// dimension so the product is vectorized across compartments.
+	///
+	/// To advance a population over a time step of length h, we weight each cell
+	/// by its expected time at risk per person w, then add A (w x) to x. Forward
+	/// Euler uses w = h. The exponential integrator uses w = (1 - exp(-h e)) / e
+	/// for total exit rate e, so exits from each cell decay exponentially within
+	/// the step and are split between destinations in proportion to their rates.
+	/// This conserves population and keeps it non-negative for any step size.
+	class HivOperator {
+	public:
+		typedef double block_t[DP::N_HIV_CELL][DP::N_HIV_LANE];
+
+		HivOperator();
+
+		/// Rebuild the operator from flow rates for one sex and age, with CD4
+		/// categories interpreted according to scheme
+		template<cd4_scheme_t scheme = CD4_SCHEME_DEFAULT>
+		void assemble(const HivStepRates& rates);
+
+		/// Calculate the rate of change dx = A x for the first nlane compartments in x.
+		/// nlane must be N_POP or N_HIV_LANE
+		void apply(const block_t& x, block_t& dx, const int nlane) const;
+
+		/// Calculate the time at risk in each cell over a step of length
+		/// step_size, as used by advance(). Call after assemble()
+		void update_exposure(const double step_size, const integrator_t method);
+
+		/// Advance x over one time step and add HIV-related deaths during the step to dth
+		void advance(block_t& x, block_t& dth, const int nlane) const;
+
+		inline int num_nonzero() const {return _row[DP::N_HIV_CELL];}
+
+		// Element k of the sparse matrix in compressed sparse row format
+		inline int row_begin(const int i) const {return _row[i];}
+		inline int row_end(const int i) const {return _row[i + 1];}
+		inline int col(const int k) const {return _col[k];}
+		inline double val(const int k) const {return _val[k];}
+
+		// HIV-related deaths are recorded at this rate in cell i
+		inline double death_rate(const int i) const {return _mort[i];}
+
+		// Total rate of exit from cell i, equal to -A(i,i)
+		inline double exit_rate(const int i) const {return _exit[i];}
+
+		// Time at risk per person in cell i over one time step
+		inline double exposure(const int i) const {return _exposure[i];}
+
+	private:
+		// Upper bound on the number of nonzero elements: at most one progression
+		// and one primary infection term, one ART interruption term per ART cell,
+		// three ART uptake terms, and the diagonal in each row
+		static const int MAX_NONZERO = DP::N_HIV_CELL * 5 + DP::N_HIV_ADULT * DP::N_ART;
+
+		template<int nlane>
+		void apply_lanes(const block_t& x, block_t& dx) const;
+
+		inline static int cell(const int h, const int d) {return h * DP::N_DTX + d;}
+		inline void insert(const int j, const double value) {
+			if (j == _num_rows) _exit[j] = -value;
+			_col[_row[_num_rows + 1]] = j;
+			_val[_row[_num_rows + 1]++] = value;
+		}
+		inline void next_row() {++_num_rows; _row[_num_rows + 1] = _row[_num_rows];}
+
+		int _num_rows;
+		int _row[DP::N_HIV_CELL + 1];
+		int _col[MAX_NONZERO];
+		double _val[MAX_NONZERO];
+		double _mort[DP::N_HIV_CELL];
+		double _exit[DP::N_HIV_CELL];
+		double _exposure[DP::N_HIV_CELL];
+	};
+
+	HivOperator::HivOperator() : _num_rows(0) {
+		HivStepRates rates = {};
+		assemble(rates);
+		update_exposure(DP::HIV_STEP_SIZE, DP::INTEGRATOR_EULER);
+	}
+
+	template<cd4_scheme_t scheme>
+	void HivOperator::assemble(const HivStepRates& rates) {
+		int h, d, hx, dx;
+
+		_num_rows = -1;
+		_row[0] = 0;
+		for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+			for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+				next_row();
+
+				if (d <= DP::DTX_OFF_MAX) {
+					// Not on ART
+					if constexpr (scheme == DP::CD4_GOALS) {
+						if (h > DP::HIV_PRIMARY)
+							insert(cell(DP::HIV_PRIMARY, d), rates.prog[DP::HIV_PRIMARY] * rates.dist[h]);
+						if (h > DP::HIV_GEQ_500)
+							insert(cell(h - 1, d), rates.prog[h - 1]);
+						insert(cell(h, d), -(rates.off_out[h] + rates.uptake[h]));
+					} else {
+						if (h > DP::HIV_ADULT_MIN)
+							insert(cell(h - 1, d), rates.prog[h - 1]);
+						if (h < DP::HIV_ADULT_MAX)
+							insert(cell(h, d), -(rates.off_out[h] + rates.uptake[h]));
+						else
+							insert(cell(h, d), -(rates.mort_scale[h] * rates.mort[h] + rates.uptake[h]));
+					}
+
+					// ART interruption
+					if (d == DP::DTX_PREV_TX)
+						for (hx = DP::HIV_ADULT_MIN; hx <= DP::HIV_ADULT_MAX; ++hx)
+							for (dx = DP::DTX_ART_MIN; dx <= DP::DTX_ART_MAX; ++dx)
+								if (Cd4Scheme<scheme>::ART_EXIT_STAGE[hx][dx] == h)
+									insert(cell(hx, dx), rates.art_exit);
+
+					_mort[cell(h, d)] = rates.mort_scale[h] * rates.mort[h];
+				} else {
+					// On ART
+					if (d == DP::DTX_ART1) {
+						for (dx = DP::DTX_OFF_MIN; dx <= DP::DTX_OFF_MAX; ++dx)
+							insert(cell(h, dx), rates.uptake[h]);
+					} else {
+						insert(cell(h, d - 1), rates.art_flow[d - 1 - DP::DTX_ART_MIN]);
+					}
+					insert(cell(h, d), -rates.art_out[h][d - DP::DTX_ART_MIN]);
+
+					_mort[cell(h, d)] = rates.art_mort[h][d - DP::DTX_ART_MIN];
+				}
+			}
+		}
+	}
+
+	void HivOperator::apply(const block_t& x, block_t& dx, const int nlane) const {
+		// Fixed lane counts let compilers vectorize the inner loops fully
+		if (nlane <= DP::N_POP)
+			apply_lanes<DP::N_POP>(x, dx);
+		else
+			apply_lanes<DP::N_HIV_LANE>(x, dx);
+	}
+
+	template<int nlane>
+	void HivOperator::apply_lanes(const block_t& x, block_t& dx) const {
+		double sum[nlane];
+		double v;
+		int i, j, k, l;
+		for (i = 0; i < DP::N_HIV_CELL; ++i) {
+			for (l = 0; l < nlane; ++l)
+				sum[l] = 0.0;
+			for (k = _row[i]; k < _row[i + 1]; ++k) {
+				j = _col[k];
+				v = _val[k];
+				for (l = 0; l < nlane; ++l)
+					sum[l] += v * x[j][l];
+			}
+			for (l = 0; l < nlane; ++l)
+				dx[i][l] = sum[l];
+		}
+	}
+
+	void HivOperator::update_exposure(const double step_size, const integrator_t method) {
+		int i;
+		for (i = 0; i < DP::N_HIV_CELL; ++i)
+			if (method == DP::INTEGRATOR_EXPONENTIAL && _exit[i] > 0.0)
+				_exposure[i] = -std::expm1(-step_size * _exit[i]) / _exit[i];
+			else
+				_exposure[i] = step_size;
+	}
+
+	void HivOperator::advance(block_t& x, block_t& dth, const int nlane) const {
+		block_t y, dx;
+		int i, l;
+		for (i = 0; i < DP::N_HIV_CELL; ++i)
+			for (l = 0; l < nlane; ++l)
+				y[i][l] = _exposure[i] * x[i][l];
+		apply(y, dx, nlane);
+		for (i = 0; i < DP::N_HIV_CELL; ++i)
+			for (l = 0; l < nlane; ++l) {
+				x[i][l] += dx[i][l];
+				dth[i][l] += y[i][l] * _mort[i];
+			}
+	}
+
+} // END namespace DP
+
+#endif // DPHIVOPERATOR_H
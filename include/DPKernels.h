@@ -0,0 +1,63 @@
+#ifndef DPKERNELS_H
+#define DPKERNELS_H
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define DP_KERNELS_X86
+#endif
+
+namespace DP {
+
+	// +=+ interface +=+
+
+	// Numerical kernels for the hottest loops in the model. Each kernel has a
+	// portable scalar implementation and, on x86 builds with GCC or Clang, AVX2 and
+	// AVX-512 implementations compiled with function-level target attributes. The
+	// vectorized implementation is selected at runtime, so binaries built without
+	// -march flags still benefit on hardware that supports it.
+
+	enum kernel_isa_t {
+		KERNEL_SCALAR = 0,
+		KERNEL_AVX2   = 1,
+		KERNEL_AVX512 = 2
+	};
+
+	// Rows passed to kernels must be padded to a multiple of KERNEL_WIDTH
+	// elements, with zeros in the padding
+	const int KERNEL_WIDTH = 8;
+
+	// Round n up to the next multiple of KERNEL_WIDTH
+	constexpr int kernel_pad(const int n) {return ((n + KERNEL_WIDTH - 1) / KERNEL_WIDTH) * KERNEL_WIDTH;}
+
+	// Returns true if the current CPU can run kernels built for isa
+	bool kernel_supported(const kernel_isa_t isa);
+
+	// Returns the fastest kernel ISA supported by the current CPU
+	kernel_isa_t kernel_best();
+
+	// Multiply a row-major matrix by two vectors at once: y0 = mat * x0 and y1 = mat * x1.
+	// @param mat nrow by ncol matrix, stored row-major with row stride ncol
+	// @param x0,x1 vectors of length ncol
+	// @param y0,y1 vectors of length nrow to store the products
+	// @param nrow number of matrix rows
+	// @param ncol number of matrix columns, must be a multiple of KERNEL_WIDTH
+	//
+	// All implementations accumulate each row in KERNEL_WIDTH partial sums that are
+	// reduced in the same order, so AVX2 and AVX-512 results are identical and
+	// scalar results differ only by fused multiply-add rounding.
+	typedef void (*mixmul_kernel_t)(const double* mat, const double* x0, const double* x1, double* y0, double* y1, const int nrow, const int ncol);
+
+	// Returns the implementation of mixmul for isa. isa must be supported by the current CPU.
+	mixmul_kernel_t mixmul_kernel(const kernel_isa_t isa);
+
+	void mixmul_scalar(const double* mat, const double* x0, const double* x1, double* y0, double* y1, const int nrow, const int ncol);
+
+#ifdef DP_KERNELS_X86
+	void mixmul_avx2(const double* mat, const double* x0, const double* x1, double* y0, double* y1, const int nrow, const int ncol);
+	void mixmul_avx512(const double* mat, const double* x0, const double* x1, double* y0, double* y1, const int nrow, const int ncol);
+#endif
+
+} // END namespace DP
+
+#include <DPKernels_impl.h>
+
+#endif // DPKERNELS_H
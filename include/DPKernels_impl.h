@@ -0,0 +1,128 @@
+#ifndef DPKERNELS_IMPL_H
+#define DPKERNELS_IMPL_H
+
+#ifdef DP_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace DP {
+
+	bool kernel_supported(const kernel_isa_t isa) {
+		switch (isa) {
+		case KERNEL_SCALAR: return true;
+#ifdef DP_KERNELS_X86
+		case KERNEL_AVX2:   return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		case KERNEL_AVX512: return __builtin_cpu_supports("avx512f");
+#endif
+		default: return false;
+		}
+	}
+
+	kernel_isa_t kernel_best() {
+		if (kernel_supported(KERNEL_AVX512)) return KERNEL_AVX512;
+		if (kernel_supported(KERNEL_AVX2))   return KERNEL_AVX2;
+		return KERNEL_SCALAR;
+	}
+
+	mixmul_kernel_t mixmul_kernel(const kernel_isa_t isa) {
+		switch (isa) {
+#ifdef DP_KERNELS_X86
+		case KERNEL_AVX2:   return mixmul_avx2;
+		case KERNEL_AVX512: return mixmul_avx512;
+#endif
+		default: return mixmul_scalar;
+		}
+	}
+
+	void mixmul_scalar(const double* mat, const double* x0, const double* x1, double* y0, double* y1, const int nrow, const int ncol) {
+		const double* row;
+		double sum0[KERNEL_WIDTH], sum1[KERNEL_WIDTH];
+		int i, j, k;
+		for (i = 0; i < nrow; ++i) {
+			row = mat + i * ncol;
+			for (k = 0; k < KERNEL_WIDTH; ++k)
+				sum0[k] = sum1[k] = 0.0;
+			for (j = 0; j < ncol; j += KERNEL_WIDTH)
+				for (k = 0; k < KERNEL_WIDTH; ++k) {
+					sum0[k] += row[j + k] * x0[j + k];
+					sum1[k] += row[j + k] * x1[j + k];
+				}
+
+			// pairwise reduction, matching the vectorized kernels
+			for (k = 0; k < 4; ++k) {
+				sum0[k] += sum0[k + 4];
+				sum1[k] += sum1[k + 4];
+			}
+			for (k = 0; k < 2; ++k) {
+				sum0[k] += sum0[k + 2];
+				sum1[k] += sum1[k + 2];
+			}
+			y0[i] = sum0[0] + sum0[1];
+			y1[i] = sum1[0] + sum1[1];
+		}
+	}
+
+#ifdef DP_KERNELS_X86
+
+	// Reduce the four lanes of v in the same order as mixmul_scalar
+	__attribute__((target("avx2,fma")))
+	static inline double reduce_avx2(const __m256d v) {
+		__m128d u = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(u, _mm_unpackhi_pd(u, u)));
+	}
+
+	__attribute__((target("avx2,fma")))
+	void mixmul_avx2(const double* mat, const double* x0, const double* x1, double* y0, double* y1, const int nrow, const int ncol) {
+		const double* row;
+		__m256d lo0, hi0, lo1, hi1, m;
+		int i, j;
+		for (i = 0; i < nrow; ++i) {
+			row = mat + i * ncol;
+			lo0 = hi0 = lo1 = hi1 = _mm256_setzero_pd();
+			for (j = 0; j < ncol; j += KERNEL_WIDTH) {
+				m = _mm256_loadu_pd(row + j);
+				lo0 = _mm256_fmadd_pd(m, _mm256_loadu_pd(x0 + j), lo0);
+				lo1 = _mm256_fmadd_pd(m, _mm256_loadu_pd(x1 + j), lo1);
+				m = _mm256_loadu_pd(row + j + 4);
+				hi0 = _mm256_fmadd_pd(m, _mm256_loadu_pd(x0 + j + 4), hi0);
+				hi1 = _mm256_fmadd_pd(m, _mm256_loadu_pd(x1 + j + 4), hi1);
+			}
+			y0[i] = reduce_avx2(_mm256_add_pd(lo0, hi0));
+			y1[i] = reduce_avx2(_mm256_add_pd(lo1, hi1));
+		}
+	}
+
+	// Reduce the eight lanes of v in the same order as mixmul_scalar. Halves are
+	// extracted with a zeroing mask, since _mm512_extractf64x4_pd (and GCC's
+	// _mm512_castpd512_pd256) pass an undefined source that GCC reports as maybe
+	// uninitialized
+	__attribute__((target("avx512f")))
+	static inline double reduce_avx512(const __m512d v) {
+		__m256d w = _mm256_add_pd(_mm512_maskz_extractf64x4_pd(0xF, v, 0), _mm512_maskz_extractf64x4_pd(0xF, v, 1));
+		__m128d u = _mm_add_pd(_mm256_castpd256_pd128(w), _mm256_extractf128_pd(w, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(u, _mm_unpackhi_pd(u, u)));
+	}
+
+	__attribute__((target("avx512f")))
+	void mixmul_avx512(const double* mat, const double* x0, const double* x1, double* y0, double* y1, const int nrow, const int ncol) {
+		const double* row;
+		__m512d sum0, sum1, m;
+		int i, j;
+		for (i = 0; i < nrow; ++i) {
+			row = mat + i * ncol;
+			sum0 = sum1 = _mm512_setzero_pd();
+			for (j = 0; j < ncol; j += KERNEL_WIDTH) {
+				m = _mm512_loadu_pd(row + j);
+				sum0 = _mm512_fmadd_pd(m, _mm512_loadu_pd(x0 + j), sum0);
+				sum1 = _mm512_fmadd_pd(m, _mm512_loadu_pd(x1 + j), sum1);
+			}
+			y0[i] = reduce_avx512(sum0);
+			y1[i] = reduce_avx512(sum1);
+		}
+	}
+
+#endif // DP_KERNELS_X86
+
+} // END namespace DP
+
+#endif // DPKERNELS_IMPL_H
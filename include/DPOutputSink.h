@@ -0,0 +1,129 @@
+#ifndef DPOUTPUTSINK_H
+#define DPOUTPUTSINK_H
+
+#include <stdexcept>
+#include <vector>
+#include <DPConst.h>
+#include <DPDefs.h>
+
+namespace DP {
+
+	/// Interface for recording outputs as a projection runs. Sinks added with
+	/// ProjectionT::add_sink() are called after each year is projected, including
+	/// the base year, so summary outputs can be calculated without keeping the
+	/// full population history.
+	/// @tparam projection_t projection type, usually an instance of ProjectionT
+	template<typename projection_t>
+	class OutputSink {
+	public:
+		virtual ~OutputSink() {}
+
+		/// Record outputs for the year with time index time. proj.pop and proj.dth
+		/// hold years time and time - 1 (if time > 0), including with rolling
+		/// storage. A resumed projection records years again from where it resumes
+		virtual void record(const projection_t& proj, const int time) = 0;
+	};
+
+	/// Adult HIV indicators by year, sex and age group: population size, people
+	/// living with HIV (PLHIV), people on ART and new infections, and from these
+	/// prevalence, incidence and ART coverage. Incidence is new infections during
+	/// the year per HIV-negative person in the same age group at the start of the year.
+	template<typename projection_t>
+	class IndicatorSink : public OutputSink<projection_t> {
+	public:
+		/// @param num_years   number of years in the projection
+		/// @param age_lower   lower bound of each age group, in increasing order. The
+		///                    first must be DP::AGE_ADULT_MIN, and the last group
+		///                    extends to DP::AGE_ADULT_MAX
+		IndicatorSink(const int num_years, const std::vector<int>& age_lower = {15, 25, 35, 50});
+
+		void record(const projection_t& proj, const int time) override;
+
+		inline int num_groups() const {return _age_lower.size();}
+		inline int age_lower(const int g) const {return _age_lower[g];}
+
+		// Counts by year, sex and age group
+		inline double popsize(const int t, const int s, const int g) const {return _popsize[t][s][g];}
+		inline double plhiv(const int t, const int s, const int g) const {return _plhiv[t][s][g];}
+		inline double on_art(const int t, const int s, const int g) const {return _on_art[t][s][g];}
+		inline double new_hiv(const int t, const int s, const int g) const {return _new_hiv[t][s][g];}
+
+		// Proportions by year, sex and age group. These are 0 when the denominator is 0
+		inline double prevalence(const int t, const int s, const int g) const {return ratio(_plhiv[t][s][g], _popsize[t][s][g]);}
+		inline double incidence(const int t, const int s, const int g) const {return ratio(_new_hiv[t][s][g], _hiv_neg_start[t][s][g]);}
+		inline double art_coverage(const int t, const int s, const int g) const {return ratio(_on_art[t][s][g], _plhiv[t][s][g]);}
+
+	private:
+		inline static double ratio(const double num, const double den) {return den > 0.0 ? num / den : 0.0;}
+
+		std::vector<int> _age_lower;
+		int _group[DP::N_AGE_ADULT]; // age group of each adult age
+
+		year_sex_age_t _popsize;
+		year_sex_age_t _plhiv;
+		year_sex_age_t _on_art;
+		year_sex_age_t _new_hiv;
+		year_sex_age_t _hiv_neg_start;
+	};
+
+	template<typename projection_t>
+	IndicatorSink<projection_t>::IndicatorSink(const int num_years, const std::vector<int>& age_lower)
+		: _age_lower(age_lower),
+		  _popsize(boost::extents[num_years][DP::N_SEX][age_lower.size()]),
+		  _plhiv(boost::extents[num_years][DP::N_SEX][age_lower.size()]),
+		  _on_art(boost::extents[num_years][DP::N_SEX][age_lower.size()]),
+		  _new_hiv(boost::extents[num_years][DP::N_SEX][age_lower.size()]),
+		  _hiv_neg_start(boost::extents[num_years][DP::N_SEX][age_lower.size()]) {
+		int a, g;
+
+		if (_age_lower.empty() || _age_lower[0] != DP::AGE_ADULT_MIN)
+			throw std::invalid_argument("IndicatorSink age groups must start at DP::AGE_ADULT_MIN");
+		for (g = 1; g < num_groups(); ++g)
+			if (_age_lower[g] <= _age_lower[g - 1] || _age_lower[g] > DP::AGE_ADULT_MAX)
+				throw std::invalid_argument("IndicatorSink age groups must be increasing adult ages");
+
+		g = 0;
+		for (a = DP::AGE_ADULT_MIN; a <= DP::AGE_ADULT_MAX; ++a) {
+			if (g + 1 < num_groups() && a == _age_lower[g + 1]) ++g;
+			_group[a - DP::AGE_ADULT_MIN] = g;
+		}
+	}
+
+	template<typename projection_t>
+	void IndicatorSink<projection_t>::record(const projection_t& proj, const int time) {
+		const int t(time);
+		double hiv_neg, hiv_pos, art, new_hiv;
+		int b, d, g, h, r, s, u;
+
+		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+			for (g = 0; g < num_groups(); ++g)
+				_popsize[t][s][g] = _plhiv[t][s][g] = _on_art[t][s][g] = _new_hiv[t][s][g] = _hiv_neg_start[t][s][g] = 0.0;
+
+		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
+			s = DP::sex[u];
+			for (b = 0; b < DP::N_AGE_ADULT; ++b) {
+				g = _group[b];
+				hiv_neg = hiv_pos = art = new_hiv = 0.0;
+				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+					hiv_neg += proj.pop.adult_neg(t, u, b, r);
+					new_hiv += proj.dat.new_hiv_infections(t, u, b + DP::AGE_ADULT_MIN, r);
+					for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+						for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d)
+							hiv_pos += proj.pop.adult_hiv(t, u, b, r, h, d);
+						for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d)
+							art += proj.pop.adult_hiv(t, u, b, r, h, d);
+					}
+					if (t > 0)
+						_hiv_neg_start[t][s][g] += proj.pop.adult_neg(t - 1, u, b, r);
+				}
+				_popsize[t][s][g] += hiv_neg + hiv_pos;
+				_plhiv[t][s][g] += hiv_pos;
+				_on_art[t][s][g] += art;
+				_new_hiv[t][s][g] += new_hiv;
+			}
+		}
+	}
+
+} // END namespace DP
+
+#endif // DPOUTPUTSINK_H
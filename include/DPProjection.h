@@ -1,22 +1,68 @@
 #ifndef DPPROJECTION_H
 #define DPPROJECTION_H
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
 #include <DPConst.h>
 #include <DPData.h>
+#include <DPHivOperator.h>
+#include <DPOutputSink.h>
+#include <DPTransmission.h>
+#include <GBMath.h>
+#include <GBThreadPool.h>
 #include <Population.h>
 
 namespace DP {
 
-	class Projection {
+	/// Structural options that projections are specialized on at compile time.
+	/// Branches for options that are not selected are compiled away.
+	/// @tparam cd4       interpretation of adult CD4 categories
+	/// @tparam incidence source of adult HIV incidence. With INCIDENCE_RUNTIME,
+	///                   this is chosen by ModelData::direct_incidence()
+	/// @tparam steps     HIV time steps per year. With 0, this is chosen by
+	///                   ModelData::hiv_time_steps()
+	/// @tparam keypops   whether key populations are modeled. If false, key
+	///                   population inputs are ignored and key populations stay empty
+	/// @tparam layout    memory layout of adults living with HIV in pop and dth
+	template<cd4_scheme_t cd4 = CD4_SCHEME_DEFAULT, incidence_model_t incidence = INCIDENCE_RUNTIME, int steps = 0, bool keypops = true, hiv_layout_t layout = HIV_LAYOUT_COMPARTMENT>
+	struct ProjectionOptions {
+		static constexpr cd4_scheme_t cd4_scheme = cd4;
+		static constexpr incidence_model_t incidence_model = incidence;
+		static constexpr int hiv_time_steps = steps;
+		static constexpr bool key_populations = keypops;
+		static constexpr hiv_layout_t hiv_layout = layout;
+	};
+
+	/// Population projection
+	/// @tparam Options structural options, usually an instance of ProjectionOptions
+	/// @tparam value_t real-valued type used to store population sizes. Calculations
+	///                 within each time step, sums over the population and model
+	///                 outputs in dat use double precision
+	template<typename Options, typename value_t = double>
+	class ProjectionT {
 	public:
-		typedef double popsize_t; // This sets the data type used to store populations.
+		typedef value_t popsize_t; // This sets the data type used to store populations.
+		typedef Options options_t;
+
+		// Type used to sum population sizes. Sums are compensated when populations are
+		// stored in less than double precision, so that rounding in storage does not
+		// accumulate in aggregate outputs like births
+		typedef typename std::conditional<std::is_same<popsize_t, double>::value, double, GB::kahan_sum<double>>::type accum_t;
+
+		// Function called by project() after each year is projected, with the time
+		// index of that year. When pop and dth use rolling storage, this is the last
+		// chance to read the year's population before it is overwritten
+		typedef std::function<void(const ProjectionT&, const int)> year_callback_t;
 
-		Population pop;
-		Population dth;
-		ModelData<popsize_t> dat;
+		PopulationT<popsize_t, Options::hiv_layout> pop;
+		PopulationT<popsize_t, Options::hiv_layout> dth;
+		ModelData<double> dat;
 
-		Projection(const int year_start, const int year_final);
-		~Projection();
+		ProjectionT(const int year_start, const int year_final);
+		~ProjectionT();
 
 		void initialize(const std::string &upd_filename);
 
@@ -28,21 +74,87 @@ namespace DP {
 		// stores year_end as the last year of valid model outputs. Subsequent calls to
 		// project() will resume from year_end. Use invalidate(year) to reset this resumption
 		// point to an earlier year. invalidate(-1) will force project() to start from the
-		// beginning.
+		// beginning. Inputs changed through ModelData setters since the last call to
+		// project() invalidate later years automatically (see ModelData::changed_time()),
+		// so invalidate() is only needed after writing directly to shared input memory.
+		// If pop uses rolling storage, project() can only resume from the years still
+		// stored, and otherwise starts from the beginning.
 		void invalidate(const int year);
 
+		// Set the function called after each year is projected, including the
+		// base year. Pass an empty function to stop calling it
+		inline void year_callback(const year_callback_t& callback) {_year_callback = callback;}
+
+		// Add a sink that records outputs after each year is projected, including the
+		// base year. Sinks are called in the order added, before the year callback.
+		// The projection does not own sinks, which must remain valid while added
+		inline void add_sink(OutputSink<ProjectionT>* sink) {_sinks.push_back(sink);}
+		inline void remove_sink(OutputSink<ProjectionT>* sink) {_sinks.erase(std::remove(_sinks.begin(), _sinks.end(), sink), _sinks.end());}
+		inline void clear_sinks() {_sinks.clear();}
+
+		// Run demographic, circumcision, adult HIV and migration updates for
+		// independent sex and age strata on the threads of pool. Each stratum is
+		// calculated the same way on any thread, so results do not depend on the
+		// number of threads. The projection does not own the pool, which must remain
+		// valid while set. Pass nullptr (the default) to run serially
+		void thread_pool(GB::WorkStealingPool* pool);
+
+		// Save the state of the projection in its last valid year as a binary snapshot:
+		// the population in that year, outputs in dat through that year, and
+		// dat.input_hash() for that year. Snapshots use native byte order and the
+		// storage type popsize_t. Returns a snapshot_status_t code
+		int save_snapshot(std::ostream& out) const;
+		int save_snapshot(const std::string& filename) const;
+
+		// Restore a snapshot saved by a projection with the same years, options and
+		// storage type. Inputs in dat must be set and outputs shared before loading,
+		// and must match the inputs used to make the snapshot through its year. On
+		// success, project() resumes from the year after the snapshot; populations
+		// in other years are not restored, so project() starts from the first year
+		// if inputs in or before the snapshot year change or invalidate() is called
+		// for an earlier year. Returns a snapshot_status_t code
+		int load_snapshot(std::istream& in);
+		int load_snapshot(const std::string& filename);
+
 		// Accessors
 		inline const int year_first() const {return _year_first;}
 		inline const int year_final() const {return _year_final;}
 		inline const int num_years() const {return _num_years;}
 
+		// HIV time steps per year and step size, from Options or ModelData
+		inline int hiv_time_steps() const {return Options::hiv_time_steps > 0 ? Options::hiv_time_steps : dat.hiv_time_steps();}
+		inline double hiv_step_size() const {return 1.0 / hiv_time_steps();}
+
+		// true if HIV incidence is a model input, false if it is calculated from sexual transmission
+		inline bool direct_incidence() const {
+			if constexpr (Options::incidence_model == DP::INCIDENCE_RUNTIME) {
+				return dat.direct_incidence();
+			} else {
+				return Options::incidence_model == DP::INCIDENCE_DIRECT;
+			}
+		}
+
 		// Public calculation methods
 		double calc_births(const int time);
 		double calc_births_hiv_exposed(const int time);
 
 	private:
+		// Aggregates of the adult population used by HIV calculations at each time
+		// step. These are calculated in a full sweep of the population at the start
+		// of each year, then kept current as the population changes during the year:
+		// advance_one_step_hiv_adult accumulates them as it updates each compartment, and
+		// infection calculations add new infections to them
+		struct StepSummary {
+			double popsize[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];            // adult population size
+			double plhiv_off[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP][DP::N_STAGE]; // PLHIV off ART by HIV stage
+			double plhiv_art[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP][DP::N_STAGE]; // PLHIV on ART by HIV stage
+			double off_art[DP::N_SEX][DP::N_AGE_ADULT][DP::N_HIV_ADULT];          // PLHIV off ART by CD4 category
+			double on_art[DP::N_SEX][DP::N_AGE_ADULT][DP::N_HIV_ADULT][DP::N_ART]; // PLHIV on ART by CD4 category and ART duration
+			bool valid;
+		};
+
 		// Projection is not default-constructible - start and final years must be specified
-		Projection();
+		ProjectionT();
 
 		void calc_popsize(const int time);
 
@@ -55,14 +167,19 @@ namespace DP {
 		void project_one_year(const int time);
 
 		void advance_one_year_demography(const int time);
+		void advance_demography_stratum(const int time, const int u, const int a);
 		void advance_one_year_risk(const int time);
 		void advance_one_year_male_circumcision(const int time);
 		void advance_one_year_hiv(const int time);
 		void advance_one_year_hiv_adult(const int time);
 		void advance_one_year_hiv_child(const int time);
 		void advance_one_step_hiv_adult(const int time, const int step);
+		void gather_hiv_step_rates(const int time, const int s, const int a, const double* mort_scale, const sex_hiv_t& uptake_rate, HivStepRates& rates);
+		void calc_step_summary(const int time);
+		void clear_step_summary();
+		void accumulate_step_summary(const int time, const int u, const int b, const int r);
 		void calc_adult_art_uptake(const int time, const int step, sex_hiv_t& rate);
-		void calc_adult_infections(const int time, const int step);
+		void calc_adult_infections(const int time, const int step, TransmissionCache& cache);
 		void insert_adult_infections(const int time, const int step);
 		void insert_clhiv_agein(const int time);
 		void insert_endyear_migrants(const int time);
@@ -71,6 +188,25 @@ namespace DP {
 
 		void calc_deaths(const int time);
 
+		// Call task(i, thread) for i in [0, n), on the thread pool if one is set
+		template<typename task_t>
+		void for_each_stratum(const int n, const task_t& task);
+
+		// Call sinks and the year callback after year time is projected
+		void record_outputs(const int time);
+
+		// Copy the population in year time and outputs through year time to or from
+		// snapshot buffers, in a fixed order that does not depend on storage layout
+		void pack_snapshot(const int time, std::vector<popsize_t>& state, std::vector<double>& outputs) const;
+		void unpack_snapshot(const int time, const std::vector<popsize_t>& state, const std::vector<double>& outputs);
+
+		// Snapshot header fields: format version, sizeof(popsize_t), first and final
+		// year, snapshot time index, and structural options
+		static constexpr char SNAPSHOT_MAGIC[8] = {'G', 'O', 'A', 'L', 'S', 'A', 'R', 'M'};
+		static const int SNAPSHOT_VERSION = 1;
+		static const int SNAPSHOT_HEADER_SIZE = 9;
+		void snapshot_header(const int time, std::int32_t header[SNAPSHOT_HEADER_SIZE]) const;
+
 		int _year_first;
 		int _year_final;
 		int _num_years;
@@ -78,8 +214,45 @@ namespace DP {
 		// if _last_valid_time < 0,  then the entire population projection in pop is invalid
 		// if _last_valid_time >= 0, then the population projection in pop is valid through _last_valid_year and invalid afterwards
 		int _last_valid_time;
+
+		// Time index of the last year stored in pop, or -1 if none has been
+		int _last_stored_time;
+
+		// Time index of the first year projected or restored in pop. This is 0 unless
+		// pop was restored from a snapshot, which only holds the snapshot year
+		int _first_restored_time;
+
+		// Transmission inputs that are constant within a year, updated at the start of each year
+		TransmissionCache _transmission_cache;
+
+		StepSummary _summary;
+
+		// Working memory for the adult HIV time step, one per thread
+		struct HivStepScratch {
+			HivStepRates rates;
+			HivOperator op;
+			HivOperator::block_t x;
+			HivOperator::block_t deaths;
+		};
+		std::vector<HivStepScratch> _hiv_scratch;
+		GB::WorkStealingPool* _pool;
+
+		year_callback_t _year_callback;
+		std::vector<OutputSink<ProjectionT>*> _sinks;
+
+		// Upper bound on behavioral risk groups of sex s used when enumerating key populations
+		inline int key_pop_end(const int s) const {return Options::key_populations ? DP::N_POP_SEX[s] : DP::POP_KEY_MIN;}
 	};
 
+	// Projection with default options, equivalent to a single build before ProjectionT was introduced
+	typedef ProjectionT<ProjectionOptions<>> Projection;
+
+	// Projection with Spectrum CD4 categories
+	typedef ProjectionT<ProjectionOptions<CD4_SPECTRUM>> ProjectionSpectrumCD4;
+
+	// Projection with default options that stores populations in single precision
+	typedef ProjectionT<ProjectionOptions<>, float> ProjectionFloat;
+
 } // END namespace DP
 
 #include <DPProjection_impl.h>
@@ -2,56 +2,117 @@
 #define DPPROJECTION_IMPL_H
 
 #include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <numeric>
 
 namespace DP {
 
-	Projection::Projection(const int year_start, const int year_final) 
+	template<typename Options, typename value_t>
+	ProjectionT<Options, value_t>::ProjectionT(const int year_start, const int year_final) 
 	: pop(year_start, year_final),
 		dth(year_start, year_final),
 		dat(year_start, year_final),
-		_last_valid_time(-1) {
+		_last_valid_time(-1),
+		_last_stored_time(-1),
+		_first_restored_time(0),
+		_hiv_scratch(1),
+		_pool(nullptr) {
+		_summary.valid = false;
 		_year_first = year_start;
 		_year_final = year_final;
 		_num_years = year_final - year_start + 1;
 	}
 
-	Projection::~Projection() {}
+	template<typename Options, typename value_t>
+	ProjectionT<Options, value_t>::~ProjectionT() {}
 
-	void Projection::initialize(const std::string &upd_filename) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::initialize(const std::string &upd_filename) {
 		dat.initialize(upd_filename);
 	}
 
-	void Projection::project(const int year_end) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::project(const int year_end) {
 		const int time_end(std::min(year_end - year_first(), num_years()));
-		const int time_bgn(std::max(_last_valid_time, 0) + 1);
+		int time_bgn;
+
+		// Resume from the earliest year with inputs changed through ModelData setters
+		if (dat.changed_time() <= _last_valid_time)
+			_last_valid_time = dat.changed_time() - 1;
+		dat.clear_changes();
+
+		// Rolling storage only holds the last pop.num_slots() years projected, so
+		// resuming from an earlier year requires starting from the beginning
+		if (pop.rolling() && _last_valid_time <= _last_stored_time - pop.num_slots())
+			_last_valid_time = -1;
+
+		// After load_snapshot(), years before the snapshot year are not stored, so
+		// resuming from an earlier year also requires starting from the beginning
+		if (_last_valid_time < _first_restored_time)
+			_last_valid_time = -1;
+		time_bgn = std::max(_last_valid_time, 0) + 1;
 
 		if (_last_valid_time < 0) {
+			_first_restored_time = 0;
 			init_baseyear_population();
 			calc_births_baseyear();
 			calc_deaths_baseyear();
 			calc_popsize(0);
+			_last_stored_time = 0;
+			record_outputs(0);
 		}
 
 		for (int t(time_bgn); t <= time_end; ++t) {
+			// Some compartments are only added to during the year. Their storage may
+			// hold an earlier projection of year t or, with rolling storage, year t - 2
+			pop.clear_year(t);
+			dth.clear_year(t);
 			project_one_year(t);
 			calc_popsize(t);
+			_last_stored_time = t;
+			record_outputs(t);
 		}
 
 		_last_valid_time = time_end;
 	}
 
-	void Projection::invalidate(const int year) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::record_outputs(const int time) {
+		for (OutputSink<ProjectionT>* sink : _sinks)
+			sink->record(*this, time);
+		if (_year_callback) _year_callback(*this, time);
+	}
+
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::thread_pool(GB::WorkStealingPool* pool) {
+		_pool = pool;
+		_hiv_scratch.resize(pool ? pool->num_threads() : 1);
+	}
+
+	template<typename Options, typename value_t>
+	template<typename task_t>
+	void ProjectionT<Options, value_t>::for_each_stratum(const int n, const task_t& task) {
+		if (_pool) {
+			_pool->parallel_for(n, task);
+		} else {
+			for (int i(0); i < n; ++i)
+				task(i, 0);
+		}
+	}
+
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::invalidate(const int year) {
 		// If 'year' is before the first year of projection, use -1. Otherwise, reset
 		// _last_valid_time to the given year or the _last_valid_time, whichever is
 		// earlier
 		_last_valid_time = (year < year_first() ? -1 : std::min(year - year_first(), _last_valid_time));
 	}
 
-	void Projection::calc_popsize(const int t) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::calc_popsize(const int t) {
 		int a, b, d, h, r, s;
-		popsize_t count;
+		accum_t count;
 
 		for (a = DP::AGE_CHILD_MIN; a <= DP::AGE_CHILD_MAX; ++a) {
 			s = DP::FEMALE;
@@ -94,7 +155,8 @@ namespace DP {
 		}
 	}
 
-	void Projection::init_baseyear_population() {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::init_baseyear_population() {
 		const int t(0), r(DP::POP_NOSEX);
 		int a, s;
 
@@ -119,7 +181,8 @@ namespace DP {
 
 	/// @pre pop.adult_neg(0, s, a, DP::POP_NOSEX) stores the whole population for sex s and age a. Males
 	/// are not yet disaggregated by circumcision status.
-	void Projection::init_baseyear_risk() {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::init_baseyear_risk() {
 		const int t(0);
 		int a, k, r, s;
 		double size_fert, size_curr, size_prev, scale;
@@ -137,7 +200,7 @@ namespace DP {
 
 		// Enumerate key populations with and without turnover ("turn" and "stay", respectively)
 		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
-			for (r = DP::POP_KEY_MIN; r < N_POP_SEX[s]; ++r)
+			for (r = DP::POP_KEY_MIN; r < key_pop_end(s); ++r)
 				if (dat.keypop_stay(s, r)) {
 					kp_stay_sex[ns] = s;
 					kp_stay_pop[ns] = r;
@@ -266,7 +329,8 @@ namespace DP {
 		}
 	}
 
-	void Projection::init_baseyear_male_circumcision() {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::init_baseyear_male_circumcision() {
 		const int t(0);
 		double prop[DP::N_AGE];
 		double n;
@@ -296,13 +360,14 @@ namespace DP {
 		}
 	}
 
-	void Projection::calc_births_baseyear() {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::calc_births_baseyear() {
 		const int t(0), s(DP::FEMALE);
 
 		const double perc_m(dat.srb(t) / (dat.srb(t) + 100.0));
 		const double perc_f(1.0 - perc_m);
-		popsize_t female[DP::N_AGE];
-		popsize_t denom(0.0), births(0.0);
+		accum_t female[DP::N_AGE];
+		double denom(0.0), births(0.0);
 		int a, b, d, h, r;
 
 		for (a = 14; a <= DP::AGE_BIRTH_MAX; ++a)
@@ -340,7 +405,8 @@ namespace DP {
 		dat.births(t, DP::FEMALE, births * perc_f);
 	}
 
-	void Projection::calc_deaths_baseyear() {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::calc_deaths_baseyear() {
 		const int t(0);
 		double mort, deaths;
 		int a, s;
@@ -367,7 +433,8 @@ namespace DP {
 		}
 	}
 
-	void Projection::project_one_year(const int t) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::project_one_year(const int t) {
 		// We sequence risk calculations before HIV calculations so that we capture HIV
 		// risk among those who debut sexually at age 15
 		advance_one_year_demography(t);
@@ -378,34 +445,69 @@ namespace DP {
 		insert_endyear_migrants(t);
 	}
 
-	void Projection::advance_one_year_demography(const int t) {
-		double buff[DP::N_HIV_CHILD];
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::advance_one_year_demography(const int t) {
+		const int n_age(DP::N_AGE - 1); // ages 1-80+
 		double surv, mort, births;
-		int a, b, d, h, r, s, u;
 
-		// Projection
-		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
-			s = sex[u];
+		// Projection. Each sex, circumcision status and age only depends on the previous year
+		for_each_stratum(DP::N_SEX_MC * n_age, [&](const int i, const int) {
+			advance_demography_stratum(t, DP::SEX_MC_MIN + i / n_age, DP::AGE_MIN + 1 + i % n_age);
+		});
+
+		// Add births to the population
+		const double perc_m(dat.srb(t) / (dat.srb(t) + 100.0));
+		const double perc_f(1.0 - perc_m);
+		births = calc_births(t);
+		dat.births(t, DP::MALE,   births * perc_m);
+		dat.births(t, DP::FEMALE, births * perc_f);
+
+		// all newborn males are assumed uncircumcised
+		for (int u = DP::SEX_MIN; u <= DP::SEX_MAX; ++u) {
+			surv = dat.Sx(t,u,0);
+			mort = 1.0 - surv;
+			pop.child_neg(t, u, 0) = dat.births(t,u) * surv;
+			dth.child_neg(t, u, 0) = dat.births(t,u) * mort;
+		}
+	}
 
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::advance_demography_stratum(const int t, const int u, const int a) {
+		const int s(sex[u]);
+		const int b(a - DP::AGE_ADULT_MIN);
+		double buff[DP::N_HIV_CHILD];
+		double surv, mort;
+		int d, h, r;
+
+		if (a <= DP::AGE_CHILD_MAX) {
 			// ages 1-14
-			for (a = DP::AGE_CHILD_MIN + 1; a <= DP::AGE_CHILD_MAX; ++a) {
-				surv = dat.Sx(t, s, a);
-				mort = 1.0 - surv;
+			surv = dat.Sx(t, s, a);
+			mort = 1.0 - surv;
 
-				pop.child_neg(t, u, a) = pop.child_neg(t - 1, u, a - 1) * surv;
-				dth.child_neg(t, u, a) = pop.child_neg(t - 1, u, a - 1) * mort;
+			pop.child_neg(t, u, a) = pop.child_neg(t - 1, u, a - 1) * surv;
+			dth.child_neg(t, u, a) = pop.child_neg(t - 1, u, a - 1) * mort;
 
-				for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h) {
-					for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
-						pop.child_hiv(t, u, a, h, d) = pop.child_hiv(t - 1, u, a - 1, h, d) * surv;
-						dth.child_hiv(t, u, a, h, d) = pop.child_hiv(t - 1, u, a - 1, h, d) * mort;
-					}
+			for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h) {
+				for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+					pop.child_hiv(t, u, a, h, d) = pop.child_hiv(t - 1, u, a - 1, h, d) * surv;
+					dth.child_hiv(t, u, a, h, d) = pop.child_hiv(t - 1, u, a - 1, h, d) * mort;
 				}
 			}
 
+			// redistribute 5 year-olds from CD4 percentages to numbers
+			if (a == 5) {
+				for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+					for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h)
+						buff[h] = pop.child_hiv(t, u, a, h, d);
+					for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h) {
+						pop.child_hiv(t, u, a, h, d) = 0.0;
+						for (int i(DP::HIV_CHILD_MIN); i <= DP::HIV_CHILD_MAX; ++i)
+							pop.child_hiv(t, u, a, h, d) += CD4_MAP_AGE_5[i][h] * buff[i];
+					}
+				}
+			}
+		} else if (a == DP::AGE_ADULT_MIN) {
 			// age 15
-			a = DP::AGE_ADULT_MIN;
-			b = a - DP::AGE_ADULT_MIN;
 			r = DP::POP_NOSEX; // Children are assumed sexually inactive before age 15
 			surv = dat.Sx(t, s, a);
 			mort = 1.0 - surv;
@@ -419,27 +521,37 @@ namespace DP {
 				}
 			}
 
-			// ages 16-79
-			for (a = DP::AGE_ADULT_MIN + 1; a < DP::AGE_ADULT_MAX; ++a) {
-				b = a - DP::AGE_ADULT_MIN;
-				surv = dat.Sx(t, s, a);
-				mort = 1.0 - surv;
-
-				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
-					pop.adult_neg(t, u, b, r) = pop.adult_neg(t - 1, u, b - 1, r) * surv;
-					dth.adult_neg(t, u, b, r) = pop.adult_neg(t - 1, u, b - 1, r) * mort;
-				}
-				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+			// redistribute 15 year-olds from child to adult CD4 categories
+			for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+				for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
 					for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
-						for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
-							pop.adult_hiv(t, u, b, r, h, d) = pop.adult_hiv(t - 1, u, b - 1, r, h, d) * surv;
-							dth.adult_hiv(t, u, b, r, h, d) = pop.adult_hiv(t - 1, u, b - 1, r, h, d) * mort;
-						}
+						buff[h] = pop.adult_hiv(t, u, b, r, h, d);
+					pop.adult_hiv(t, u, b, r, DP::HIV_PRIMARY, d) = 0.00;
+					pop.adult_hiv(t, u, b, r, DP::HIV_GEQ_500, d) = buff[DP::HIV_PED_GEQ_1000] + buff[DP::HIV_PED_750_1000] + buff[DP::HIV_PED_500_750];
+					pop.adult_hiv(t, u, b, r, DP::HIV_350_500, d) = buff[DP::HIV_PED_350_500];
+					pop.adult_hiv(t, u, b, r, DP::HIV_200_350, d) = buff[DP::HIV_PED_200_350];
+					pop.adult_hiv(t, u, b, r, DP::HIV_100_200, d) = 0.35 * buff[DP::HIV_PED_LT_200];
+					pop.adult_hiv(t, u, b, r, DP::HIV_050_100, d) = 0.21 * buff[DP::HIV_PED_LT_200];
+					pop.adult_hiv(t, u, b, r, DP::HIV_050_100, d) = 0.44 * buff[DP::HIV_PED_LT_200];
+				}
 			}
+		} else if (a < DP::AGE_ADULT_MAX) {
+			// ages 16-79
+			surv = dat.Sx(t, s, a);
+			mort = 1.0 - surv;
 
+			for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+				pop.adult_neg(t, u, b, r) = pop.adult_neg(t - 1, u, b - 1, r) * surv;
+				dth.adult_neg(t, u, b, r) = pop.adult_neg(t - 1, u, b - 1, r) * mort;
+			}
+			for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+				for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+					for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+						pop.adult_hiv(t, u, b, r, h, d) = pop.adult_hiv(t - 1, u, b - 1, r, h, d) * surv;
+						dth.adult_hiv(t, u, b, r, h, d) = pop.adult_hiv(t - 1, u, b - 1, r, h, d) * mort;
+					}
+		} else {
 			// ages 80+
-			a = DP::AGE_ADULT_MAX;
-			b = a - DP::AGE_ADULT_MIN;
 			const double surv_79(dat.Sx(t, s, a));
 			const double surv_80(dat.Sx(t, s, a + 1));
 			const double mort_79(1.0 - surv_79);
@@ -454,55 +566,11 @@ namespace DP {
 						pop.adult_hiv(t, u, b, r, h, d) = pop.adult_hiv(t - 1, u, b - 1, r, h, d) * surv_79 + pop.adult_hiv(t - 1, u, b, r, h, d) * surv_80;
 						dth.adult_hiv(t, u, b, r, h, d) = pop.adult_hiv(t - 1, u, b - 1, r, h, d) * mort_79 + pop.adult_hiv(t - 1, u, b, r, h, d) * mort_80;
 					}
-
-			// redistribute 5 year-olds from CD4 percentages to numbers
-			a = 5;
-			for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
-				for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h)
-					buff[h] = pop.child_hiv(t, u, a, h, d);
-				for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h) {
-					pop.child_hiv(t, u, a, h, d) = 0.0;
-					for (int i(DP::HIV_CHILD_MIN); i <= DP::HIV_CHILD_MAX; ++i)
-						pop.child_hiv(t, u, a, h, d) += CD4_MAP_AGE_5[i][h] * buff[i];
-				}
-			}
-
-			// redistribute 15 year-olds from child to adult CD4 categories
-			a = DP::AGE_ADULT_MIN;
-			b = a - DP::AGE_ADULT_MIN;
-			for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
-				for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
-					for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
-						buff[h] = pop.adult_hiv(t, u, b, r, h, d);
-					pop.adult_hiv(t, u, b, r, DP::HIV_PRIMARY, d) = 0.00;
-					pop.adult_hiv(t, u, b, r, DP::HIV_GEQ_500, d) = buff[DP::HIV_PED_GEQ_1000] + buff[DP::HIV_PED_750_1000] + buff[DP::HIV_PED_500_750];
-					pop.adult_hiv(t, u, b, r, DP::HIV_350_500, d) = buff[DP::HIV_PED_350_500];
-					pop.adult_hiv(t, u, b, r, DP::HIV_200_350, d) = buff[DP::HIV_PED_200_350];
-					pop.adult_hiv(t, u, b, r, DP::HIV_100_200, d) = 0.35 * buff[DP::HIV_PED_LT_200];
-					pop.adult_hiv(t, u, b, r, DP::HIV_050_100, d) = 0.21 * buff[DP::HIV_PED_LT_200];
-					pop.adult_hiv(t, u, b, r, DP::HIV_050_100, d) = 0.44 * buff[DP::HIV_PED_LT_200];
-				}
-			}
-
-		}
-
-		// Add births to the population
-		const double perc_m(dat.srb(t) / (dat.srb(t) + 100.0));
-		const double perc_f(1.0 - perc_m);
-		births = calc_births(t);
-		dat.births(t, DP::MALE,   births * perc_m);
-		dat.births(t, DP::FEMALE, births * perc_f);
-
-		// all newborn males are assumed uncircumcised
-		for (int u = DP::SEX_MIN; u <= DP::SEX_MAX; ++u) {
-			surv = dat.Sx(t,u,0);
-			mort = 1.0 - surv;
-			pop.child_neg(t, u, 0) = dat.births(t,u) * surv;
-			dth.child_neg(t, u, 0) = dat.births(t,u) * mort;
 		}
 	}
 	
-	void Projection::advance_one_year_risk(const int t) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::advance_one_year_risk(const int t) {
 		const double eps = std::numeric_limits<double>::epsilon(); // padding term to avoid divide-by-zero
 		const sex_t umin[DP::N_SEX] = {DP::FEMALE, DP::MALE_U};
 		const sex_t umax[DP::N_SEX] = {DP::FEMALE, DP::MALE_C};
@@ -531,7 +599,7 @@ namespace DP {
 
 		// Enumerate key populations with and without turnover ("turn" and "stay", respectively)
 		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
-			for (r = DP::POP_KEY_MIN; r < N_POP_SEX[s]; ++r)
+			for (r = DP::POP_KEY_MIN; r < key_pop_end(s); ++r)
 				if (dat.keypop_stay(s, r)) {
 					kp_stay_sex[ns] = s;
 					kp_stay_pop[ns] = r;
@@ -722,200 +790,246 @@ namespace DP {
 
 	}
 
-	void Projection::advance_one_year_male_circumcision(const int t) {
-		int a, b, r, h, d;
-		double puptake, nuptake;
-
-		// Children
-		for (a = DP::AGE_CHILD_MIN; a <= DP::AGE_CHILD_MAX; ++a) {
-			puptake = dat.uptake_male_circumcision(t, a);
-			nuptake = pop.child_neg(t, DP::MALE_U, a) * puptake;
-			pop.child_neg(t, DP::MALE_U, a) -= nuptake;
-			pop.child_neg(t, DP::MALE_C, a) += nuptake;
-			for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h) {
-				for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
-					nuptake = pop.child_hiv(t, DP::MALE_U, a, h, d) * puptake;
-					pop.child_hiv(t, DP::MALE_U, a, h, d) -= nuptake;
-					pop.child_hiv(t, DP::MALE_C, a, h, d) += nuptake;
-				}
-			}
-		}
-
-		// Adults
-		for (a = DP::AGE_ADULT_MIN; a <= DP::AGE_ADULT_MAX; ++a) {
-			b = a - DP::AGE_ADULT_MIN;
-			puptake = dat.uptake_male_circumcision(t, a);
-			for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
-				nuptake = pop.adult_neg(t, DP::MALE_U, b, r) * puptake;
-				pop.adult_neg(t, DP::MALE_U, b, r) -= nuptake;
-				pop.adult_neg(t, DP::MALE_C, b, r) += nuptake;
-				for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::advance_one_year_male_circumcision(const int t) {
+		// Uptake moves men between circumcision states of the same age, so ages are independent
+		for_each_stratum(DP::N_AGE, [&](const int a, const int) {
+			const double puptake(dat.uptake_male_circumcision(t, a));
+			const int b(a - DP::AGE_ADULT_MIN);
+			double nuptake;
+			int r, h, d;
+
+			if (a <= DP::AGE_CHILD_MAX) {
+				nuptake = pop.child_neg(t, DP::MALE_U, a) * puptake;
+				pop.child_neg(t, DP::MALE_U, a) -= nuptake;
+				pop.child_neg(t, DP::MALE_C, a) += nuptake;
+				for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h) {
 					for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
-						nuptake = pop.adult_hiv(t, DP::MALE_U, b, r, h, d) * puptake;
-						pop.adult_hiv(t, DP::MALE_U, b, r, h, d) -= nuptake;
-						pop.adult_hiv(t, DP::MALE_C, b, r, h, d) += nuptake;
+						nuptake = pop.child_hiv(t, DP::MALE_U, a, h, d) * puptake;
+						pop.child_hiv(t, DP::MALE_U, a, h, d) -= nuptake;
+						pop.child_hiv(t, DP::MALE_C, a, h, d) += nuptake;
+					}
+				}
+			} else {
+				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+					nuptake = pop.adult_neg(t, DP::MALE_U, b, r) * puptake;
+					pop.adult_neg(t, DP::MALE_U, b, r) -= nuptake;
+					pop.adult_neg(t, DP::MALE_C, b, r) += nuptake;
+					for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+						for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+							nuptake = pop.adult_hiv(t, DP::MALE_U, b, r, h, d) * puptake;
+							pop.adult_hiv(t, DP::MALE_U, b, r, h, d) -= nuptake;
+							pop.adult_hiv(t, DP::MALE_C, b, r, h, d) += nuptake;
+						}
 					}
 				}
 			}
-		}
-
+		});
 	}
 
-	void Projection::advance_one_year_hiv(const int time) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::advance_one_year_hiv(const int time) {
 		advance_one_year_hiv_adult(time);
 		advance_one_year_hiv_child(time);
 	}
 
-	void Projection::advance_one_year_hiv_adult(const int time) {
-		if (!dat.direct_incidence() && time == dat.seed_time()) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::advance_one_year_hiv_adult(const int time) {
+		_summary.valid = false; // the population changed since the last time step
+
+		if (!direct_incidence() && time == dat.seed_time()) {
 			seed_epidemic(time, dat.seed_prevalence());
 		}
 
-		for (int step(0); step < DP::HIV_TIME_STEPS; ++step) {
+		if (!direct_incidence() && time >= dat.seed_time()) {
+			_transmission_cache.update(dat, time);
+		}
+
+		for (int step(0); step < hiv_time_steps(); ++step) {
 			advance_one_step_hiv_adult(time, step);
-			if (dat.direct_incidence()) {
+			if (direct_incidence()) {
 				insert_adult_infections(time, step);
 			} else {
 				if (time >= dat.seed_time())
-					calc_adult_infections(time, step);
+					calc_adult_infections(time, step, _transmission_cache);
 			}
 		}
 	}
 
-	void Projection::advance_one_year_hiv_child(const int t) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::advance_one_year_hiv_child(const int t) {
 		double births_exposed(calc_births_hiv_exposed(t));
 		dat.births_hiv_exposed(t, births_exposed);
 		// TODO: pediatric HIV infection and progression calculations
 	}
 
-	void Projection::advance_one_step_hiv_adult(const int t, const int step) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::advance_one_step_hiv_adult(const int t, const int step) {
 		const double eps = std::numeric_limits<double>::epsilon(); // padding to avoid divide-by-zero
 
-		int s, u, a, b, r, h, d;
-		double influx[DP::N_HIV_ADULT][DP::N_DTX], efflux[DP::N_HIV_ADULT][DP::N_DTX];
-		double art_exit[DP::N_HIV_ADULT];
-		double prog_primary, off_art;
-		double num_art[DP::N_SEX], num_off[DP::N_SEX];
+		int s, b, h, d;
+		double num_art;
 		double art_mort_scale[DP::N_SEX][DP::N_AGE_ADULT][DP::N_HIV_ADULT];
+		std::ptrdiff_t pop_cell[DP::N_HIV_CELL], dth_cell[DP::N_HIV_CELL];
+		const std::ptrdiff_t pop_risk(pop.adult_hiv_stride(3)), dth_risk(dth.adult_hiv_stride(3));
 		sex_hiv_t uptake_rate(boost::extents[DP::N_SEX][DP::N_HIV_ADULT]);
 
+		if (!_summary.valid)
+			calc_step_summary(t);
+
 		calc_adult_art_uptake(t, step, uptake_rate);
 
 		// Calculate scale factors for adjusting HIV-related mortality off ART based
 		// on ART coverage. We sum over behavioral risk groups, male circumcision
 		// status, and different off-ART compartment sizes so that these reductions
 		// align with Spectrum.
-		for (b = 0; b < DP::N_AGE_ADULT; ++b) {
-			for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
-				num_art[DP::MALE] = num_art[DP::FEMALE] = 0.0;
-				num_off[DP::MALE] = num_off[DP::FEMALE] = 0.0;
-				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
-					for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d) {
-						num_art[DP::MALE  ] += pop.adult_hiv(t, DP::MALE_U, b, r, h, d) + pop.adult_hiv(t, DP::MALE_C, b, r, h, d);
-						num_art[DP::FEMALE] += pop.adult_hiv(t, DP::FEMALE, b, r, h, d);
-					}
-					for (d = DP::DTX_OFF_MIN; d <= DP::DTX_OFF_MAX; ++d) {
-						num_off[DP::MALE  ] += pop.adult_hiv(t, DP::MALE_U, b, r, h, d) + pop.adult_hiv(t, DP::MALE_C, b, r, h, d);
-						num_off[DP::FEMALE] += pop.adult_hiv(t, DP::FEMALE, b, r, h, d);
-					}
+		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
+			for (b = 0; b < DP::N_AGE_ADULT; ++b) {
+				for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+					num_art = 0.0;
+					for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d)
+						num_art += _summary.on_art[s][b][h][d - DP::DTX_ART_MIN];
+					art_mort_scale[s][b][h] = 1.0 - num_art / (num_art + _summary.off_art[s][b][h] + eps);
 				}
-				for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
-					art_mort_scale[s][b][h] = 1.0 - num_art[s] / (num_art[s] + num_off[s] + eps);
-			}			
+			}
 		}
 
-		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
-			s = sex[u];
-			for (a = DP::AGE_ADULT_MIN; a <= DP::AGE_ADULT_MAX; ++a) {
-				b = a - DP::AGE_ADULT_MIN;
-				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
-
-					// Buffer patients who interrupt ART. ART_EXIT_STAGE maps
-					// from baseline HIV stage h at ART initiation and ART duration d
-					// to HIV stage after interruption.
-					for (h = DP::HIV_MIN; h <= DP::HIV_MAX; ++h)
-						art_exit[h] = 0.0;
-					for (h = DP::HIV_MIN; h <= DP::HIV_MAX; ++h) {
-						for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d)
-							art_exit[ART_EXIT_STAGE[h][d]] += pop.adult_hiv(t, u, b, r, h, d) * dat.art_exit_adult(t, s);
-					}
+		// The summary is rebuilt below as each compartment is updated
+		clear_step_summary();
 
-					// Calculate flows
-					// Not on ART
-					// TODO: implement reductions in off-ART mortality proportional to ART coverage as in AIM
-					for (d = DP::DTX_UNAWARE; d <= DP::DTX_PREV_TX; ++d) {
-#ifndef SPECTRUM_CD4
-						prog_primary = pop.adult_hiv(t, u, b, r, HIV_PRIMARY, d) * dat.hiv_prog(s, a, HIV_PRIMARY);
-
-						influx[HIV_PRIMARY][d] = 0.0;
-						influx[HIV_GEQ_500][d] = prog_primary * dat.hiv_dist(s, a, HIV_GEQ_500);
-						influx[HIV_350_500][d] = prog_primary * dat.hiv_dist(s, a, HIV_350_500) + pop.adult_hiv(t, u, b, r, HIV_GEQ_500, d) * dat.hiv_prog(s, a, HIV_GEQ_500);
-						influx[HIV_200_350][d] = prog_primary * dat.hiv_dist(s, a, HIV_200_350) + pop.adult_hiv(t, u, b, r, HIV_350_500, d) * dat.hiv_prog(s, a, HIV_350_500);
-						influx[HIV_100_200][d] = prog_primary * dat.hiv_dist(s, a, HIV_100_200) + pop.adult_hiv(t, u, b, r, HIV_200_350, d) * dat.hiv_prog(s, a, HIV_200_350);
-						influx[HIV_050_100][d] = prog_primary * dat.hiv_dist(s, a, HIV_050_100) + pop.adult_hiv(t, u, b, r, HIV_100_200, d) * dat.hiv_prog(s, a, HIV_100_200);
-						influx[HIV_000_050][d] = prog_primary * dat.hiv_dist(s, a, HIV_000_050) + pop.adult_hiv(t, u, b, r, HIV_050_100, d) * dat.hiv_prog(s, a, HIV_050_100);
-
-						efflux[HIV_PRIMARY][d] = pop.adult_hiv(t, u, b, r, HIV_PRIMARY, d) * (dat.hiv_prog(s, a, HIV_PRIMARY) + art_mort_scale[s][b][HIV_PRIMARY] * dat.hiv_mort(s, a, HIV_PRIMARY));
-						efflux[HIV_GEQ_500][d] = pop.adult_hiv(t, u, b, r, HIV_GEQ_500, d) * (dat.hiv_prog(s, a, HIV_GEQ_500) + art_mort_scale[s][b][HIV_GEQ_500] * dat.hiv_mort(s, a, HIV_GEQ_500));
-						efflux[HIV_350_500][d] = pop.adult_hiv(t, u, b, r, HIV_350_500, d) * (dat.hiv_prog(s, a, HIV_350_500) + art_mort_scale[s][b][HIV_350_500] * dat.hiv_mort(s, a, HIV_350_500));
-						efflux[HIV_200_350][d] = pop.adult_hiv(t, u, b, r, HIV_200_350, d) * (dat.hiv_prog(s, a, HIV_200_350) + art_mort_scale[s][b][HIV_200_350] * dat.hiv_mort(s, a, HIV_200_350));
-						efflux[HIV_100_200][d] = pop.adult_hiv(t, u, b, r, HIV_100_200, d) * (dat.hiv_prog(s, a, HIV_100_200) + art_mort_scale[s][b][HIV_100_200] * dat.hiv_mort(s, a, HIV_100_200));
-						efflux[HIV_050_100][d] = pop.adult_hiv(t, u, b, r, HIV_050_100, d) * (dat.hiv_prog(s, a, HIV_050_100) + art_mort_scale[s][b][HIV_050_100] * dat.hiv_mort(s, a, HIV_050_100));
-						efflux[HIV_000_050][d] = pop.adult_hiv(t, u, b, r, HIV_000_050, d) * dat.hiv_mort(s, a, HIV_000_050);
-#else
-						influx[DP::HIV_ADULT_MIN][d] = 0.0;
-						for (h = DP::HIV_ADULT_MIN + 1; h <= DP::HIV_ADULT_MAX; ++h)
-							influx[h][d] = pop.adult_hiv(t, u, b, r, h - 1, d) * dat.hiv_prog(s, a, h - 1);
-
-						for (h = DP::HIV_ADULT_MIN; h < DP::HIV_ADULT_MAX; ++h)
-							efflux[h][d] = pop.adult_hiv(t, u, b, r, h, d) * (dat.hiv_prog(s, a, h) + art_mort_scale[s][b][h] * dat.hiv_mort(s, a, h));
-						efflux[DP::HIV_ADULT_MAX][d] = pop.adult_hiv(t, u, b, r, DP::HIV_ADULT_MAX, d) * art_mort_scale[s][b][h] * dat.hiv_mort(s, a, DP::HIV_ADULT_MAX);
-#endif
-
-						for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
-							dth.adult_hiv(t, u, b, r, h, d) += DP::HIV_STEP_SIZE * pop.adult_hiv(t, u, b, r, h, d) * art_mort_scale[s][b][h] * dat.hiv_mort(s, a, h);
-					}
+		// Offsets of each CD4 and care status cell from the start of a compartment,
+		// which depend on the population layout
+		for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+			for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+				pop_cell[h * DP::N_DTX + d] = h * pop.adult_hiv_stride(4) + d * pop.adult_hiv_stride(5);
+				dth_cell[h * DP::N_DTX + d] = h * dth.adult_hiv_stride(4) + d * dth.adult_hiv_stride(5);
+			}
 
-					// Adjust for ART interruption
-					for (h = DP::HIV_MIN; h <= DP::HIV_MAX; ++h) {
-						influx[h][DP::DTX_PREV_TX] += art_exit[h];
-					}
+		// Flows are linear in the population of each sex and age, so we advance all
+		// risk groups and circumcision states of the same sex and age together. These
+		// are copied into lanes of a cell-major block for HivOperator. Each sex and
+		// age only updates its own compartments and summary entries
+		for_each_stratum(DP::N_AGE_ADULT * DP::N_SEX, [&](const int k, const int thread) {
+			const int a(DP::AGE_ADULT_MIN + k / DP::N_SEX);
+			const int b(a - DP::AGE_ADULT_MIN);
+			const int s(DP::SEX_MIN + k % DP::N_SEX);
+			HivStepScratch& scratch(_hiv_scratch[thread]);
+			HivOperator& hiv_op(scratch.op);
+			popsize_t *pop_hiv, *dth_hiv;
+			int u, r, i, nlane;
+
+			gather_hiv_step_rates(t, s, a, art_mort_scale[s][b], uptake_rate, scratch.rates);
+			hiv_op.assemble<Options::cd4_scheme>(scratch.rates);
+			hiv_op.update_exposure(hiv_step_size(), dat.hiv_integrator());
+
+			nlane = 0;
+			for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
+				if (sex[u] == s) {
+					pop_hiv = &pop.adult_hiv(t, u, b, DP::POP_MIN, DP::HIV_ADULT_MIN, DP::DTX_MIN);
+					for (i = 0; i < DP::N_HIV_CELL; ++i)
+						for (r = 0; r < DP::N_POP; ++r) {
+							scratch.x[i][nlane + r] = pop_hiv[r * pop_risk + pop_cell[i]];
+							scratch.deaths[i][nlane + r] = 0.0;
+						}
+					nlane += DP::N_POP;
+				}
+			}
 
-					// Adjust for ART uptake
-					for (h = DP::HIV_MIN; h <= DP::HIV_MAX; ++h) {
-						for (d = DP::DTX_OFF_MIN; d <= DP::DTX_OFF_MAX; ++d) {
-							efflux[h][d] += pop.adult_hiv(t, u, b, r, h, d) * uptake_rate[s][h];
+			hiv_op.advance(scratch.x, scratch.deaths, nlane);
+
+			nlane = 0;
+			for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
+				if (sex[u] == s) {
+					pop_hiv = &pop.adult_hiv(t, u, b, DP::POP_MIN, DP::HIV_ADULT_MIN, DP::DTX_MIN);
+					dth_hiv = &dth.adult_hiv(t, u, b, DP::POP_MIN, DP::HIV_ADULT_MIN, DP::DTX_MIN);
+					for (i = 0; i < DP::N_HIV_CELL; ++i)
+						for (r = 0; r < DP::N_POP; ++r) {
+							pop_hiv[r * pop_risk + pop_cell[i]] = scratch.x[i][nlane + r];
+							dth_hiv[r * dth_risk + dth_cell[i]] += scratch.deaths[i][nlane + r];
 						}
-					}
+					for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+						accumulate_step_summary(t, u, b, r);
+					nlane += DP::N_POP;
+				}
+			}
+		});
+		_summary.valid = true;
+	}
 
-					// On ART
-					for (h = DP::HIV_MIN; h <= DP::HIV_MAX; ++h) {
-						off_art = pop.adult_hiv(t, u, b, r, h, DP::DTX_UNAWARE)
-							      + pop.adult_hiv(t, u, b, r, h, DP::DTX_AWARE)
-							      + pop.adult_hiv(t, u, b, r, h, DP::DTX_PREV_TX);
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::gather_hiv_step_rates(const int t, const int s, const int a, const double* mort_scale, const sex_hiv_t& uptake_rate, HivStepRates& rates) {
+		const int b = a - DP::AGE_ADULT_MIN;
+		int h, d, k;
+
+		rates.art_exit = dat.art_exit_adult(t, s);
+		for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d)
+			rates.art_flow[d - DP::DTX_ART_MIN] = dat.art_flow(d);
+
+		for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+			rates.prog[h] = dat.hiv_prog(s, a, h);
+			rates.dist[h] = dat.hiv_dist(s, a, h);
+			rates.mort[h] = dat.hiv_mort(s, a, h);
+			rates.mort_scale[h] = mort_scale[h];
+			rates.off_out[h] = rates.prog[h] + rates.mort_scale[h] * rates.mort[h];
+			rates.uptake[h] = uptake_rate[s][h];
+			for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d) {
+				k = d - DP::DTX_ART_MIN;
+				rates.art_mort[h][k] = dat.art_mort_adult(t, s, b, h, d);
+				rates.art_out[h][k] = rates.art_exit + rates.art_mort[h][k];
+				if (d < DP::DTX_ART_MAX) // the last ART duration category is absorbing
+					rates.art_out[h][k] += rates.art_flow[k];
+			}
+		}
 
-						influx[h][DP::DTX_ART1] = off_art * uptake_rate[s][h];
-						influx[h][DP::DTX_ART2] = pop.adult_hiv(t, u, b, r, h, DP::DTX_ART1) * dat.art_flow(DP::DTX_ART1);
-						influx[h][DP::DTX_ART3] = pop.adult_hiv(t, u, b, r, h, DP::DTX_ART2) * dat.art_flow(DP::DTX_ART2);
+		// Untreated HIV mortality in the last Goals CD4 category is not scaled by ART coverage
+		if constexpr (Options::cd4_scheme == DP::CD4_GOALS)
+			rates.off_out[DP::HIV_ADULT_MAX] = rates.mort[DP::HIV_ADULT_MAX];
+	}
 
-						efflux[h][DP::DTX_ART1] = pop.adult_hiv(t, u, b, r, h, DP::DTX_ART1) * (dat.art_exit_adult(t, s) + dat.art_mort_adult(t, s, b, h, DP::DTX_ART1) + dat.art_flow(DP::DTX_ART1));
-						efflux[h][DP::DTX_ART2] = pop.adult_hiv(t, u, b, r, h, DP::DTX_ART2) * (dat.art_exit_adult(t, s) + dat.art_mort_adult(t, s, b, h, DP::DTX_ART2) + dat.art_flow(DP::DTX_ART2));
-						efflux[h][DP::DTX_ART3] = pop.adult_hiv(t, u, b, r, h, DP::DTX_ART3) * (dat.art_exit_adult(t, s) + dat.art_mort_adult(t, s, b, h, DP::DTX_ART3));
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::calc_step_summary(const int t) {
+		int u, b, r;
+		clear_step_summary();
+		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+			for (b = 0; b < DP::N_AGE_ADULT; ++b)
+				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+					accumulate_step_summary(t, u, b, r);
+		_summary.valid = true;
+	}
 
-						for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d)
-							dth.adult_hiv(t, u, b, r, h, d) += DP::HIV_STEP_SIZE * pop.adult_hiv(t, u, b, r, h, d) * dat.art_mort_adult(t, s, b, h, d);
-					}
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::clear_step_summary() {
+		std::fill_n(&_summary.popsize[0][0][0], DP::N_SEX * DP::N_AGE_ADULT * DP::N_POP, 0.0);
+		std::fill_n(&_summary.plhiv_off[0][0][0][0], DP::N_SEX * DP::N_AGE_ADULT * DP::N_POP * DP::N_STAGE, 0.0);
+		std::fill_n(&_summary.plhiv_art[0][0][0][0], DP::N_SEX * DP::N_AGE_ADULT * DP::N_POP * DP::N_STAGE, 0.0);
+		std::fill_n(&_summary.off_art[0][0][0], DP::N_SEX * DP::N_AGE_ADULT * DP::N_HIV_ADULT, 0.0);
+		std::fill_n(&_summary.on_art[0][0][0][0], DP::N_SEX * DP::N_AGE_ADULT * DP::N_HIV_ADULT * DP::N_ART, 0.0);
+	}
 
-					// Implement flows
-					for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
-						for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d)
-							pop.adult_hiv(t, u, b, r, h, d) += DP::HIV_STEP_SIZE * (influx[h][d] - efflux[h][d]);
-				}
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::accumulate_step_summary(const int t, const int u, const int b, const int r) {
+		const int s = sex[u];
+		double num_off, num_art, popsize;
+		int h, d;
+
+		popsize = pop.adult_neg(t, u, b, r);
+		for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+			num_off = pop.adult_hiv(t, u, b, r, h, DP::DTX_UNAWARE) + pop.adult_hiv(t, u, b, r, h, DP::DTX_AWARE) + pop.adult_hiv(t, u, b, r, h, DP::DTX_PREV_TX);
+			num_art = 0.0;
+			for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d) {
+				_summary.on_art[s][b][h][d - DP::DTX_ART_MIN] += pop.adult_hiv(t, u, b, r, h, d);
+				num_art += pop.adult_hiv(t, u, b, r, h, d);
 			}
+			_summary.off_art[s][b][h] += num_off;
+			_summary.plhiv_off[s][b][r][stage[h]] += num_off;
+			_summary.plhiv_art[s][b][r][stage[h]] += num_art;
+			popsize += num_off + num_art;
 		}
+		_summary.popsize[s][b][r] += popsize;
 	}
 
-	void Projection::calc_adult_art_uptake(const int t, const int step, sex_hiv_t& uptake_rate) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::calc_adult_art_uptake(const int t, const int step, sex_hiv_t& uptake_rate) {
 		std::fill_n(uptake_rate.data(), uptake_rate.num_elements(), 0.0);
 
 		// Short-circuit uptake calculations if no one is on ART
@@ -925,6 +1039,9 @@ namespace DP {
 		}
 
 		const double eps = std::numeric_limits<double>::epsilon(); // padding to avoid divide-by-zero
+		const double max_prop = 1.0 - 1e-9; // upper bound on the proportion initiating ART per step
+		const double step_size = hiv_step_size();
+		const bool exponential = (dat.hiv_integrator() == DP::INTEGRATOR_EXPONENTIAL);
 		const int elig_first = dat.art_first_eligible_stage_adult(t);
 		const double wgt_mort = dat.art_mort_weight();
 		const double wgt_elig = 1.0 - dat.art_mort_weight();
@@ -940,7 +1057,7 @@ namespace DP {
 		double prop_mort[DP::N_HIV_ADULT], prop_elig[DP::N_HIV_ADULT];
 		double norm_mort, norm_elig;
 		double loss_rate, target, remaining;
-		int a, b, d, h, k, r, s, u;
+		int a, b, d, h, k, s;
 
 		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
 			for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
@@ -951,21 +1068,16 @@ namespace DP {
 		}
 
 		// Count the number eligible and project retention
-		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
-			s = sex[u];
+		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
 			for (a = DP::AGE_ADULT_MIN; a <= DP::AGE_ADULT_MAX; ++a) {
 				b = a - DP::AGE_ADULT_MIN;
-				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
-					for (h = elig_first; h <= DP::HIV_ADULT_MAX; ++h) {
-						for (d = DP::DTX_OFF_MIN; d <= DP::DTX_OFF_MAX; ++d) {
-							elig_cd4[s][h] += pop.adult_hiv(t, u, b, r, h, d);
-							mort_cd4[s][h] += pop.adult_hiv(t, u, b, r, h, d) * dat.hiv_mort(s, a, h);
-						}
-						for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d) {
-							loss_rate = (dat.art_exit_adult(t,s) + dat.art_mort_adult(t,s,b,h,d)) * DP::HIV_STEP_SIZE;
-							retained[s] += pop.adult_hiv(t, u, b, r, h, d) * (1.0 - loss_rate);
-							eligible[s] += pop.adult_hiv(t, u, b, r, h, d);
-						}
+				for (h = elig_first; h <= DP::HIV_ADULT_MAX; ++h) {
+					elig_cd4[s][h] += _summary.off_art[s][b][h];
+					mort_cd4[s][h] += _summary.off_art[s][b][h] * dat.hiv_mort(s, a, h);
+					for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d) {
+						loss_rate = (dat.art_exit_adult(t,s) + dat.art_mort_adult(t,s,b,h,d)) * step_size;
+						retained[s] += _summary.on_art[s][b][h][d - DP::DTX_ART_MIN] * (exponential ? std::exp(-loss_rate) : 1.0 - loss_rate);
+						eligible[s] += _summary.on_art[s][b][h][d - DP::DTX_ART_MIN];
 					}
 				}
 			}
@@ -994,9 +1106,9 @@ namespace DP {
 			// This mechanism is based on Spectrum, where steps are indexed 1..10. Goals
 			// ARM indexes steps by 0..9, so we add 1 to match.
 			if (dat.art_prop_adult(t,s) > 0.0) { // Input in percentages
-				target = retained[s] + (art_input[0][s] - retained[s]) * DP::HIV_STEP_SIZE * (step + 1);
+				target = retained[s] + (art_input[0][s] - retained[s]) * step_size * (step + 1);
 			} else {                             // Input in absolute numbers
-				target = art_input[1][s] + (art_input[0][s] - art_input[1][s]) * DP::HIV_STEP_SIZE * (step + 1);
+				target = art_input[1][s] + (art_input[0][s] - art_input[1][s]) * step_size * (step + 1);
 			}
 
 			// uptake[s] = target - retained[s] ideally, but cannot be negative and
@@ -1037,58 +1149,61 @@ namespace DP {
 			}
 		}
 
-		// Return an annualized uptake rate
+		// Return an annualized uptake rate. With the exponential integrator, the
+		// proportion initiating during the step is 1 - exp(-rate * step_size)
 		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
 				for (h = elig_first; h <= DP::HIV_ADULT_MAX; ++h)
-					uptake_rate[s][h] = (elig_cd4[s][h] > 0.0 ? HIV_TIME_STEPS * init_cd4[s][h] / elig_cd4[s][h] : 0.0);
+					if (elig_cd4[s][h] <= 0.0) {
+						uptake_rate[s][h] = 0.0;
+					} else if (exponential) {
+						uptake_rate[s][h] = -std::log1p(-std::min(init_cd4[s][h] / elig_cd4[s][h], max_prop)) / step_size;
+					} else {
+						uptake_rate[s][h] = hiv_time_steps() * init_cd4[s][h] / elig_cd4[s][h];
+					}
 	}
 
-	void Projection::calc_adult_infections(const int t, const int step) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::calc_adult_infections(const int t, const int step, TransmissionCache& cache) {
 		// TODO: This is quite slow. Can we approximate this well by doing calculations by age groups?
-		// TODO: add code to precalculate quantities that are constant throughout a year (transmission probabilities, maybe mixing and balancing are close enough?)
 		// TODO: needle-based transmission
 
-		const double eps = std::numeric_limits<double>::epsilon(); // padding to avoid divide-by-zero
-		const double e_condom = dat.effect_condom();
-
 		int si, bi, ri, sj, bj, rj; // i refers to HIV- partner, j to the HIV+
-		int ai, ui, uj, cj, hj, dj, vj, qij, zij;
+		int ai, ui, hj, vj;
 
-		double prop_transmit, vmmc_mult, new_hiv;
-		double bal_numer, bal_denom;
-		double bal_mix, acts_with, acts_wout, num_art, force_group;
-		double canmix_numer[DP::N_SEX][DP::N_POP], prefer_numer[DP::N_SEX][DP::N_POP];
+		double num_art;
 		double force[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];
-		double popsize[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];
 		double prev[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP][DP::N_STAGE][DP::N_VL];
-		double per_act[DP::N_STI], sti_wgt[DP::N_STI];
+
+		// With a thread pool, the mass and force of infection calculations below are
+		// split into tasks by sex and a block of ages of one partner, with one block
+		// of ages per thread. Each task writes its own entries, so nothing is summed
+		// across tasks and results do not depend on the number of threads
+		const int n_block(_pool ? _pool->num_threads() : 1);
 
 		// We calculate transmission in heterosexual marital or cohabiting "unions" separately from "other"
 		// partnerships that include same sex, casual, or commercial sexual partnerships. We make this distinction to
-		// ensure unions and other partnerships are both balanced
-		double mix_other, bal_other, canmix_denom, prefer_denom, assort;
+		// ensure unions and other partnerships are both balanced. The root_* arrays store square roots of
+		// partnership supply and their reciprocals, see TransmissionCache::mix_age() for details
 		double supply_other[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];
 		double supply_pop_other[DP::N_SEX][DP::N_POP];
-		double mix_pop_other[DP::N_SEX][DP::N_POP][DP::N_SEX][DP::N_POP];
-		double force_other[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];
+		double root_other[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP], inv_root_other[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];
 
-		double mix_union, bal_union, union_denom;
-		double prop_union[DP::N_SEX][DP::N_POP];
 		double supply_union[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];
 		double supply_pop_union[DP::N_SEX][DP::N_POP];
-		double mix_pop_union[DP::N_SEX][DP::N_POP][DP::N_SEX][DP::N_POP];
-		double force_union[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];
-
-		// Transmission probability per partnership ptransmit[si][sj][qij][hj][vj][zij]
-		// si  HIV- partner sex
-		// sj  HIV+ partner sex
-		// qij Partnership type
-		// hj  HIV+ partner infection stage
-		// vj  HIV+ partner viral load
-		// zij STI symptom status
-		// We assume transmission risk is independent of age after adjusting for the strata above
-		double ptransmit[DP::N_SEX][DP::N_SEX][DP::N_BOND][DP::N_STAGE][DP::N_VL][DP::N_STI];
-		double mass[DP::N_SEX][DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP][DP::N_BOND][DP::N_STI];
+		double root_union[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP], inv_root_union[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];
+
+		// Transmission probabilities per partnership are cached once per year, see
+		// TransmissionCache::ptransmit(). We assume transmission risk is independent
+		// of age after adjusting for sex, partnership type, HIV stage, viral load and
+		// STI symptom status.
+		//
+		// The probability of each STI symptom status in a partnership is the product
+		// of symptom prevalence in the HIV- and HIV+ partners. We sum over HIV+ partner
+		// symptoms when calculating mass, so mass[..][0] applies to HIV- partners
+		// without STI symptoms and mass[..][1] to those with symptoms. The force of
+		// infection is accumulated separately for each, then weighted by symptom
+		// prevalence in the HIV- partner after the partner loop.
+		double mass[DP::N_SEX][DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP][DP::N_BOND][2];
 
 		if (step == 0) { // initialization at first step of year
 			for (ui = 0; ui < DP::N_SEX_MC; ++ui) {
@@ -1100,248 +1215,223 @@ namespace DP {
 			}
 		}
 
-		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si) {
-			prop_union[si][DP::POP_NEVER] = 0.0;
-			prop_union[si][DP::POP_UNION] = 1.0;
-			prop_union[si][DP::POP_SPLIT] = 0.0;
-			prop_union[si][DP::POP_PWID ] = dat.keypop_married(si, DP::POP_PWID );
-			prop_union[si][DP::POP_BOTH ] = dat.keypop_married(si, DP::POP_BOTH );
-		}
-		prop_union[DP::MALE][DP::POP_MSM] = dat.keypop_married(DP::MALE, DP::POP_MSM);
-		prop_union[DP::MALE][DP::POP_TGW] = dat.keypop_married(DP::MALE, DP::POP_TGW);
-
-		// calculate population sizes
-		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si) {
-			for (bi = 0; bi < DP::N_AGE_ADULT; ++bi)
-				for (ri = DP::POP_MIN; ri < DP::N_POP_SEX[si]; ++ri)
-					popsize[si][bi][ri] = 0.0;
-		}
-
-		for (uj = DP::SEX_MC_MIN; uj <= DP::SEX_MC_MAX; ++uj) {
-			sj = sex[uj];
-			for (bj = 0; bj < DP::N_AGE_ADULT; ++bj)
-				for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
-					popsize[sj][bj][rj] += pop.adult_neg(t, uj, bj, rj);
-					for (cj = DP::HIV_ADULT_MIN; cj <= DP::HIV_ADULT_MAX; ++cj)
-						for (dj = DP::DTX_MIN; dj <= DP::DTX_MAX; ++dj)
-							popsize[sj][bj][rj] += pop.adult_hiv(t, uj, bj, rj, cj, dj);
-				}
-		}
+		// population sizes and PLHIV are taken from the step summary
+		if (!_summary.valid)
+			calc_step_summary(t);
 
 		// calculate partnership supply
 		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si) {
 			for (bi = 0; bi < DP::N_AGE_ADULT; ++bi)
 				for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
-					supply_other[si][bi][ri] = popsize[si][bi][ri] * dat.partner_rate(t, si, bi, ri);
-					supply_union[si][bi][ri] = popsize[si][bi][ri] * prop_union[si][ri];
-				}
-		}
-
-		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si) {
-			for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
-				supply_pop_other[si][ri] = 0.0;
-				supply_pop_union[si][ri] = 0.0;
-				for (bi = 0; bi < DP::N_AGE_ADULT; ++bi) {
-					supply_pop_other[si][ri] += supply_other[si][bi][ri];
-					supply_pop_union[si][ri] += supply_union[si][bi][ri];
+					supply_other[si][bi][ri] = _summary.popsize[si][bi][ri] * cache.partner_rate(si, bi, ri);
+					supply_union[si][bi][ri] = _summary.popsize[si][bi][ri] * cache.prop_union(si, ri);
+					root_other[si][bi][ri] = sqrt(supply_other[si][bi][ri]);
+					root_union[si][bi][ri] = sqrt(supply_union[si][bi][ri]);
+					inv_root_other[si][bi][ri] = (root_other[si][bi][ri] > 0.0 ? 1.0 / root_other[si][bi][ri] : 0.0);
+					inv_root_union[si][bi][ri] = (root_union[si][bi][ri] > 0.0 ? 1.0 / root_union[si][bi][ri] : 0.0);
 				}
-			}
 		}
 
-		// calculate mixing coefficient factors by behavioral risk group
-		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si) {
-			for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
-				assort = dat.partner_assortativity(si, ri);
-				canmix_denom = eps;
-				prefer_denom = eps;
-				union_denom = eps;
-				for (sj = DP::SEX_MIN; sj <= DP::SEX_MAX; ++sj) {
-					for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
-						canmix_numer[sj][rj] = supply_pop_other[sj][rj] * (dat.mix_structure(si, ri, sj, rj) > 0); // groups can mix
-						prefer_numer[sj][rj] = supply_pop_other[sj][rj] * (dat.mix_structure(si, ri, sj, rj) > 1); // groups prefer to mix
-						canmix_denom += canmix_numer[sj][rj];
-						prefer_denom += prefer_numer[sj][rj];
-
-						mix_pop_union[si][ri][sj][rj] = supply_pop_union[sj][rj] * (si != sj);
-						union_denom += mix_pop_union[si][ri][sj][rj];
-					}
-				}
-				for (sj = DP::SEX_MIN; sj <= DP::SEX_MAX; ++sj) {
-					for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
-						mix_pop_other[si][ri][sj][rj] = (1.0 - assort) * canmix_numer[sj][rj] / canmix_denom + assort * prefer_numer[sj][rj] / prefer_denom;
-						mix_pop_union[si][ri][sj][rj] /= union_denom;
-					}
-				}
-			}
-		}
-
-		for (sj = 0; sj < DP::N_SEX; ++sj) {
-			for (bj = 0; bj < DP::N_AGE_ADULT; ++bj)
-				for (rj = 0; rj < DP::N_POP_SEX[sj]; ++rj) // TODO: start from rj = DP::POP_NEVER instead of DP::POP_NOSEX
-					for (hj = 0; hj < DP::N_STAGE; ++hj)
-						for (vj = 0; vj < DP::N_VL; ++vj)
-							prev[sj][bj][rj][hj][vj] = 0.0;
-		}
-
-		// pre-calculate PLHIV among potential sex partners
-		for (uj = 0; uj < DP::N_SEX_MC; ++uj) {
-			sj = sex[uj];
-			for (bj = 0; bj < DP::N_AGE_ADULT; ++bj) {
-				for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
-					for (cj = 0; cj < DP::N_HIV_ADULT; ++cj) {
-						hj = stage[cj];
-						num_art = pop.adult_hiv(t, uj, bj, rj, cj, DP::DTX_ART1) + pop.adult_hiv(t, uj, bj, rj, cj, DP::DTX_ART2) + pop.adult_hiv(t, uj, bj, rj, cj, DP::DTX_ART3);
-						prev[sj][bj][rj][hj][DP::VL_OFF_ART] += pop.adult_hiv(t, uj, bj, rj, cj, DP::DTX_UNAWARE);
-						prev[sj][bj][rj][hj][DP::VL_OFF_ART] += pop.adult_hiv(t, uj, bj, rj, cj, DP::DTX_AWARE  );
-						prev[sj][bj][rj][hj][DP::VL_OFF_ART] += pop.adult_hiv(t, uj, bj, rj, cj, DP::DTX_PREV_TX);
-						prev[sj][bj][rj][hj][DP::VL_FAILURE] += num_art * (1.0 - dat.art_suppressed_adult(t, sj, bj));
-						prev[sj][bj][rj][hj][DP::VL_SUCCESS] += num_art * dat.art_suppressed_adult(t, sj, bj);
+		if (step == 0 || !dat.mix_balance_annual()) {
+			for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si) {
+				for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
+					supply_pop_other[si][ri] = 0.0;
+					supply_pop_union[si][ri] = 0.0;
+					for (bi = 0; bi < DP::N_AGE_ADULT; ++bi) {
+						supply_pop_other[si][ri] += supply_other[si][bi][ri];
+						supply_pop_union[si][ri] += supply_union[si][bi][ri];
 					}
 				}
 			}
+			cache.update_mixing(supply_pop_other, supply_pop_union);
 		}
 
-		// Divide by population sizes to convert PLHIV to prevalence in potential sex partners
+		// Calculate HIV prevalence among potential sex partners by stage and viral load.
+		// Empty groups contribute no partners, so we leave their prevalence at zero
 		for (sj = 0; sj < DP::N_SEX; ++sj) {
 			for (bj = 0; bj < DP::N_AGE_ADULT; ++bj)
 				for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj)
-					for (hj = 0; hj < DP::N_STAGE; ++hj)
-						for (vj = 0; vj < DP::N_VL; ++vj)
-							prev[sj][bj][rj][hj][vj] /= popsize[sj][bj][rj];
-		}
-
-		// calculate transmission probabilities
-		// TODO: doi:10.1002/14651858.CD003255 estimated condoms reduced incidence 80%, so could apply
-		// condom effect to incidence rate instead of per-act probabilities. Results should be approximately
-		// the same, but computation may be more efficient (fewer pow calls)
-		// RG 2022-01-25: I tried optimizing by unrolling sex loops so that we could easily skip
-		// the female-to-female transmission = 0 case. This did not improve performance, and may
-		// have actually slowed down calculation.
-		for (qij = 0; qij < DP::N_BOND; ++qij) { // TODO: calculate once per year instead of once per step
-			acts_with = dat.sex_acts(qij) * dat.condom_freq(t, qij);
-			acts_wout = dat.sex_acts(qij) - acts_with;
-			for (si = 0; si < DP::N_SEX; ++si)
-				for (sj = 0; sj < DP::N_SEX; ++sj)
-					for (hj = 0; hj < DP::N_STAGE; ++hj)
-						for (vj = 0; vj < DP::N_VL; ++vj) {
-							per_act[DP::STI_NONE] = dat.hiv_risk_per_act(si, sj, hj, vj);
-							per_act[DP::STI_HIVN] = per_act[DP::STI_NONE] * dat.effect_sti_hivneg() / (1.0 - per_act[DP::STI_NONE] + per_act[DP::STI_NONE] * dat.effect_sti_hivneg());
-							per_act[DP::STI_HIVP] = per_act[DP::STI_NONE] * dat.effect_sti_hivpos() / (1.0 - per_act[DP::STI_NONE] + per_act[DP::STI_NONE] * dat.effect_sti_hivpos());
-							per_act[DP::STI_BOTH] = std::max(per_act[DP::STI_HIVN], per_act[DP::STI_HIVP]); // like doi:10.1136/sti.2006.023531, we assume the only bigger STI effect applies
-							for (zij = 0; zij < DP::N_STI; ++zij) {
-								ptransmit[si][sj][qij][hj][vj][zij] = 1.0 - pow(1.0 - per_act[zij], acts_wout) * pow(1.0 - per_act[zij] * e_condom, acts_with);
-							}
-						}
+					for (hj = 0; hj < DP::N_STAGE; ++hj) {
+						num_art = _summary.plhiv_art[sj][bj][rj][hj];
+						prev[sj][bj][rj][hj][DP::VL_OFF_ART] = _summary.plhiv_off[sj][bj][rj][hj];
+						prev[sj][bj][rj][hj][DP::VL_FAILURE] = num_art * (1.0 - cache.art_suppressed(sj, bj));
+						prev[sj][bj][rj][hj][DP::VL_SUCCESS] = num_art * cache.art_suppressed(sj, bj);
+						if (_summary.popsize[sj][bj][rj] > 0.0)
+							for (vj = 0; vj < DP::N_VL; ++vj)
+								prev[sj][bj][rj][hj][vj] /= _summary.popsize[sj][bj][rj];
+						else
+							for (vj = 0; vj < DP::N_VL; ++vj)
+								prev[sj][bj][rj][hj][vj] = 0.0;
+					}
 		}
 
 		// Cache the infectiousness "mass", defined here as HIV prevalence
-		// in potential partners, weighted by the probability of transmission per partnership
-		for (si = 0; si < DP::N_SEX; ++si)
+		// in potential partners, weighted by the probability of transmission per partnership.
+		// Tasks are split by HIV- partner sex and HIV+ partner age
+		for_each_stratum(DP::N_SEX * n_block, [&](const int i, const int) {
+			const int si(DP::SEX_MIN + i / n_block);
+			const int bj_begin(DP::N_AGE_ADULT * (i % n_block) / n_block);
+			const int bj_end(DP::N_AGE_ADULT * (i % n_block + 1) / n_block);
+			double mass_sti[DP::N_STI];
+			double sti_pos;
+			int sj, bj, rj, hj, vj, qij, zij;
+
 			for (sj = 0; sj < DP::N_SEX; ++sj)
-				for (bj = 0; bj < DP::N_AGE_ADULT; ++bj)
-					for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj)
-						for (qij = 0; qij < DP::N_BOND; ++qij)
+				for (bj = bj_begin; bj < bj_end; ++bj)
+					for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
+						sti_pos = cache.sti_prev(sj, bj, rj);
+						for (qij = 0; qij < DP::N_BOND; ++qij) {
 							for (zij = 0; zij < DP::N_STI; ++zij) {
-								mass[si][sj][bj][rj][qij][zij] = 0.0;
+								mass_sti[zij] = 0.0;
 								for (hj = 0; hj < DP::N_STAGE; ++hj)
 									for (vj = 0; vj < DP::N_VL; ++vj)
-										mass[si][sj][bj][rj][qij][zij] += ptransmit[si][sj][qij][hj][vj][zij] * prev[sj][bj][rj][hj][vj];
+										mass_sti[zij] += cache.ptransmit(si, sj, qij, hj, vj, zij) * prev[sj][bj][rj][hj][vj];
 							}
-
-		for (si = 0; si < DP::N_SEX; ++si) {
-			for (bi = 0; bi < DP::N_AGE_ADULT; ++bi)
-				for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
-					force_other[si][bi][ri] = 0.0;
-					force_union[si][bi][ri] = 0.0;
-				}
-		}
-
+							mass[si][sj][bj][rj][qij][0] = (1.0 - sti_pos) * mass_sti[DP::STI_NONE] + sti_pos * mass_sti[DP::STI_HIVP];
+							mass[si][sj][bj][rj][qij][1] = (1.0 - sti_pos) * mass_sti[DP::STI_HIVN] + sti_pos * mass_sti[DP::STI_BOTH];
+						}
+					}
+		});
+
+		// The balanced mixing coefficient between (si,bi,ri) and (sj,bj,rj) is
+		// mix_age(si,bi,sj,bj) * mix_pop(si,ri,sj,rj) * root(sj,bj,rj) / root(si,bi,ri).
+		// For each HIV+ partner group (sj,rj) and partnership type, the sum over bj
+		// is a matrix-vector product of the age mixing matrix with supply-weighted mass
+		// that can be shared by all HIV- partner risk groups ri. Non-marital partnerships
+		// only visit pairs of risk groups that can mix, see ModelData::mix_index_begin().
+		// Tasks are split by HIV- partner sex and age, so each task only needs the rows
+		// of the age mixing matrix for its ages, and updates only the population of
+		// those ages.
+		//
 		// The loop below is hideously expensive. Before putting ANYTHING
 		// in this loop, ask yourself whether it could be precalculated
 		// outside this loop. If not, put the calculation at the highest
 		// level of this loop possible.
-		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si) {
-			for (bi = 0; bi < DP::N_AGE_ADULT; ++bi) {
+		for_each_stratum(DP::N_SEX * n_block, [&](const int i, const int) {
+			const int si(DP::SEX_MIN + i / n_block);
+			const int bi_begin(DP::N_AGE_ADULT * (i % n_block) / n_block);
+			const int bi_end(DP::N_AGE_ADULT * (i % n_block + 1) / n_block);
+			double prop_transmit, new_hiv, sti_neg, mix_pop;
+			bool bond_used;
+			int ui, ai, bi, ri, sj, bj, rj, qij, k;
+
+			// Supply-weighted mass by HIV+ partner age, and its product with the age mixing
+			// matrix. The first index is HIV- partner STI symptom status. mass_root is padded
+			// for TransmissionCache::mix_age_product
+			alignas(64) double mass_root[2][DP::N_AGE_ADULT_PAD] = {};
+			double mass_mix[2][DP::N_AGE_ADULT];
+
+			// Products of the age mixing matrix with mass for non-marital partnerships,
+			// by HIV+ partner sex and risk group and partnership type. These are calculated
+			// on first use and shared by all HIV- partner risk groups
+			double mass_mix_other[DP::N_SEX][DP::N_POP][DP::N_BOND][2][DP::N_AGE_ADULT];
+			bool mix_done[DP::N_SEX][DP::N_POP][DP::N_BOND];
+
+			double force_other[DP::N_AGE_ADULT][DP::N_POP][2];
+			double force_union[DP::N_AGE_ADULT][DP::N_POP][2];
+
+			for (bi = bi_begin; bi < bi_end; ++bi)
 				for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
-					for (sj = DP::SEX_MIN; sj <= DP::SEX_MAX; ++sj) {
-						// we do not model female-to-female transmission, so we only
-						// execute the inner loop when at least one partner is male
-						if (si == DP::MALE || sj == DP::MALE) {
+					force_other[bi][ri][0] = force_other[bi][ri][1] = 0.0;
+					force_union[bi][ri][0] = force_union[bi][ri][1] = 0.0;
+				}
+
+			// non-marital, non-cohabiting partnerships
+			for (sj = DP::SEX_MIN; sj <= DP::SEX_MAX; ++sj)
+				for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj)
+					for (qij = 0; qij < DP::N_BOND; ++qij)
+						mix_done[sj][rj][qij] = false;
+
+			for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
+				for (k = dat.mix_index_begin(si, ri); k < dat.mix_index_end(si, ri); ++k) {
+					sj = dat.mix_index_sex(k);
+					rj = dat.mix_index_pop(k);
+					mix_pop = cache.mix_pop_other(si, ri, sj, rj);
+					// we do not model female-to-female transmission, so we only
+					// execute the inner loop when at least one partner is male
+					if ((si == DP::MALE || sj == DP::MALE) && mix_pop > 0.0) {
+						qij = DP::BOND_TYPE[si][ri][sj][rj];
+						if (!mix_done[sj][rj][qij]) {
 							for (bj = 0; bj < DP::N_AGE_ADULT; ++bj) {
-								for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
-									sti_wgt[DP::STI_NONE] = (1.0 - dat.sti_prev(t, si, bi, ri)) * (1.0 - dat.sti_prev(t, sj, bj, rj));
-									sti_wgt[DP::STI_HIVN] = dat.sti_prev(t, si, bi, ri) * (1.0 - dat.sti_prev(t, sj, bj, rj));
-									sti_wgt[DP::STI_HIVP] = (1.0 - dat.sti_prev(t, si, bi, ri)) * dat.sti_prev(t, sj, bj, rj);
-									sti_wgt[DP::STI_BOTH] = dat.sti_prev(t, si, bi, ri) * dat.sti_prev(t, sj, bj, rj);
-
-									// non-marital, non-cohabiting partnerships
-									bal_denom = supply_other[si][bi][ri] * dat.partner_preference_age(si, bi, sj, bj) * mix_pop_other[si][ri][sj][rj];
-									bal_numer = supply_other[sj][bj][rj] * dat.partner_preference_age(sj, bj, si, bi) * mix_pop_other[sj][rj][si][ri];
-									bal_other = (bal_denom > 0.0 ? sqrt(bal_numer / bal_denom) : 0.0);
-									mix_other = dat.partner_preference_age(si, bi, sj, bj) * mix_pop_other[si][ri][sj][rj];
-									if (mix_other > 0.0 && bal_other > 0.0 && popsize[sj][bj][rj] > 0.0) {
-										qij = DP::BOND_TYPE[si][ri][sj][rj];
-										bal_mix = mix_other * bal_other;
-
-										force_group = 0.0;
-										for (zij = 0; zij < DP::N_STI; ++zij)
-											force_group += mass[si][sj][bj][rj][qij][zij] * sti_wgt[zij];
-										force_other[si][bi][ri] += bal_mix * force_group;
-									}
+								mass_root[0][bj] = root_other[sj][bj][rj] * mass[si][sj][bj][rj][qij][0];
+								mass_root[1][bj] = root_other[sj][bj][rj] * mass[si][sj][bj][rj][qij][1];
+							}
+							cache.mix_age_product(si, sj, mass_root[0], mass_root[1], mass_mix_other[sj][rj][qij][0], mass_mix_other[sj][rj][qij][1], bi_begin, bi_end);
+							mix_done[sj][rj][qij] = true;
+						}
+						for (bi = bi_begin; bi < bi_end; ++bi) {
+							force_other[bi][ri][0] += mix_pop * mass_mix_other[sj][rj][qij][0][bi];
+							force_other[bi][ri][1] += mix_pop * mass_mix_other[sj][rj][qij][1][bi];
+						}
+					}
+				}
+			}
 
-									// marital or cohabiting partnerships
-									bal_denom = supply_union[si][bi][ri] * dat.partner_preference_age(si, bi, sj, bj) * mix_pop_union[si][ri][sj][rj];
-									bal_numer = supply_union[sj][bj][rj] * dat.partner_preference_age(sj, bj, si, bi) * mix_pop_union[sj][rj][si][ri];
-									bal_union = (bal_denom > 0.0 ? sqrt(bal_numer / bal_denom) : 0.0);
-									mix_union = dat.partner_preference_age(si, bi, sj, bj) * mix_pop_union[si][ri][sj][rj];
-									if (mix_union > 0.0 && bal_union > 0.0 && popsize[sj][bj][rj] > 0.0) {
-										qij = DP::BOND_UNION;
-										bal_mix = mix_union * bal_union;
-
-										force_group = 0.0;
-										for (zij = 0; zij < DP::N_STI; ++zij)
-											force_group += mass[si][sj][bj][rj][qij][zij] * sti_wgt[zij];
-										force_union[si][bi][ri] += bal_mix * force_group;
+			// marital or cohabiting partnerships
+			for (sj = DP::SEX_MIN; sj <= DP::SEX_MAX; ++sj) {
+				if (si == DP::MALE || sj == DP::MALE) {
+					for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
+						bond_used = false;
+						for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri)
+							bond_used = bond_used || (cache.mix_pop_union(si, ri, sj, rj) > 0.0);
+						if (bond_used) {
+							qij = DP::BOND_UNION;
+							for (bj = 0; bj < DP::N_AGE_ADULT; ++bj) {
+								mass_root[0][bj] = root_union[sj][bj][rj] * mass[si][sj][bj][rj][qij][0];
+								mass_root[1][bj] = root_union[sj][bj][rj] * mass[si][sj][bj][rj][qij][1];
+							}
+							cache.mix_age_product(si, sj, mass_root[0], mass_root[1], mass_mix[0], mass_mix[1], bi_begin, bi_end);
+							for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
+								mix_pop = cache.mix_pop_union(si, ri, sj, rj);
+								if (mix_pop > 0.0)
+									for (bi = bi_begin; bi < bi_end; ++bi) {
+										force_union[bi][ri][0] += mix_pop * mass_mix[0][bi];
+										force_union[bi][ri][1] += mix_pop * mass_mix[1][bi];
 									}
-								}
 							}
 						}
 					}
-					force[si][bi][ri] = dat.partner_rate(t, si, bi, ri) * force_other[si][bi][ri] + prop_union[si][ri] * force_union[si][bi][ri];
 				}
 			}
-		}
 
-		double force_pwid[DP::N_SEX];
-		force_pwid[DP::FEMALE] = dat.pwid_needle_sharing(t) * dat.pwid_infection_force(t, DP::FEMALE);
-		force_pwid[DP::MALE  ] = dat.pwid_needle_sharing(t) * dat.pwid_infection_force(t, DP::MALE);
-
-		// update the population and record new infections
-		for (ui = 0; ui < DP::N_SEX_MC; ++ui) {
-			si = sex[ui];
-			vmmc_mult = (ui == DP::MALE_C) ? 1.0 - dat.effect_vmmc() : 1.0;
-			for (bi = 0; bi < DP::N_AGE_ADULT; ++bi) {
-				ai = bi + DP::AGE_ADULT_MIN;
+			for (bi = bi_begin; bi < bi_end; ++bi) {
 				for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
-					prop_transmit = 1.0 - exp(-HIV_STEP_SIZE * (force[si][bi][ri] * vmmc_mult + force_pwid[si] * (ri == DP::POP_PWID)));
-					new_hiv = prop_transmit * pop.adult_neg(t, ui, bi, ri);
-					pop.adult_neg(t, ui, bi, ri) -= new_hiv;
-					pop.adult_hiv(t, ui, bi, ri, DP::HIV_PRIMARY, DP::DTX_UNAWARE) += new_hiv;
-					dat.new_hiv_infections(t, ui, ai, ri, dat.new_hiv_infections(t, ui, ai, ri) + new_hiv);
+					sti_neg = cache.sti_prev(si, bi, ri);
+					force[si][bi][ri] = cache.partner_rate(si, bi, ri) * inv_root_other[si][bi][ri] * ((1.0 - sti_neg) * force_other[bi][ri][0] + sti_neg * force_other[bi][ri][1])
+					                  + cache.prop_union(si, ri)      * inv_root_union[si][bi][ri] * ((1.0 - sti_neg) * force_union[bi][ri][0] + sti_neg * force_union[bi][ri][1]);
 				}
 			}
-		}
+
+			// update the population and record new infections
+			for (ui = DP::SEX_MC_MIN; ui <= DP::SEX_MC_MAX; ++ui) {
+				if (sex[ui] != si) continue;
+				for (bi = bi_begin; bi < bi_end; ++bi) {
+					ai = bi + DP::AGE_ADULT_MIN;
+					for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
+						prop_transmit = 1.0 - exp(-hiv_step_size() * (force[si][bi][ri] * cache.vmmc_mult(ui) + cache.force_pwid(si) * (ri == DP::POP_PWID)));
+						new_hiv = prop_transmit * pop.adult_neg(t, ui, bi, ri);
+						pop.adult_neg(t, ui, bi, ri) -= new_hiv;
+						pop.adult_hiv(t, ui, bi, ri, DP::HIV_PRIMARY, DP::DTX_UNAWARE) += new_hiv;
+						dat.new_hiv_infections(t, ui, ai, ri, dat.new_hiv_infections(t, ui, ai, ri) + new_hiv);
+						_summary.off_art[si][bi][DP::HIV_PRIMARY] += new_hiv;
+						_summary.plhiv_off[si][bi][ri][stage[DP::HIV_PRIMARY]] += new_hiv;
+					}
+				}
+			}
+		});
 	}
 
-	void Projection::insert_adult_infections(const int t, const int step) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::insert_adult_infections(const int t, const int step) {
 		// TODO: This was originally implemented when Spectrum calculated infections
 		// once per year instead of once per timestep. Calculations that refer
 		// to year t-1 could be done once annually instead of once per timestep.
 		const double eps = 1e-8 / 3.0; // padding term used to avoid divide-by-zero issues without resorting to conditional logic
 		const double irr_sex(dat.irr_sex(t));
 		int s, u, a, b, r;
-		double X[DP::N_SEX];
-		double neg_age[DP::N_SEX][DP::N_AGE_ADULT], new_hiv_age[DP::N_SEX][DP::N_AGE_ADULT], new_hiv_pop[DP::N_POP];
+		accum_t X[DP::N_SEX];
+		accum_t neg_age[DP::N_SEX][DP::N_AGE_ADULT];
+		double new_hiv_age[DP::N_SEX][DP::N_AGE_ADULT], new_hiv_pop[DP::N_POP];
 		double new_hiv_sex[DP::N_SEX], new_hiv;
 		double new_hiv_all[DP::N_SEX_MC][DP::N_AGE_ADULT][DP::N_POP];
 		double scale, denom, wnum;
@@ -1356,7 +1446,7 @@ namespace DP {
 			}
 		}
 
-		new_hiv = DP::HIV_STEP_SIZE * dat.incidence(t) * (X[DP::FEMALE] + X[DP::MALE]);
+		new_hiv = hiv_step_size() * dat.incidence(t) * (X[DP::FEMALE] + X[DP::MALE]);
 		new_hiv_sex[DP::MALE  ] = new_hiv / (irr_sex * X[DP::FEMALE] + X[DP::MALE]) * X[DP::MALE  ];
 		new_hiv_sex[DP::FEMALE] = new_hiv / (irr_sex * X[DP::FEMALE] + X[DP::MALE]) * X[DP::FEMALE] * irr_sex;
 
@@ -1407,20 +1497,8 @@ namespace DP {
 			}
 		}
 
-		// Distribute new infections
-#ifndef SPECTRUM_CD4
-		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
-			s = sex[u];
-			for (b = 0; b < DP::N_AGE_ADULT; ++b) {
-				a = b + DP::AGE_ADULT_MIN;
-				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
-					dat.new_hiv_infections(t, u, a, r, dat.new_hiv_infections(t, u, a, r) + new_hiv_all[u][b][r]);
-					pop.adult_neg(t, u, b, r) -= new_hiv_all[u][b][r];
-					pop.adult_hiv(t, u, b, r, DP::HIV_PRIMARY, DP::DTX_UNAWARE) += new_hiv_all[u][b][r];
-				}
-			}
-		}
-#else
+		// Distribute new infections. Goals CD4 categories include primary
+		// infection, while Spectrum categories distribute new infections by CD4 count
 		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
 			s = sex[u];
 			for (b = 0; b < DP::N_AGE_ADULT; ++b) {
@@ -1428,15 +1506,24 @@ namespace DP {
 				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
 					dat.new_hiv_infections(t, u, a, r, dat.new_hiv_infections(t, u, a, r) + new_hiv_all[u][b][r]);
 					pop.adult_neg(t, u, b, r) -= new_hiv_all[u][b][r];
-					for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
-						pop.adult_hiv(t, u, b, r, h, DP::DTX_UNAWARE) += dat.hiv_dist(s, a, h) * new_hiv_all[u][b][r];
+					if constexpr (Options::cd4_scheme == DP::CD4_GOALS) {
+						pop.adult_hiv(t, u, b, r, DP::HIV_PRIMARY, DP::DTX_UNAWARE) += new_hiv_all[u][b][r];
+						_summary.off_art[s][b][DP::HIV_PRIMARY] += new_hiv_all[u][b][r];
+						_summary.plhiv_off[s][b][r][stage[DP::HIV_PRIMARY]] += new_hiv_all[u][b][r];
+					} else {
+						for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+							pop.adult_hiv(t, u, b, r, h, DP::DTX_UNAWARE) += dat.hiv_dist(s, a, h) * new_hiv_all[u][b][r];
+							_summary.off_art[s][b][h] += dat.hiv_dist(s, a, h) * new_hiv_all[u][b][r];
+							_summary.plhiv_off[s][b][r][stage[h]] += dat.hiv_dist(s, a, h) * new_hiv_all[u][b][r];
+						}
+					}
 				}
 			}
 		}
-#endif
 	}
 
-	void Projection::insert_clhiv_agein(const int t) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::insert_clhiv_agein(const int t) {
 		const double eps = std::numeric_limits<double>::epsilon(); // padding to avoid divide-by-zero
 		const int a = 14;
 		int s, h, d;
@@ -1459,30 +1546,25 @@ namespace DP {
 		}
 	}
 
-	void Projection::insert_endyear_migrants(const int t) {
-		double migr;
-		int a, b, d, h, r, s, u;
-
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::insert_endyear_migrants(const int t) {
 		calc_popsize(t);
 
-		// Children (ages 0-14)
-		for (u = SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
-			s = sex[u];
-			for (a = DP::AGE_CHILD_MIN; a <= DP::AGE_CHILD_MAX; ++a) {
-				migr = dat.migration(t, s, a) / dat.popsize(t, s, a);
+		// Migrants are distributed proportionally within each sex and age
+		for_each_stratum(DP::N_SEX_MC * DP::N_AGE, [&](const int i, const int) {
+			const int u(DP::SEX_MC_MIN + i / DP::N_AGE);
+			const int a(DP::AGE_MIN + i % DP::N_AGE);
+			const int s(sex[u]);
+			const int b(a - DP::AGE_ADULT_MIN);
+			const double migr(dat.migration(t, s, a) / dat.popsize(t, s, a));
+			int d, h, r;
+
+			if (a <= DP::AGE_CHILD_MAX) {
 				pop.child_neg(t, u, a) *= (1.0 + migr);
 				for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h)
 					for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d)
 						pop.child_hiv(t, u, a, h, d) *= (1.0 + migr);
-			}
-		}
-
-		// Adults (ages 15+)
-		for (u = SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
-			s = sex[u];
-			for (a = DP::AGE_ADULT_MIN; a <= DP::AGE_ADULT_MAX; ++a) {
-				b = a - DP::AGE_ADULT_MIN;
-				migr = dat.migration(t, s, a) / dat.popsize(t, s, a);
+			} else {
 				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
 					pop.adult_neg(t, u, b, r) *= (1.0 + migr);
 					for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
@@ -1490,10 +1572,11 @@ namespace DP {
 							pop.adult_hiv(t, u, b, r, h, d) *= (1.0 + migr);
 				}
 			}
-		}
+		});
 	}
 
-	void Projection::seed_epidemic(const int t, const double prev) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::seed_epidemic(const int t, const double prev) {
 		double cases;
 		for (int u(0); u < DP::N_SEX_MC; ++u) {
 			for (int b(0); b < DP::N_AGE_ADULT; ++b)
@@ -1505,8 +1588,10 @@ namespace DP {
 		}
 	}
 
-	double Projection::calc_births_hiv_exposed(const int t) {
-		double num_hiv[N_HIV_ADULT], num_art, num_neg, num_all;
+	template<typename Options, typename value_t>
+	double ProjectionT<Options, value_t>::calc_births_hiv_exposed(const int t) {
+		accum_t num_hiv[N_HIV_ADULT], num_art, num_neg;
+		double num_all;
 		double frr_hiv[N_HIV_ADULT], frr_art;
 		double raw_hiv, asfr;
 		double births_exposed(0.0);
@@ -1557,10 +1642,11 @@ namespace DP {
 		return(0.5 * births_exposed);
 	}
 
-	double Projection::calc_births(const int t) {
+	template<typename Options, typename value_t>
+	double ProjectionT<Options, value_t>::calc_births(const int t) {
 		const int s(DP::FEMALE);
-		popsize_t female[DP::N_AGE];
-		popsize_t denom(0.0), births(0.0);
+		accum_t female[DP::N_AGE];
+		double denom(0.0), births(0.0);
 
 		int a, b, d, h, r;
 
@@ -1583,7 +1669,8 @@ namespace DP {
 		return births;
 	}
 
-	void Projection::calc_deaths(const int t) {
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::calc_deaths(const int t) {
 		double mort, deaths;
 		int a, s;
 
@@ -1611,6 +1698,188 @@ namespace DP {
 
 	}
 
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::snapshot_header(const int time, std::int32_t header[SNAPSHOT_HEADER_SIZE]) const {
+		header[0] = SNAPSHOT_VERSION;
+		header[1] = sizeof(popsize_t);
+		header[2] = year_first();
+		header[3] = year_final();
+		header[4] = time;
+		header[5] = Options::cd4_scheme;
+		header[6] = Options::incidence_model;
+		header[7] = Options::hiv_time_steps;
+		header[8] = Options::key_populations;
+	}
+
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::pack_snapshot(const int time, std::vector<popsize_t>& state, std::vector<double>& outputs) const {
+		int a, b, d, h, r, s, t(time), u;
+
+		state.clear();
+		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+			for (a = 0; a < DP::N_AGE_CHILD; ++a) {
+				state.push_back(pop.child_neg(t, u, a));
+				state.push_back(dth.child_neg(t, u, a));
+				for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h)
+					for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+						state.push_back(pop.child_hiv(t, u, a, h, d));
+						state.push_back(dth.child_hiv(t, u, a, h, d));
+					}
+			}
+		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+			for (b = 0; b < DP::N_AGE_ADULT; ++b)
+				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+					state.push_back(pop.adult_neg(t, u, b, r));
+					state.push_back(dth.adult_neg(t, u, b, r));
+					for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+						for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+							state.push_back(pop.adult_hiv(t, u, b, r, h, d));
+							state.push_back(dth.adult_hiv(t, u, b, r, h, d));
+						}
+				}
+
+		outputs.clear();
+		for (t = 0; t <= time; ++t) {
+			outputs.push_back(dat.births_hiv_exposed(t));
+			for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
+				outputs.push_back(dat.births(t, s));
+				for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a) {
+					outputs.push_back(dat.deaths(t, s, a));
+					outputs.push_back(dat.popsize(t, s, a));
+				}
+			}
+			for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+				for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+					for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+						outputs.push_back(dat.new_hiv_infections(t, u, a, r));
+		}
+	}
+
+	template<typename Options, typename value_t>
+	void ProjectionT<Options, value_t>::unpack_snapshot(const int time, const std::vector<popsize_t>& state, const std::vector<double>& outputs) {
+		const popsize_t* x(state.data());
+		const double* y(outputs.data());
+		int a, b, d, h, r, s, t(time), u;
+
+		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+			for (a = 0; a < DP::N_AGE_CHILD; ++a) {
+				pop.child_neg(t, u, a) = *x++;
+				dth.child_neg(t, u, a) = *x++;
+				for (h = DP::HIV_CHILD_MIN; h <= DP::HIV_CHILD_MAX; ++h)
+					for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+						pop.child_hiv(t, u, a, h, d) = *x++;
+						dth.child_hiv(t, u, a, h, d) = *x++;
+					}
+			}
+		for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+			for (b = 0; b < DP::N_AGE_ADULT; ++b)
+				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+					pop.adult_neg(t, u, b, r) = *x++;
+					dth.adult_neg(t, u, b, r) = *x++;
+					for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+						for (d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+							pop.adult_hiv(t, u, b, r, h, d) = *x++;
+							dth.adult_hiv(t, u, b, r, h, d) = *x++;
+						}
+				}
+
+		for (t = 0; t <= time; ++t) {
+			dat.births_hiv_exposed(t, *y++);
+			for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
+				dat.births(t, s, *y++);
+				for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a) {
+					dat.deaths(t, s, a, *y++);
+					dat.popsize(t, s, a, *y++);
+				}
+			}
+			for (u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+				for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+					for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+						dat.new_hiv_infections(t, u, a, r, *y++);
+		}
+	}
+
+	template<typename Options, typename value_t>
+	int ProjectionT<Options, value_t>::save_snapshot(std::ostream& out) const {
+		const int time(_last_valid_time);
+		std::int32_t header[SNAPSHOT_HEADER_SIZE];
+		std::uint64_t hash, size[2];
+		std::vector<popsize_t> state;
+		std::vector<double> outputs;
+
+		if (time < 0 || time < _first_restored_time || (pop.rolling() && time <= _last_stored_time - pop.num_slots()))
+			return DP::SNAPSHOT_NOT_PROJECTED;
+
+		snapshot_header(time, header);
+		hash = dat.input_hash(time);
+		pack_snapshot(time, state, outputs);
+		size[0] = state.size();
+		size[1] = outputs.size();
+
+		out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+		out.write(reinterpret_cast<const char*>(size), sizeof(size));
+		out.write(reinterpret_cast<const char*>(state.data()), state.size() * sizeof(popsize_t));
+		out.write(reinterpret_cast<const char*>(outputs.data()), outputs.size() * sizeof(double));
+		return out.good() ? DP::SNAPSHOT_OK : DP::SNAPSHOT_IO_ERROR;
+	}
+
+	template<typename Options, typename value_t>
+	int ProjectionT<Options, value_t>::save_snapshot(const std::string& filename) const {
+		std::ofstream out(filename.c_str(), std::ios::binary);
+		if (!out.good()) return DP::SNAPSHOT_IO_ERROR;
+		return save_snapshot(out);
+	}
+
+	template<typename Options, typename value_t>
+	int ProjectionT<Options, value_t>::load_snapshot(std::istream& in) {
+		char magic[sizeof(SNAPSHOT_MAGIC)];
+		std::int32_t header[SNAPSHOT_HEADER_SIZE], expected[SNAPSHOT_HEADER_SIZE];
+		std::uint64_t hash, size[2];
+		std::vector<popsize_t> state;
+		std::vector<double> outputs;
+		int time;
+
+		in.read(magic, sizeof(magic));
+		if (!in.good()) return DP::SNAPSHOT_IO_ERROR;
+		if (!std::equal(magic, magic + sizeof(magic), SNAPSHOT_MAGIC)) return DP::SNAPSHOT_BAD_FORMAT;
+
+		in.read(reinterpret_cast<char*>(header), sizeof(header));
+		in.read(reinterpret_cast<char*>(&hash), sizeof(hash));
+		in.read(reinterpret_cast<char*>(size), sizeof(size));
+		if (!in.good()) return DP::SNAPSHOT_IO_ERROR;
+		if (header[0] != SNAPSHOT_VERSION) return DP::SNAPSHOT_BAD_FORMAT;
+
+		time = header[4];
+		if (time < 0 || time >= num_years()) return DP::SNAPSHOT_INCOMPATIBLE;
+		snapshot_header(time, expected);
+		if (!std::equal(header, header + SNAPSHOT_HEADER_SIZE, expected)) return DP::SNAPSHOT_INCOMPATIBLE;
+		if (hash != dat.input_hash(time)) return DP::SNAPSHOT_INPUT_MISMATCH;
+
+		// Check sizes against a packed snapshot of this projection before reading
+		pack_snapshot(time, state, outputs);
+		if (size[0] != state.size() || size[1] != outputs.size()) return DP::SNAPSHOT_BAD_FORMAT;
+		in.read(reinterpret_cast<char*>(state.data()), state.size() * sizeof(popsize_t));
+		in.read(reinterpret_cast<char*>(outputs.data()), outputs.size() * sizeof(double));
+		if (!in.good()) return DP::SNAPSHOT_IO_ERROR;
+
+		unpack_snapshot(time, state, outputs);
+		dat.clear_changes(); // inputs through time match the snapshot
+		_last_valid_time = time;
+		_last_stored_time = time;
+		_first_restored_time = time;
+		_summary.valid = false;
+		return DP::SNAPSHOT_OK;
+	}
+
+	template<typename Options, typename value_t>
+	int ProjectionT<Options, value_t>::load_snapshot(const std::string& filename) {
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in.good()) return DP::SNAPSHOT_IO_ERROR;
+		return load_snapshot(in);
+	}
+
 } // END namespace DP
 
 #endif // DPPROJECTION_IMPL_H
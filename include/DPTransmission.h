@@ -0,0 +1,293 @@
+#ifndef DPTRANSMISSION_H
+#define DPTRANSMISSION_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <DPConst.h>
+#include <DPData.h>
+#include <DPKernels.h>
+
+namespace DP {
+
+	// Number of adult ages, padded for use with vectorized kernels
+	const int N_AGE_ADULT_PAD = kernel_pad(DP::N_AGE_ADULT);
+
+	/// Cache of sexual transmission inputs that are constant within a year.
+	///
+	/// calc_adult_infections runs once per HIV time step, but many of the
+	/// quantities it needs depend only on the year and ModelData inputs, not on the
+	/// population state. TransmissionCache holds those quantities so that they are
+	/// calculated once per year in advance_one_year_hiv_adult instead of once per step.
+	class TransmissionCache {
+	public:
+		TransmissionCache();
+		~TransmissionCache();
+
+		/// Recalculate cached quantities for year t
+		template<typename popsize_t>
+		void update(const ModelData<popsize_t>& dat, const int t);
+
+		/// Select the implementation used by mix_age_product. By default, this is
+		/// the fastest implementation supported by the current CPU
+		inline void kernel(const kernel_isa_t isa) {_mixmul = mixmul_kernel(isa);}
+
+		/// Recalculate mixing between behavioral risk groups given partnership supply
+		/// by risk group. supply_other and supply_union are indexed by sex and risk group
+		void update_mixing(const double supply_other[DP::N_SEX][DP::N_POP], const double supply_union[DP::N_SEX][DP::N_POP]);
+
+		// Transmission probability per partnership, indexed by HIV- partner sex si,
+		// HIV+ partner sex sj, partnership type q, HIV+ partner stage h, HIV+ partner
+		// viral load v, and STI symptom status z
+		inline double ptransmit(const int si, const int sj, const int q, const int h, const int v, const int z) const {return _ptransmit[q][si][sj][h][v][z];}
+
+		// Proportion of behavioral risk group (s,r) in marital or cohabiting unions
+		inline double prop_union(const int s, const int r) const {return _prop_union[s][r];}
+
+		// Indicators that (si,ri) may mix with (sj,rj) or prefers to mix with (sj,rj)
+		inline double canmix(const int si, const int ri, const int sj, const int rj) const {return _canmix[si][ri][sj][rj];}
+		inline double prefer(const int si, const int ri, const int sj, const int rj) const {return _prefer[si][ri][sj][rj];}
+
+		inline double assortativity(const int s, const int r) const {return _assort[s][r];}
+
+		// Partnership balancing. Let M(i,j) be the proportion of partnerships group i
+		// wants from group j, and S(i) be the partnership supply of group i. The
+		// balanced proportion M(i,j) * sqrt(S(j) * M(j,i) / (S(i) * M(i,j))) is equal to
+		// sqrt(M(i,j) * M(j,i)) * sqrt(S(j)) / sqrt(S(i)). The first factor is symmetric
+		// and separates into age and behavioral risk group terms, which we cache here.
+		inline double mix_age(const int si, const int bi, const int sj, const int bj) const {return _mix_age[si][sj][bi][bj];}
+		inline double mix_pop_other(const int si, const int ri, const int sj, const int rj) const {return _mix_pop_other[si][ri][sj][rj];}
+		inline double mix_pop_union(const int si, const int ri, const int sj, const int rj) const {return _mix_pop_union[si][ri][sj][rj];}
+
+		// Multiply the age mixing matrix for HIV- partner sex si and HIV+ partner sex sj
+		// by x0 and x1, storing the results in y0 and y1. x0 and x1 must have length
+		// N_AGE_ADULT_PAD with zero padding, y0 and y1 must have length N_AGE_ADULT.
+		// Only HIV- partner ages b_begin to b_end-1 are calculated. Each age is
+		// calculated the same way whichever range it is part of
+		inline void mix_age_product(const int si, const int sj, const double* x0, const double* x1, double* y0, double* y1,
+		                            const int b_begin = 0, const int b_end = DP::N_AGE_ADULT) const {
+			if (_num_bands == DP::N_AGE_ADULT) {
+				_mixmul(&_mix_age[si][sj][b_begin][0], x0, x1, y0 + b_begin, y1 + b_begin, b_end - b_begin, DP::N_AGE_ADULT_PAD);
+			} else {
+				mix_band_product(si, sj, x0, x1, y0, y1, b_begin, b_end);
+			}
+		}
+
+		inline double partner_rate(const int s, const int b, const int r) const {return _partner_rate[s][b][r];}
+
+		inline double art_suppressed(const int s, const int b) const {return _art_suppressed[s][b];}
+
+		// STI symptom prevalence. The probability of each STI symptom status z in a
+		// partnership is the outer product of these prevalences in both partners,
+		// so we cache the factors instead of the weights themselves
+		inline double sti_prev(const int s, const int b, const int r) const {return _sti_prev[s][b][r];}
+
+		// Force of infection from needle sharing among PWID
+		inline double force_pwid(const int s) const {return _force_pwid[s];}
+
+		// Multiplier on the force of infection by sex and circumcision status
+		inline double vmmc_mult(const int u) const {return _vmmc_mult[u];}
+
+	private:
+		// Approximate mix_age_product using age bands (see ModelData::transmission_age_band).
+		// x0 and x1 are summed within bands of HIV+ partner ages, multiplied by the
+		// average mixing coefficient between bands, then assigned to every age in the
+		// HIV- partner band
+		void mix_band_product(const int si, const int sj, const double* x0, const double* x1, double* y0, double* y1, const int b_begin, const int b_end) const;
+
+		double _ptransmit[DP::N_BOND][DP::N_SEX][DP::N_SEX][DP::N_STAGE][DP::N_VL][DP::N_STI];
+		double _prop_union[DP::N_SEX][DP::N_POP];
+		double _canmix[DP::N_SEX][DP::N_POP][DP::N_SEX][DP::N_POP];
+		double _prefer[DP::N_SEX][DP::N_POP][DP::N_SEX][DP::N_POP];
+		double _assort[DP::N_SEX][DP::N_POP];
+		alignas(64) double _mix_age[DP::N_SEX][DP::N_SEX][DP::N_AGE_ADULT][DP::N_AGE_ADULT_PAD];
+
+		// Age mixing by band. Each [si][sj] block stores a _num_bands by
+		// kernel_pad(_num_bands) matrix in row-major order
+		alignas(64) double _mix_band[DP::N_SEX][DP::N_SEX][DP::N_AGE_ADULT * DP::N_AGE_ADULT_PAD];
+		int _num_bands;
+		int _band[DP::N_AGE_ADULT]; // _band[b] is the band that contains adult age b
+		double _mix_pop_other[DP::N_SEX][DP::N_POP][DP::N_SEX][DP::N_POP];
+		double _mix_pop_union[DP::N_SEX][DP::N_POP][DP::N_SEX][DP::N_POP];
+		double _partner_rate[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];
+		double _art_suppressed[DP::N_SEX][DP::N_AGE_ADULT];
+		double _sti_prev[DP::N_SEX][DP::N_AGE_ADULT][DP::N_POP];
+		double _force_pwid[DP::N_SEX];
+		double _vmmc_mult[DP::N_SEX_MC];
+
+		mixmul_kernel_t _mixmul;
+	};
+
+	TransmissionCache::TransmissionCache()
+		: _num_bands(DP::N_AGE_ADULT),
+			_mixmul(mixmul_kernel(kernel_best())) {
+		std::fill_n(&_mix_age[0][0][0][0], DP::N_SEX * DP::N_SEX * DP::N_AGE_ADULT * DP::N_AGE_ADULT_PAD, 0.0); // zero padding
+		for (int b = 0; b < DP::N_AGE_ADULT; ++b)
+			_band[b] = b;
+	}
+
+	void TransmissionCache::mix_band_product(const int si, const int sj, const double* x0, const double* x1, double* y0, double* y1, const int b_begin, const int b_end) const {
+		alignas(64) double xb0[DP::N_AGE_ADULT_PAD] = {}, xb1[DP::N_AGE_ADULT_PAD] = {};
+		double yb0[DP::N_AGE_ADULT], yb1[DP::N_AGE_ADULT];
+		int b;
+
+		for (b = 0; b < DP::N_AGE_ADULT; ++b) {
+			xb0[_band[b]] += x0[b];
+			xb1[_band[b]] += x1[b];
+		}
+
+		_mixmul(_mix_band[si][sj], xb0, xb1, yb0, yb1, _num_bands, kernel_pad(_num_bands));
+
+		for (b = b_begin; b < b_end; ++b) {
+			y0[b] = yb0[_band[b]];
+			y1[b] = yb1[_band[b]];
+		}
+	}
+
+	TransmissionCache::~TransmissionCache() {}
+
+	void TransmissionCache::update_mixing(const double supply_other[DP::N_SEX][DP::N_POP], const double supply_union[DP::N_SEX][DP::N_POP]) {
+		const double eps = std::numeric_limits<double>::epsilon(); // padding to avoid divide-by-zero
+
+		int si, ri, sj, rj;
+		double canmix_denom, prefer_denom, union_denom, assort;
+		double canmix_numer[DP::N_SEX][DP::N_POP], prefer_numer[DP::N_SEX][DP::N_POP];
+		double mix_other[DP::N_SEX][DP::N_POP][DP::N_SEX][DP::N_POP];
+		double mix_union[DP::N_SEX][DP::N_POP][DP::N_SEX][DP::N_POP];
+
+		// calculate mixing coefficient factors by behavioral risk group
+		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si) {
+			for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
+				assort = _assort[si][ri];
+				canmix_denom = eps;
+				prefer_denom = eps;
+				union_denom = eps;
+				for (sj = DP::SEX_MIN; sj <= DP::SEX_MAX; ++sj) {
+					for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
+						canmix_numer[sj][rj] = supply_other[sj][rj] * _canmix[si][ri][sj][rj];
+						prefer_numer[sj][rj] = supply_other[sj][rj] * _prefer[si][ri][sj][rj];
+						canmix_denom += canmix_numer[sj][rj];
+						prefer_denom += prefer_numer[sj][rj];
+
+						mix_union[si][ri][sj][rj] = supply_union[sj][rj] * (si != sj);
+						union_denom += mix_union[si][ri][sj][rj];
+					}
+				}
+				for (sj = DP::SEX_MIN; sj <= DP::SEX_MAX; ++sj) {
+					for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
+						mix_other[si][ri][sj][rj] = (1.0 - assort) * canmix_numer[sj][rj] / canmix_denom + assort * prefer_numer[sj][rj] / prefer_denom;
+						mix_union[si][ri][sj][rj] /= union_denom;
+					}
+				}
+			}
+		}
+
+		// symmetric part of the balanced mixing coefficients
+		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si)
+			for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri)
+				for (sj = DP::SEX_MIN; sj <= DP::SEX_MAX; ++sj)
+					for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
+						_mix_pop_other[si][ri][sj][rj] = sqrt(mix_other[si][ri][sj][rj] * mix_other[sj][rj][si][ri]);
+						_mix_pop_union[si][ri][sj][rj] = sqrt(mix_union[si][ri][sj][rj] * mix_union[sj][rj][si][ri]);
+					}
+	}
+
+	template<typename popsize_t>
+	void TransmissionCache::update(const ModelData<popsize_t>& dat, const int t) {
+		const int N_TRANSMIT = DP::N_SEX * DP::N_SEX * DP::N_STAGE * DP::N_VL * DP::N_STI;
+		const double* log_escape = dat.log_escape();
+		const double* log_escape_condom = dat.log_escape_condom();
+		double acts_with, acts_wout;
+		double* ptransmit;
+		int si, sj, bi, bj, ri, rj, q, k;
+		int band_width, band_cols;
+
+		// calculate transmission probabilities from the per-act escape probabilities
+		// cached in ModelData. Each partnership type's table is contiguous.
+		// TODO: doi:10.1002/14651858.CD003255 estimated condoms reduced incidence 80%, so could apply
+		// condom effect to incidence rate instead of per-act probabilities. Results should be approximately
+		// the same.
+		// RG 2022-01-25: I tried optimizing by unrolling sex loops so that we could easily skip
+		// the female-to-female transmission = 0 case. This did not improve performance, and may
+		// have actually slowed down calculation.
+		for (q = 0; q < DP::N_BOND; ++q) {
+			acts_with = dat.sex_acts(q) * dat.condom_freq(t, q);
+			acts_wout = dat.sex_acts(q) - acts_with;
+			ptransmit = &_ptransmit[q][0][0][0][0][0];
+			for (k = 0; k < N_TRANSMIT; ++k)
+				ptransmit[k] = -expm1(acts_wout * log_escape[k] + acts_with * log_escape_condom[k]);
+		}
+
+		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si) {
+			_prop_union[si][DP::POP_NOSEX] = 0.0;
+			_prop_union[si][DP::POP_NEVER] = 0.0;
+			_prop_union[si][DP::POP_UNION] = 1.0;
+			_prop_union[si][DP::POP_SPLIT] = 0.0;
+			_prop_union[si][DP::POP_PWID ] = dat.keypop_married(si, DP::POP_PWID );
+			_prop_union[si][DP::POP_BOTH ] = dat.keypop_married(si, DP::POP_BOTH );
+		}
+		_prop_union[DP::MALE][DP::POP_MSM] = dat.keypop_married(DP::MALE, DP::POP_MSM);
+		_prop_union[DP::MALE][DP::POP_TGW] = dat.keypop_married(DP::MALE, DP::POP_TGW);
+
+		// Mixing structure by behavioral risk group
+		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si)
+			for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
+				_assort[si][ri] = dat.partner_assortativity(si, ri);
+				for (sj = DP::SEX_MIN; sj <= DP::SEX_MAX; ++sj)
+					for (rj = DP::POP_NEVER; rj < DP::N_POP_SEX[sj]; ++rj) {
+						_canmix[si][ri][sj][rj] = (dat.mix_structure(si, ri, sj, rj) > 0); // groups can mix
+						_prefer[si][ri][sj][rj] = (dat.mix_structure(si, ri, sj, rj) > 1); // groups prefer to mix
+					}
+			}
+
+		// Symmetric part of the balanced mixing coefficients by age. We only
+		// calculate the upper triangle and mirror it to the lower
+		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si)
+			for (sj = si; sj <= DP::SEX_MAX; ++sj)
+				for (bi = 0; bi < DP::N_AGE_ADULT; ++bi)
+					for (bj = (si == sj ? bi : 0); bj < DP::N_AGE_ADULT; ++bj) {
+						_mix_age[si][sj][bi][bj] = sqrt(dat.partner_preference_age(si, bi, sj, bj) * dat.partner_preference_age(sj, bj, si, bi));
+						_mix_age[sj][si][bj][bi] = _mix_age[si][sj][bi][bj];
+					}
+
+		// Average age mixing coefficients within bands when grouped transmission is used.
+		// Band averages of the symmetric coefficients are also symmetric, so partnerships
+		// remain balanced
+		band_width = dat.transmission_age_band();
+		_num_bands = (DP::N_AGE_ADULT + band_width - 1) / band_width;
+		for (bi = 0; bi < DP::N_AGE_ADULT; ++bi)
+			_band[bi] = bi / band_width;
+		if (_num_bands < DP::N_AGE_ADULT) {
+			band_cols = kernel_pad(_num_bands);
+			for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si)
+				for (sj = DP::SEX_MIN; sj <= DP::SEX_MAX; ++sj) {
+					std::fill_n(_mix_band[si][sj], _num_bands * band_cols, 0.0);
+					for (bi = 0; bi < DP::N_AGE_ADULT; ++bi)
+						for (bj = 0; bj < DP::N_AGE_ADULT; ++bj)
+							_mix_band[si][sj][_band[bi] * band_cols + _band[bj]] += _mix_age[si][sj][bi][bj];
+					for (bi = 0; bi < _num_bands; ++bi)
+						for (bj = 0; bj < _num_bands; ++bj)
+							_mix_band[si][sj][bi * band_cols + bj] /= std::min(band_width, DP::N_AGE_ADULT - bi * band_width) * std::min(band_width, DP::N_AGE_ADULT - bj * band_width);
+				}
+		}
+
+		for (si = DP::SEX_MIN; si <= DP::SEX_MAX; ++si)
+			for (bi = 0; bi < DP::N_AGE_ADULT; ++bi) {
+				_art_suppressed[si][bi] = dat.art_suppressed_adult(t, si, bi);
+				for (ri = DP::POP_NEVER; ri < DP::N_POP_SEX[si]; ++ri) {
+					_partner_rate[si][bi][ri] = dat.partner_rate(t, si, bi, ri);
+					_sti_prev[si][bi][ri] = dat.sti_prev(t, si, bi, ri);
+				}
+			}
+
+		_force_pwid[DP::FEMALE] = dat.pwid_needle_sharing(t) * dat.pwid_infection_force(t, DP::FEMALE);
+		_force_pwid[DP::MALE  ] = dat.pwid_needle_sharing(t) * dat.pwid_infection_force(t, DP::MALE);
+
+		_vmmc_mult[DP::FEMALE] = 1.0;
+		_vmmc_mult[DP::MALE_U] = 1.0;
+		_vmmc_mult[DP::MALE_C] = 1.0 - dat.effect_vmmc();
+	}
+
+} // END namespace DP
+
+#endif // DPTRANSMISSION_H
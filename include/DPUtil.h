@@ -80,7 +80,8 @@ namespace DP {
 	// @param dist CD4 distribution after primary infection - no row for primary infection
 	// @param prog HIV progression rates with untreated HIV - no row for CD4<50
 	// @param mort HIV-related mortality rates with untreated HIV
-	template<typename popsize_t>
+	// @tparam scheme CD4 scheme of the projection that will use dat
+	template<cd4_scheme_t scheme = CD4_SCHEME_DEFAULT, typename popsize_t>
 	void set_adult_prog_from_10yr(ModelData<popsize_t>& dat, cd4_sex_age_ref_t& dist, cd4_sex_age_ref_t& prog, cd4_sex_age_ref_t& mort);
 
 	// Initialize adult HIV-related mortality rates on ART
@@ -101,7 +102,8 @@ namespace DP {
 	/// Initialize adult ART eligibility by CD4 count thresholds
 	/// @param dat Model data instance to initialize
 	/// @param cd4 The highest CD4 cell count eligible for ART by year
-	template<typename popsize_t>
+	/// @tparam scheme CD4 scheme of the projection that will use dat
+	template<cd4_scheme_t scheme = CD4_SCHEME_DEFAULT, typename popsize_t>
 	void set_adult_art_eligibility_from_cd4(ModelData<popsize_t>& dat, time_series_int_ref_t& cd4);
 
 	// Initialize numbers of CLHIV aging in using Spectrum outputs
@@ -194,45 +196,45 @@ namespace DP {
 		dat.effect_sti_hivneg(or_sti_hiv_neg);
 	}
 
-	template<typename popsize_t>
+	template<cd4_scheme_t scheme, typename popsize_t>
 	void set_adult_prog_from_10yr(ModelData<popsize_t>& dat, cd4_sex_age_ref_t& dist, cd4_sex_age_ref_t& prog, cd4_sex_age_ref_t& mort) {
 		const int n_age_group = 4;
 		int row, col;
 
-#ifndef SPECTRUM_CD4
-		for (int h(DP::HIV_GEQ_500); h <= DP::HIV_000_050; ++h) {
-			row = h - DP::HIV_GEQ_500;
+		if constexpr (scheme == DP::CD4_GOALS) {
+			for (int h(DP::HIV_GEQ_500); h <= DP::HIV_000_050; ++h) {
+				row = h - DP::HIV_GEQ_500;
+				for (int a(DP::AGE_ADULT_MIN); a <= DP::AGE_ADULT_MAX; ++a) {
+					col = std::min((a - DP::AGE_ADULT_MIN) / 10, n_age_group - 1);
+					dat.hiv_dist(DP::MALE,   a, h, dist[row][col]);
+					dat.hiv_dist(DP::FEMALE, a, h, dist[row][col + n_age_group]);
+				}
+			}
+		} else {
+			// When Spectrum CD4 categories are used, Spectrum CD4 categories are remapped
+			// onto Goals categories. Since Goals only has inputs for 6 of 7 categories,
+			// we split the input for Goals 200-350 across compartments to represent
+			// Spectrum 200-250 and 250-350.
 			for (int a(DP::AGE_ADULT_MIN); a <= DP::AGE_ADULT_MAX; ++a) {
 				col = std::min((a - DP::AGE_ADULT_MIN) / 10, n_age_group - 1);
-				dat.hiv_dist(DP::MALE,   a, h, dist[row][col]);
-				dat.hiv_dist(DP::FEMALE, a, h, dist[row][col + n_age_group]);
+				dat.hiv_dist(DP::MALE, a, DP::HIV_PRIMARY, dist[0][col]);	       // Spectrum CD4>500 mapped to Goals Primary
+				dat.hiv_dist(DP::MALE, a, DP::HIV_GEQ_500, dist[1][col]);        // Spectrum 350-500 mapped to Goals CD4>500
+				dat.hiv_dist(DP::MALE, a, DP::HIV_350_500, dist[2][col] * 0.74); // Spectrum 250-350 mapped to Goals 350-500
+				dat.hiv_dist(DP::MALE, a, DP::HIV_200_350, dist[2][col] * 0.26); // Spectrum 200-250 mapped to Goals 200-350
+				dat.hiv_dist(DP::MALE, a, DP::HIV_100_200, dist[3][col]);        // Spectrum 100-200 mapped to Goals 100-200
+				dat.hiv_dist(DP::MALE, a, DP::HIV_050_100, dist[4][col]);        // Spectrum  50-100 mapped to Goals  50-100
+				dat.hiv_dist(DP::MALE, a, DP::HIV_000_050, dist[5][col]);        // Spectrum   0-50  mapped to Goals   0-50
+
+				col += n_age_group;
+				dat.hiv_dist(DP::FEMALE, a, DP::HIV_PRIMARY, dist[0][col]);
+				dat.hiv_dist(DP::FEMALE, a, DP::HIV_GEQ_500, dist[1][col]);
+				dat.hiv_dist(DP::FEMALE, a, DP::HIV_350_500, dist[2][col] * 0.74);
+				dat.hiv_dist(DP::FEMALE, a, DP::HIV_200_350, dist[2][col] * 0.26);
+				dat.hiv_dist(DP::FEMALE, a, DP::HIV_100_200, dist[3][col]);
+				dat.hiv_dist(DP::FEMALE, a, DP::HIV_050_100, dist[4][col]);
+				dat.hiv_dist(DP::FEMALE, a, DP::HIV_000_050, dist[5][col]);
 			}
 		}
-#else
-		// When Spectrum CD4 categories are used, Spectrum CD4 categories are remapped
-		// onto Goals categories. Since Goals only has inputs for 6 of 7 categories,
-		// we split the input for Goals 200-350 across compartments to represent
-		// Spectrum 200-250 and 250-350.
-		for (int a(DP::AGE_ADULT_MIN); a <= DP::AGE_ADULT_MAX; ++a) {
-			col = std::min((a - DP::AGE_ADULT_MIN) / 10, n_age_group - 1);
-			dat.hiv_dist(DP::MALE, a, DP::HIV_PRIMARY, dist[0][col]);	       // Spectrum CD4>500 mapped to Goals Primary
-			dat.hiv_dist(DP::MALE, a, DP::HIV_GEQ_500, dist[1][col]);        // Spectrum 350-500 mapped to Goals CD4>500
-			dat.hiv_dist(DP::MALE, a, DP::HIV_350_500, dist[2][col] * 0.74); // Spectrum 250-350 mapped to Goals 350-500
-			dat.hiv_dist(DP::MALE, a, DP::HIV_200_350, dist[2][col] * 0.26); // Spectrum 200-250 mapped to Goals 200-350
-			dat.hiv_dist(DP::MALE, a, DP::HIV_100_200, dist[3][col]);        // Spectrum 100-200 mapped to Goals 100-200
-			dat.hiv_dist(DP::MALE, a, DP::HIV_050_100, dist[4][col]);        // Spectrum  50-100 mapped to Goals  50-100
-			dat.hiv_dist(DP::MALE, a, DP::HIV_000_050, dist[5][col]);        // Spectrum   0-50  mapped to Goals   0-50
-
-			col += n_age_group;
-			dat.hiv_dist(DP::FEMALE, a, DP::HIV_PRIMARY, dist[0][col]);
-			dat.hiv_dist(DP::FEMALE, a, DP::HIV_GEQ_500, dist[1][col]);
-			dat.hiv_dist(DP::FEMALE, a, DP::HIV_350_500, dist[2][col] * 0.74);
-			dat.hiv_dist(DP::FEMALE, a, DP::HIV_200_350, dist[2][col] * 0.26);
-			dat.hiv_dist(DP::FEMALE, a, DP::HIV_100_200, dist[3][col]);
-			dat.hiv_dist(DP::FEMALE, a, DP::HIV_050_100, dist[4][col]);
-			dat.hiv_dist(DP::FEMALE, a, DP::HIV_000_050, dist[5][col]);
-		}
-#endif
 
 		for (int h(DP::HIV_PRIMARY); h <= DP::HIV_050_100; ++h) {
 			for (int a(DP::AGE_ADULT_MIN); a <= DP::AGE_ADULT_MAX; ++a) {
@@ -272,12 +274,12 @@ namespace DP {
 		}
 	}
 
-	template<typename popsize_t>
+	template<cd4_scheme_t scheme, typename popsize_t>
 	void set_adult_art_eligibility_from_cd4(ModelData<popsize_t>& dat, time_series_int_ref_t& cd4) {
 		int h;
 		for (int t(0); t < dat.num_years(); ++t) {
 			h = DP::HIV_ADULT_MIN;
-			while ((h < DP::HIV_ADULT_MAX) && (DP::CD4_ADULT_LOWER[h] >= cd4[t]))
+			while ((h < DP::HIV_ADULT_MAX) && (Cd4Scheme<scheme>::CD4_LOWER[h] >= cd4[t]))
 				++h;
 			dat.art_first_eligible_stage_adult(t,h);
 		}
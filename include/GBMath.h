@@ -78,6 +78,44 @@ namespace GB {
         return(1.0 / (1.0 + std::pow((x - dist.shift()) / dist.scale(), -dist.shape())));
     }
 
+    // Compensated (Kahan-Babuska) summation. Rounding error lost by each addition
+    // is accumulated separately and added back when the sum is read, so the error
+    // does not grow with the number of terms. This behaves like a RealType in
+    // assignments, += and arithmetic. Compensation is removed by value-unsafe
+    // optimizations such as -ffast-math.
+    template <class RealType = double>
+    class kahan_sum {
+    public:
+        typedef RealType value_type;
+
+        kahan_sum(RealType value = 0) : _sum(value), _err(0) {}
+
+        kahan_sum& operator=(RealType value) {
+            _sum = value;
+            _err = 0;
+            return *this;
+        }
+
+        kahan_sum& operator+=(RealType x) {
+            const RealType sum = _sum + x;
+            if (std::fabs(_sum) >= std::fabs(x))
+                _err += (_sum - sum) + x;
+            else
+                _err += (x - sum) + _sum;
+            _sum = sum;
+            return *this;
+        }
+
+        kahan_sum& operator-=(RealType x) {return *this += -x;}
+
+        RealType value() const {return _sum + _err;}
+        operator RealType() const {return value();}
+
+    private:
+        RealType _sum;
+        RealType _err;
+    };
+
 } // end namespace GB
 
 #endif // GBMATH_H
@@ -0,0 +1,170 @@
+#ifndef GBTHREADPOOL_H
+#define GBTHREADPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace GB {
+
+// Persistent pool of threads for data-parallel loops. parallel_for() splits an
+// index range into one contiguous block per thread. A thread that finishes its
+// own block steals indices from the end of other threads' blocks, so uneven
+// tasks stay balanced. The calling thread takes part as thread 0, and the other
+// threads wait between loops, so a pool with one thread runs loops serially.
+class WorkStealingPool {
+public:
+  // Task for index i, called on the thread with index thread
+  typedef std::function<void(const int i, const int thread)> task_t;
+
+  // Start a pool of num_threads threads, including the calling thread. If
+  // num_threads is 0, use one thread per hardware thread
+  explicit WorkStealingPool(const int num_threads = 0);
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  inline int num_threads() const {return _num_threads;}
+
+  // Call task(i, thread) for each i in [0, n) and return when all calls have
+  // finished. thread is in [0, num_threads()) and can index per-thread scratch
+  // memory. Tasks must not throw or call parallel_for on the same pool. Only
+  // one thread may call parallel_for at a time
+  void parallel_for(const int n, const task_t& task);
+
+private:
+  // Indices [begin, end) not yet taken from a thread's block
+  struct alignas(64) Block {
+    std::mutex lock;
+    int begin;
+    int end;
+  };
+
+  void worker_main(const int thread);
+
+  // Run tasks from thread's own block, then steal from the others
+  void run_tasks(const int thread);
+  bool take_own(const int thread, int& i);
+  bool steal(const int thread, int& i);
+
+  int _num_threads;
+  std::unique_ptr<Block[]> _blocks;
+  std::vector<std::thread> _threads;
+
+  std::mutex _mutex;
+  std::condition_variable _start;
+  std::condition_variable _done;
+  const task_t* _task;
+  std::uint64_t _generation; // incremented to start each loop
+  int _busy;                 // worker threads still running the current loop
+  bool _stop;
+};
+
+inline WorkStealingPool::WorkStealingPool(const int num_threads)
+  : _num_threads(num_threads > 0 ? num_threads : std::max(static_cast<int>(std::thread::hardware_concurrency()), 1)),
+    _blocks(new Block[_num_threads]),
+    _task(nullptr),
+    _generation(0),
+    _busy(0),
+    _stop(false) {
+  _threads.reserve(_num_threads - 1);
+  for (int k(1); k < _num_threads; ++k)
+    _threads.emplace_back(&WorkStealingPool::worker_main, this, k);
+}
+
+inline WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _start.notify_all();
+  for (std::thread& thread : _threads)
+    thread.join();
+}
+
+inline void WorkStealingPool::parallel_for(const int n, const task_t& task) {
+  int k;
+
+  if (_num_threads == 1 || n <= 1) {
+    for (k = 0; k < n; ++k)
+      task(k, 0);
+    return;
+  }
+
+  // Workers are waiting, so blocks can be set without their locks. Starting the
+  // loop under _mutex publishes them to the workers
+  for (k = 0; k < _num_threads; ++k) {
+    _blocks[k].begin = static_cast<int>(static_cast<std::int64_t>(n) * k / _num_threads);
+    _blocks[k].end = static_cast<int>(static_cast<std::int64_t>(n) * (k + 1) / _num_threads);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _task = &task;
+    _busy = _num_threads - 1;
+    ++_generation;
+  }
+  _start.notify_all();
+
+  run_tasks(0);
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  _done.wait(lock, [this] {return _busy == 0;});
+  _task = nullptr;
+}
+
+inline void WorkStealingPool::worker_main(const int thread) {
+  std::uint64_t generation(0);
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _start.wait(lock, [&] {return _stop || _generation != generation;});
+      if (_stop) return;
+      generation = _generation;
+    }
+
+    run_tasks(thread);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (--_busy == 0) _done.notify_one();
+  }
+}
+
+inline void WorkStealingPool::run_tasks(const int thread) {
+  const task_t& task(*_task);
+  int i;
+  while (take_own(thread, i) || steal(thread, i))
+    task(i, thread);
+}
+
+inline bool WorkStealingPool::take_own(const int thread, int& i) {
+  Block& block(_blocks[thread]);
+  std::lock_guard<std::mutex> lock(block.lock);
+  if (block.begin == block.end) return false;
+  i = block.begin++;
+  return true;
+}
+
+inline bool WorkStealingPool::steal(const int thread, int& i) {
+  // Blocks only shrink during a loop, so once every block has been seen empty
+  // there is nothing left to steal
+  for (int k(1); k < _num_threads; ++k) {
+    Block& block(_blocks[(thread + k) % _num_threads]);
+    std::lock_guard<std::mutex> lock(block.lock);
+    if (block.begin < block.end) {
+      i = --block.end;
+      return true;
+    }
+  }
+  return false;
+}
+
+} // end namespace GB
+
+#endif // GBTHREADPOOL_H
@@ -1,6 +1,8 @@
 #ifndef GBUTIL_H
 #define GBUTIL_H
 
+#include <cstddef>
+#include <cstdint>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -14,6 +16,31 @@ std::vector<std::string> split(const std::string &str, const char delimiter);
 // Return TRUE if the string str contains the substring sub, FALSE otherwise
 bool contains(const std::string &str, const std::string &sub);
 
+// 64-bit FNV-1a hash of a sequence of bytes. Values are hashed by their
+// in-memory representation, so hashes are only comparable between builds with
+// the same byte order and type sizes
+class fnv1a_hash {
+public:
+  fnv1a_hash() : _hash(14695981039346656037ULL) {}
+
+  void update(const void* data, const std::size_t num_bytes) {
+    const unsigned char* byte(static_cast<const unsigned char*>(data));
+    for (std::size_t k(0); k < num_bytes; ++k) {
+      _hash ^= byte[k];
+      _hash *= 1099511628211ULL;
+    }
+  }
+
+  // Hash num_values values of a trivially copyable type
+  template <typename T>
+  void update(const T* values, const std::size_t num_values) {update(static_cast<const void*>(values), num_values * sizeof(T));}
+
+  std::uint64_t value() const {return _hash;}
+
+private:
+  std::uint64_t _hash;
+};
+
 } // end namespace GB
 
 template <typename T>
@@ -1,6 +1,7 @@
 #ifndef GOALS_ARM_H
 #define GOALS_ARM_H
 
+#include <DPEnsemble.h>
 #include <DPProjection.h>
 #include <DPUtil.h>
 
@@ -1,6 +1,9 @@
 #ifndef POPULATION_H
 #define POPULATION_H
 
+#include <cstddef>
+#include <new>
+#include <numeric>
 #include <vector>
 #include <boost/multi_array.hpp>
 #include <DPConst.h>
@@ -8,55 +11,116 @@
 namespace DP {
 
 // Class for population structures
-class Population {
+/// @tparam value_t real-valued type (e.g. double or float) used to store population sizes
+/// @tparam layout  memory layout of adults living with HIV. Accessors are the same for every layout
+template<typename value_t, hiv_layout_t layout = HIV_LAYOUT_COMPARTMENT>
+class PopulationT {
 public:
   // +-+ Nested types +-+
-  typedef boost::multi_array_ref<double, 4> adult_neg_t; // HIV-negative adults, stratified by year, sex, age, risk
-  typedef boost::multi_array_ref<double, 6> adult_hiv_t; // HIV-positive adults, stratified by year, sex, age, risk, CD4, and care status
-  typedef boost::multi_array_ref<double, 3> child_neg_t; // HIV-negative children, stratified by year, sex and age
-  typedef boost::multi_array_ref<double, 5> child_hiv_t; // HIV-positive children, stratified by year, sex, age, CD4, and care status
+  typedef value_t value_type;
+  typedef boost::multi_array_ref<value_t, 4> adult_neg_t; // HIV-negative adults, stratified by year, sex, age, risk
+  typedef boost::multi_array_ref<value_t, 6> adult_hiv_t; // HIV-positive adults, stratified by year, sex, age, risk, CD4, and care status
+  typedef boost::multi_array_ref<value_t, 3> child_neg_t; // HIV-negative children, stratified by year, sex and age
+  typedef boost::multi_array_ref<value_t, 5> child_hiv_t; // HIV-positive children, stratified by year, sex, age, CD4, and care status
+
+  // +-+ Constants +-+
+  // Alignment in bytes of owned storage and of each array within it
+  static constexpr std::size_t ALIGNMENT = 64;
+
+  // (CD4, care status) blocks fill whole ALIGNMENT-byte lines when the number of
+  // CD4 categories is a multiple of HIV_EXTENT_ALIGN
+  static constexpr int HIV_EXTENT_ALIGN = ALIGNMENT / std::gcd(ALIGNMENT, N_DTX * sizeof(value_t));
+
+  // Extent of the CD4 dimension of adult_hiv in owned storage. With
+  // HIV_LAYOUT_COMPARTMENT, CD4 categories are padded so that each (CD4, care
+  // status) block fills a whole number of ALIGNMENT-byte lines. Other layouts
+  // have risk groups innermost and are not padded
+  static constexpr int HIV_EXTENT_PADDED = (layout != HIV_LAYOUT_COMPARTMENT) ? N_HIV_ADULT
+    : (N_HIV_ADULT + HIV_EXTENT_ALIGN - 1) / HIV_EXTENT_ALIGN * HIV_EXTENT_ALIGN;
+
+  // Number of years held by rolling storage. This must be a power of two
+  static constexpr int ROLLING_YEARS = 2;
 
   // +-+ Methods +-+
   // Constructors
-  Population(const int year_min, const int year_max);
-  ~Population();
+  PopulationT(const int year_min, const int year_max);
+  PopulationT(const PopulationT&) = delete;
+  PopulationT& operator=(const PopulationT&) = delete;
+  ~PopulationT();
+
+  /// Allocate owned storage for population sizes as one ALIGNMENT-byte aligned
+  /// arena. Each array starts on an aligned boundary, and adult_hiv is padded to
+  /// HIV_EXTENT_PADDED CD4 categories. Storage is released on destruction or when
+  /// storage is reallocated or shared
+  void allocate_storage();
+
+  /// Allocate owned storage like allocate_storage(), but only for the last
+  /// ROLLING_YEARS years. Year t is stored in slot t % ROLLING_YEARS, so storing
+  /// year t overwrites year t - ROLLING_YEARS. Accessors still take the time
+  /// index relative to year_first(), but are only valid for the years most
+  /// recently stored
+  void allocate_rolling_storage();
 
   /// Share memory for storing population sizes
   /// @param ptr_adult_neg HIV-negative adults by year, sex, age, and risk
-  /// @param ptr_adult_hiv HIV-positive adults by year, sex, age, risk, CD4, and care status
+  /// @param ptr_adult_hiv HIV-positive adults by year, sex, age, risk, CD4, and care status,
+  ///                      ordered according to layout
   /// @param ptr_child_neg HIV-negative children by year, sex, age
   /// @param ptr_child_hiv HIV-positive children by year, sex, age, CD4, and care status
   void share_storage(
-      double* ptr_adult_neg,
-      double* ptr_adult_hiv,
-      double* ptr_child_neg,
-      double* ptr_child_hiv);
+      value_t* ptr_adult_neg,
+      value_t* ptr_adult_hiv,
+      value_t* ptr_child_neg,
+      value_t* ptr_child_hiv);
   
   // Accessors
   int year_first() const;
   int year_final() const;
   int num_years() const;
+  bool owns_storage() const {return _arena != NULL;}
+  bool rolling() const {return _time_mask != -1;}
+  int num_slots() const {return rolling() ? ROLLING_YEARS : num_years();} // Number of years held in storage
+
+  // Distance in values between adult_hiv elements that differ by one in index
+  // dim, where dims 0-5 are year, sex, age, risk, CD4, and care status. This
+  // depends on the layout and on whether storage is padded
+  std::ptrdiff_t adult_hiv_stride(const int dim) const {return _adult_hiv->strides()[dim];}
 
   // Population accessors: "get" methods
-  inline double adult_neg(int t, int s, int a, int r) const { return (*_adult_neg)[t][s][a][r]; }
-  inline double adult_hiv(int t, int s, int a, int r, int h, int d) const { return (*_adult_hiv)[t][s][a][r][h][d]; }
-  inline double child_neg(int t, int s, int a) const { return (*_child_neg)[t][s][a]; }
-  inline double child_hiv(int t, int s, int a, int h, int d) const { return (*_child_hiv)[t][s][a][h][d]; }
+  inline value_t adult_neg(int t, int s, int a, int r) const { return (*_adult_neg)[t & _time_mask][s][a][r]; }
+  inline value_t adult_hiv(int t, int s, int a, int r, int h, int d) const { return (*_adult_hiv)[t & _time_mask][s][a][r][h][d]; }
+  inline value_t child_neg(int t, int s, int a) const { return (*_child_neg)[t & _time_mask][s][a]; }
+  inline value_t child_hiv(int t, int s, int a, int h, int d) const { return (*_child_hiv)[t & _time_mask][s][a][h][d]; }
 
   // Population accessors: "set" methods
-  inline double& adult_neg(int t, int s, int a, int r) { return (*_adult_neg)[t][s][a][r]; }
-  inline double& adult_hiv(int t, int s, int a, int r, int h, int d) { return (*_adult_hiv)[t][s][a][r][h][d]; }
-  inline double& child_neg(int t, int s, int a) { return (*_child_neg)[t][s][a]; }
-  inline double& child_hiv(int t, int s, int a, int h, int d) { return (*_child_hiv)[t][s][a][h][d]; }
+  inline value_t& adult_neg(int t, int s, int a, int r) { return (*_adult_neg)[t & _time_mask][s][a][r]; }
+  inline value_t& adult_hiv(int t, int s, int a, int r, int h, int d) { return (*_adult_hiv)[t & _time_mask][s][a][r][h][d]; }
+  inline value_t& child_neg(int t, int s, int a) { return (*_child_neg)[t & _time_mask][s][a]; }
+  inline value_t& child_hiv(int t, int s, int a, int h, int d) { return (*_child_hiv)[t & _time_mask][s][a][h][d]; }
   
   // Convenience functions
-  void initialize(double value); // Set all compartment sizes = value
+  void initialize(value_t value); // Set all compartment sizes = value
+  void clear_year(const int t);    // Set all compartment sizes in year t = 0
 
 private:
+  // Allocate owned storage for n_slot years
+  void allocate_slots(const int n_slot);
+
+  // Wrap storage for each array, with n_slot years and hiv_extent CD4 categories in adult_hiv
+  void wrap_storage(value_t* ptr_adult_neg, value_t* ptr_adult_hiv, value_t* ptr_child_neg, value_t* ptr_child_hiv, const int n_slot, const int hiv_extent);
+  void release_storage();
+
   int _year_first;
   int _year_final;
   int _n_year;
 
+  // Time indices are masked with _time_mask to find their storage slot. This is
+  // ROLLING_YEARS - 1 for rolling storage and -1 (all bits set) otherwise
+  int _time_mask;
+
+  // Owned storage, or NULL if storage is shared
+  void* _arena;
+
   // Population state variables
   adult_neg_t* _adult_neg; // HIV-negative adults
   adult_hiv_t* _adult_hiv; // HIV-positive adults
@@ -64,6 +128,8 @@ private:
   child_hiv_t* _child_hiv; // HIV-positive children
 };
 
+typedef PopulationT<double> Population;
+
 } // END namespace DP
 
 #include <Population_impl.h>
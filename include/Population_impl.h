@@ -3,51 +3,129 @@
 
 namespace DP {
 
-    Population::Population(const int year_min, const int year_max)
-        : _adult_neg(NULL), _adult_hiv(NULL), _child_neg(NULL), _child_hiv(NULL) {
+    template<typename value_t, hiv_layout_t layout>
+    PopulationT<value_t, layout>::PopulationT(const int year_min, const int year_max)
+        : _time_mask(-1), _arena(NULL), _adult_neg(NULL), _adult_hiv(NULL), _child_neg(NULL), _child_hiv(NULL) {
       _year_first = year_min;
       _year_final = year_max;
       _n_year = year_max - year_min + 1;
     }
 
-    Population::~Population() {
+    template<typename value_t, hiv_layout_t layout>
+    PopulationT<value_t, layout>::~PopulationT() {
+      release_storage();
+    }
+
+    template<typename value_t, hiv_layout_t layout>
+    void PopulationT<value_t, layout>::allocate_storage() {
+      allocate_slots(num_years());
+      _time_mask = -1;
+    }
+
+    template<typename value_t, hiv_layout_t layout>
+    void PopulationT<value_t, layout>::allocate_rolling_storage() {
+      static_assert((ROLLING_YEARS & (ROLLING_YEARS - 1)) == 0, "ROLLING_YEARS must be a power of two");
+      allocate_slots(ROLLING_YEARS);
+      _time_mask = ROLLING_YEARS - 1;
+    }
+
+    template<typename value_t, hiv_layout_t layout>
+    void PopulationT<value_t, layout>::allocate_slots(const int n_slot) {
+      // Round each array up to whole alignment lines so the next one starts aligned
+      const std::size_t line(ALIGNMENT / sizeof(value_t));
+      const std::size_t n_adult_neg((n_slot * N_SEX_MC * N_AGE_ADULT * N_POP + line - 1) / line * line);
+      const std::size_t n_adult_hiv((n_slot * N_SEX_MC * N_AGE_ADULT * N_POP * HIV_EXTENT_PADDED * N_DTX + line - 1) / line * line);
+      const std::size_t n_child_neg((n_slot * N_SEX_MC * N_AGE_CHILD + line - 1) / line * line);
+      const std::size_t n_child_hiv((n_slot * N_SEX_MC * N_AGE_CHILD * N_HIV_CHILD * N_DTX + line - 1) / line * line);
+      const std::size_t n_total(n_adult_neg + n_adult_hiv + n_child_neg + n_child_hiv);
+      value_t* ptr;
+
+      release_storage();
+      _arena = ::operator new(n_total * sizeof(value_t), std::align_val_t(ALIGNMENT));
+      ptr = static_cast<value_t*>(_arena);
+      std::fill_n(ptr, n_total, value_t(0));
+      wrap_storage(ptr, ptr + n_adult_neg, ptr + n_adult_neg + n_adult_hiv, ptr + n_adult_neg + n_adult_hiv + n_child_neg, n_slot, HIV_EXTENT_PADDED);
+    }
+
+    template<typename value_t, hiv_layout_t layout>
+    void PopulationT<value_t, layout>::share_storage(
+        value_t* ptr_adult_neg,
+        value_t* ptr_adult_hiv,
+        value_t* ptr_child_neg,
+        value_t* ptr_child_hiv) {
+      release_storage();
+      wrap_storage(ptr_adult_neg, ptr_adult_hiv, ptr_child_neg, ptr_child_hiv, num_years(), N_HIV_ADULT);
+      _time_mask = -1;
+    }
+
+    template<typename value_t, hiv_layout_t layout>
+    void PopulationT<value_t, layout>::wrap_storage(
+        value_t* ptr_adult_neg,
+        value_t* ptr_adult_hiv,
+        value_t* ptr_child_neg,
+        value_t* ptr_child_hiv,
+        const int n_slot,
+        const int hiv_extent) {
+        // Dimensions of adult_hiv in order of increasing stride
+        const boost::multi_array_types::size_type order[3][6] = {
+          {5, 4, 3, 2, 1, 0},  // HIV_LAYOUT_COMPARTMENT: [t][s][a][r][h][d]
+          {3, 5, 4, 2, 1, 0},  // HIV_LAYOUT_CELL_MAJOR:  [t][s][a][h][d][r]
+          {3, 2, 1, 4, 5, 0}}; // HIV_LAYOUT_CARE_MAJOR:  [t][d][h][s][a][r]
+        const bool ascending[6] = {true, true, true, true, true, true};
+        _adult_neg = new adult_neg_t(ptr_adult_neg, boost::extents[n_slot][N_SEX_MC][N_AGE_ADULT][N_POP]);
+        _adult_hiv = new adult_hiv_t(ptr_adult_hiv, boost::extents[n_slot][N_SEX_MC][N_AGE_ADULT][N_POP][hiv_extent][N_DTX],
+                                     boost::general_storage_order<6>(order[layout], ascending));
+        _child_neg = new child_neg_t(ptr_child_neg, boost::extents[n_slot][N_SEX_MC][N_AGE_CHILD]);
+        _child_hiv = new child_hiv_t(ptr_child_hiv, boost::extents[n_slot][N_SEX_MC][N_AGE_CHILD][N_HIV_CHILD][N_DTX]);
+    }
+
+    template<typename value_t, hiv_layout_t layout>
+    void PopulationT<value_t, layout>::release_storage() {
       if (_adult_neg) { delete _adult_neg; }
       if (_adult_hiv) { delete _adult_hiv; }
       if (_child_neg) { delete _child_neg; }
       if (_child_hiv) { delete _child_hiv; }
+      if (_arena) { ::operator delete(_arena, std::align_val_t(ALIGNMENT)); }
+      _adult_neg = NULL;
+      _adult_hiv = NULL;
+      _child_neg = NULL;
+      _child_hiv = NULL;
+      _arena = NULL;
     }
 
-    void Population::share_storage(
-        double* ptr_adult_neg,
-        double* ptr_adult_hiv,
-        double* ptr_child_neg,
-        double* ptr_child_hiv) {
-        const int n_year(year_final() - year_first() + 1);
-        _adult_neg = new adult_neg_t(ptr_adult_neg, boost::extents[n_year][N_SEX_MC][N_AGE_ADULT][N_POP]);
-        _adult_hiv = new adult_hiv_t(ptr_adult_hiv, boost::extents[n_year][N_SEX_MC][N_AGE_ADULT][N_POP][N_HIV_ADULT][N_DTX]);
-        _child_neg = new child_neg_t(ptr_child_neg, boost::extents[n_year][N_SEX_MC][N_AGE_CHILD]);
-        _child_hiv = new child_hiv_t(ptr_child_hiv, boost::extents[n_year][N_SEX_MC][N_AGE_CHILD][N_HIV_CHILD][N_DTX]);
-    }
-
-    int Population::year_first() const {
+    template<typename value_t, hiv_layout_t layout>
+    int PopulationT<value_t, layout>::year_first() const {
       return _year_first;
     }
 
-    int Population::year_final() const {
+    template<typename value_t, hiv_layout_t layout>
+    int PopulationT<value_t, layout>::year_final() const {
       return _year_final;
     }
 
-    int Population::num_years() const {
+    template<typename value_t, hiv_layout_t layout>
+    int PopulationT<value_t, layout>::num_years() const {
       return _n_year;
     }
 
-    void Population::initialize(double value) {
+    template<typename value_t, hiv_layout_t layout>
+    void PopulationT<value_t, layout>::initialize(value_t value) {
       std::fill_n(_child_neg->data(), _child_neg->num_elements(), value);
       std::fill_n(_child_hiv->data(), _child_hiv->num_elements(), value);
       std::fill_n(_adult_neg->data(), _adult_neg->num_elements(), value);
       std::fill_n(_adult_hiv->data(), _adult_hiv->num_elements(), value);
     }
 
+    template<typename value_t, hiv_layout_t layout>
+    void PopulationT<value_t, layout>::clear_year(const int t) {
+      // Year is the outermost dimension of every array and layout
+      const int slot(t & _time_mask);
+      std::fill_n(_child_neg->data() + slot * _child_neg->strides()[0], _child_neg->strides()[0], value_t(0));
+      std::fill_n(_child_hiv->data() + slot * _child_hiv->strides()[0], _child_hiv->strides()[0], value_t(0));
+      std::fill_n(_adult_neg->data() + slot * _adult_neg->strides()[0], _adult_neg->strides()[0], value_t(0));
+      std::fill_n(_adult_hiv->data() + slot * _adult_hiv->strides()[0], _adult_hiv->strides()[0], value_t(0));
+    }
+
 } // END namespace DP
 
 #endif // POPULATION_IMPL_H
@@ -0,0 +1,201 @@
+// Synthetic inputs for testing and benchmarking full projections without country data. The
+// epidemic grows quickly from a seed in 1975 and ART is scaled up from 2004.
+#ifndef TESTS_SYNTHETIC_PROJECTION_H
+#define TESTS_SYNTHETIC_PROJECTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <GoalsARM.h>
+
+// Write a UPD file with smoothly varying demographic inputs for 1970-2049
+void write_synthetic_upd(const std::string& filename) {
+	const int year_first(DP::UPDData::UPD_YEAR_START), year_final(DP::UPDData::UPD_YEAR_FINAL);
+	FILE* out = fopen(filename.c_str(), "w");
+	int y, s, a;
+
+	fprintf(out, "<basepop>\nyear,sex,age,value\n");
+	for (y = year_first; y <= 1985; y += 5)
+		for (s = 1; s <= 2; ++s)
+			for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+				fprintf(out, "%d,%d,%d,%.3f\n", y, s, a, 50000.0 * std::exp(-0.035 * a) * (1.0 + 0.1 * (y - year_first) / 5));
+	fprintf(out, "</basepop>\n<lfts>\nyear,sex,age,lx,ex,Sx\n");
+	for (y = year_first; y <= year_final; ++y)
+		for (s = 1; s <= 2; ++s)
+			for (a = DP::AGE_MIN; a <= DP::AGE_MAX + 1; ++a)
+				fprintf(out, "%d,%d,%d,%.4f,%.4f,%.6f\n", y, s, a, 100000.0 * std::exp(-0.01 * a), std::max(70.0 - 0.8 * a, 2.0),
+				        a == 0 ? 0.966 : a < 50 ? 0.999 : a <= DP::AGE_MAX ? 0.999 - 0.003 * (a - 50) : 0.85);
+	fprintf(out, "</lfts>\n<tfr>\nyear,value\n");
+	for (y = year_first; y <= year_final; ++y)
+		fprintf(out, "%d,%.5f\n", y, std::max(6.5 - 0.05 * (y - year_first), 2.5));
+	fprintf(out, "</tfr>\n<srb>\nyear,value\n");
+	for (y = year_first; y <= year_final; ++y)
+		fprintf(out, "%d,%.5f\n", y, 103.0);
+	fprintf(out, "</srb>\n<pasfrs>\nyear,age,value\n");
+	for (y = year_first; y <= year_final; ++y) {
+		double total(0.0);
+		for (a = DP::AGE_BIRTH_MIN; a <= DP::AGE_BIRTH_MAX; ++a)
+			total += std::exp(-0.5 * std::pow((a - 27.0) / 7.0, 2));
+		for (a = DP::AGE_BIRTH_MIN; a <= DP::AGE_BIRTH_MAX; ++a)
+			fprintf(out, "%d,%d,%.6f\n", y, a, std::exp(-0.5 * std::pow((a - 27.0) / 7.0, 2)) / total);
+	}
+	fprintf(out, "</pasfrs>\n<migration>\nyear,sex,age,value\n");
+	for (y = year_first; y <= year_final; ++y)
+		for (s = 1; s <= 2; ++s)
+			for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+				fprintf(out, "%d,%d,%d,%.3f\n", y, s, a, 0.0);
+	fprintf(out, "</migration>\n");
+	fclose(out);
+}
+
+// Storage for model inputs and outputs that ModelData shares with the caller
+struct SyntheticInputs {
+	std::vector<double> births, births_exposed, new_hiv, partner_rate, mix, assort, pwid_force, needle;
+
+	explicit SyntheticInputs(const int num_years)
+		: births(num_years * DP::N_SEX), births_exposed(num_years),
+		  new_hiv(num_years * DP::N_SEX_MC * DP::N_AGE * DP::N_POP),
+		  partner_rate(num_years * DP::N_SEX * DP::N_AGE_ADULT * DP::N_POP),
+		  mix(DP::N_SEX * DP::N_AGE_ADULT * DP::N_SEX * DP::N_AGE_ADULT),
+		  assort(DP::N_SEX * DP::N_POP), pwid_force(num_years * DP::N_SEX), needle(num_years) {}
+};
+
+// Set up proj with owned population storage, demographic inputs from upd_filename,
+// and synthetic HIV and transmission inputs stored in inputs
+template<typename projection_t>
+void setup_synthetic_projection(projection_t& proj, SyntheticInputs& inputs, const std::string& upd_filename) {
+	auto& dat = proj.dat;
+	const int ny = proj.num_years();
+	int i, t, s, a, b, r, h, d, q;
+
+	proj.pop.allocate_storage();
+	proj.dth.allocate_storage();
+	proj.initialize(upd_filename);
+	dat.share_births(inputs.births.data());
+	dat.share_births_exposed(inputs.births_exposed.data());
+	dat.share_new_infections(inputs.new_hiv.data());
+
+	i = 0;
+	for (t = 0; t < ny; ++t)
+		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+			for (b = 0; b < DP::N_AGE_ADULT; ++b)
+				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+					const double base = (r == DP::POP_NOSEX ? 0.0 : r == DP::POP_UNION ? 0.3 : r >= DP::POP_KEY_MIN ? 4.0 + r : 1.2);
+					inputs.partner_rate[i++] = base * std::exp(-0.04 * b) * (1.0 + 0.1 * s);
+				}
+	dat.share_partner_rate(inputs.partner_rate.data());
+
+	// Partners are a few years older for women and younger for men
+	i = 0;
+	for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+		for (a = 0; a < DP::N_AGE_ADULT; ++a) {
+			double total(0.0);
+			for (int s2 = DP::SEX_MIN; s2 <= DP::SEX_MAX; ++s2)
+				for (int a2 = 0; a2 < DP::N_AGE_ADULT; ++a2) {
+					const double shift = (s == s2) ? 0.0 : (s == DP::FEMALE ? 3.0 : -3.0);
+					inputs.mix[i + s2 * DP::N_AGE_ADULT + a2] = std::exp(-std::pow((a2 - a - shift) / 6.0, 2));
+					total += inputs.mix[i + s2 * DP::N_AGE_ADULT + a2];
+				}
+			for (int k = 0; k < DP::N_SEX * DP::N_AGE_ADULT; ++k)
+				inputs.mix[i + k] /= total;
+			i += DP::N_SEX * DP::N_AGE_ADULT;
+		}
+	dat.share_age_mixing(inputs.mix.data());
+
+	for (i = 0; i < DP::N_SEX * DP::N_POP; ++i)
+		inputs.assort[i] = 0.2 + 0.05 * (i % DP::N_POP);
+	dat.share_pop_assortativity(inputs.assort.data());
+
+	for (t = 0; t < ny; ++t) {
+		inputs.pwid_force[DP::N_SEX * t + DP::FEMALE] = 0.01;
+		inputs.pwid_force[DP::N_SEX * t + DP::MALE] = 0.012;
+		inputs.needle[t] = 0.3;
+	}
+	dat.share_pwid_risk(inputs.pwid_force.data(), inputs.needle.data());
+
+	for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+		for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+			for (int s2 = DP::SEX_MIN; s2 <= DP::SEX_MAX; ++s2)
+				for (int r2 = DP::POP_MIN; r2 <= DP::POP_MAX; ++r2) {
+					int v(0);
+					if (r != DP::POP_NOSEX && r2 != DP::POP_NOSEX) {
+						if (s != s2) v = 1;
+						if (s == DP::MALE && s2 == DP::MALE && (r == DP::POP_MSM || r == DP::POP_TGW) && (r2 == DP::POP_MSM || r2 == DP::POP_TGW)) v = 2;
+						if (s != s2 && r == DP::POP_BOTH && (r2 == DP::POP_BOTH || r2 == DP::POP_NEVER || r2 == DP::POP_SPLIT)) v = 2;
+						if (s == DP::MALE && s2 == DP::FEMALE && r2 == DP::POP_FSW) v = 2;
+						if (s == DP::FEMALE && s2 == DP::FEMALE) v = 0;
+					}
+					dat.mix_structure(s, r, s2, r2, v);
+				}
+
+	for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
+		DP::init_sexual_debut(dat, s, 17.5 + s, 21.0 + 3 * s);
+		for (r = DP::POP_KEY_MIN; r < DP::N_POP_SEX[s]; ++r) {
+			dat.keypop_exit_prop(s, r, (r == DP::POP_PWID) ? 0.0 : 0.15);
+			dat.keypop_size(s, r, 0.01 + 0.002 * r);
+			dat.keypop_stay(s, r, r == DP::POP_MSM || r == DP::POP_TGW);
+			dat.keypop_married(s, r, 0.1);
+			DP::set_keypop_age(dat, s, static_cast<DP::pop_t>(r), std::log(10.0), 0.5);
+		}
+	}
+	DP::set_mean_union_duration(dat, 25.0);
+
+	dat.direct_incidence(false);
+	dat.seed_time(5);
+	dat.seed_prevalence(0.001);
+
+	for (q = 0; q < DP::N_BOND; ++q)
+		dat.sex_acts(q, q == DP::BOND_UNION ? 80 : q == DP::BOND_PAID ? 10 : 30);
+	for (t = 0; t < ny; ++t) {
+		for (q = 0; q < DP::N_BOND; ++q)
+			dat.condom_freq(t, q, std::min(0.8, 0.01 * t * (q + 1)));
+		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+			for (b = 0; b < DP::N_AGE_ADULT; ++b)
+				for (r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+					dat.sti_prev(t, s, b, r, 0.02 + 0.01 * (r >= DP::POP_KEY_MIN) + 0.001 * (b % 7));
+		for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+			dat.uptake_male_circumcision(t, a, a < 20 ? 0.005 : 0.0);
+	}
+	DP::set_transmission(dat, 0.0019, 1.9, 10.0, 9.2, 1.0, 7.3, 0.04, 0.52, 2.5, 2.5);
+	dat.effect_vmmc(0.6);
+	dat.effect_condom(0.8);
+
+	for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+		for (a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a) {
+			const double dist[DP::N_HIV_ADULT] = {0.0, 0.6, 0.25, 0.1, 0.03, 0.01, 0.01};
+			const double prog[DP::N_HIV_ADULT] = {4.0, 0.15, 0.2, 0.25, 0.4, 0.6, 0.0};
+			const double mort[DP::N_HIV_ADULT] = {0.0, 0.005, 0.01, 0.02, 0.08, 0.2, 0.5};
+			for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+				dat.hiv_dist(s, a, h, dist[h]);
+				dat.hiv_prog(s, a, h, prog[h] * (1.0 + 0.005 * a));
+				dat.hiv_mort(s, a, h, mort[h] * (1.0 + 0.01 * a));
+			}
+		}
+
+	for (t = 0; t < ny; ++t) {
+		const int year = proj.year_first() + t;
+		for (s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
+			dat.art_num_adult(t, s, year >= 2004 && year < 2010 ? 2000.0 * (year - 2003) * (1 + s) : 0.0);
+			dat.art_prop_adult(t, s, year >= 2010 ? std::min(0.9, 0.3 + 0.04 * (year - 2010)) : 0.0);
+			dat.art_exit_adult(t, s, 0.05);
+			for (b = 0; b < DP::N_AGE_ADULT; ++b) {
+				dat.art_suppressed_adult(t, s, b, 0.8);
+				for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+					for (d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d)
+						dat.art_mort_adult(t, s, b, h, d, 0.01 * (h + 1) / (d - 2));
+			}
+		}
+		dat.art_first_eligible_stage_adult(t, year < 2010 ? DP::HIV_100_200 : year < 2016 ? DP::HIV_350_500 : DP::HIV_PRIMARY);
+		for (b = 0; b < DP::N_AGE_BIRTH; ++b)
+			dat.frr_age_no_art(t, b, 0.8);
+	}
+	dat.art_mort_weight(0.5);
+	for (b = 0; b < DP::N_AGE_BIRTH; ++b)
+		dat.frr_age_on_art(b, 0.9);
+	for (h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+		dat.frr_cd4_no_art(h, 1.0 - 0.1 * h);
+}
+
+#endif // TESTS_SYNTHETIC_PROJECTION_H
@@ -1,10 +1,18 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <vector>
 #include <GoalsARM.h>
+#include "synthetic_projection.h"
 
-void setup_projection(DP::Projection& proj) {
+template<typename projection_t>
+void setup_projection(projection_t& proj) {
 	constexpr double tfr(7.33), srb(101.4);
 	constexpr double pasfrs[DP::N_AGE_BIRTH] = {
 		0.0271, 0.0271, 0.0271, 0.0271, 0.0271,
@@ -111,6 +119,14 @@ TEST_CASE("test births", "[births]") {
 
 	births = proj.calc_births(year_final - year_first);
 	REQUIRE( fabs(births - target_births) < tolerance );
+
+	// Fertility does not depend on the CD4 scheme, and both schemes can be used in one program
+	DP::ProjectionSpectrumCD4 proj_spectrum(year_first, year_final);
+	proj_spectrum.pop.share_storage(adult_neg.data(), adult_hiv.data(), child_neg.data(), child_hiv.data());
+	setup_projection(proj_spectrum);
+
+	births = proj_spectrum.calc_births(year_final - year_first);
+	REQUIRE( fabs(births - target_births) < tolerance );
 }
 
 TEST_CASE("test births HIV exposed", "[births]") {
@@ -135,3 +151,879 @@ TEST_CASE("test births HIV exposed", "[births]") {
 	births = proj.calc_births_hiv_exposed(year_final - year_first);
 	REQUIRE( fabs(births - target_births) < tolerance );
 }
+
+TEST_CASE("test owned population storage", "[population]") {
+	constexpr int year_first(1970), year_final(1971);
+	constexpr double target_births(251855), tolerance(0.5);
+	constexpr std::size_t alignment(DP::Population::ALIGNMENT);
+
+	DP::Projection proj(year_first, year_final);
+	proj.pop.allocate_storage();
+	REQUIRE( proj.pop.owns_storage() );
+	REQUIRE( proj.pop.adult_hiv_stride(3) % (alignment / sizeof(double)) == 0 );
+	REQUIRE( proj.pop.adult_hiv_stride(3) >= DP::N_HIV_ADULT * DP::N_DTX );
+
+	// Each adult HIV block and each array starts on an aligned boundary
+	for (int b = 0; b < DP::N_AGE_ADULT; ++b)
+		for (int r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+			REQUIRE( reinterpret_cast<std::uintptr_t>(&proj.pop.adult_hiv(1, DP::FEMALE, b, r, 0, 0)) % alignment == 0 );
+	REQUIRE( reinterpret_cast<std::uintptr_t>(&proj.pop.adult_neg(0, 0, 0, 0)) % alignment == 0 );
+	REQUIRE( reinterpret_cast<std::uintptr_t>(&proj.pop.child_neg(0, 0, 0)) % alignment == 0 );
+	REQUIRE( reinterpret_cast<std::uintptr_t>(&proj.pop.child_hiv(0, 0, 0, 0, 0)) % alignment == 0 );
+
+	setup_projection(proj);
+	REQUIRE( fabs(proj.calc_births(year_final - year_first) - target_births) < tolerance );
+}
+
+TEST_CASE("test rolling population storage", "[population]") {
+	constexpr int year_first(1970), year_final(2100);
+	constexpr double target_births(251855), tolerance(0.5);
+
+	// Only two years are stored however long the projection
+	DP::Projection proj(year_first, year_final);
+	proj.pop.allocate_rolling_storage();
+	REQUIRE( proj.pop.rolling() );
+	REQUIRE( proj.pop.num_slots() == 2 );
+	REQUIRE( &proj.pop.adult_hiv(2, DP::FEMALE, 5, DP::POP_NOSEX, 1, 0) == &proj.pop.adult_hiv(0, DP::FEMALE, 5, DP::POP_NOSEX, 1, 0) );
+	REQUIRE( &proj.pop.adult_neg(3, DP::MALE_C, 5, DP::POP_NOSEX) != &proj.pop.adult_neg(2, DP::MALE_C, 5, DP::POP_NOSEX) );
+
+	// Births in year 1 only use years 0 and 1
+	setup_projection(proj);
+	REQUIRE( fabs(proj.calc_births(1) - target_births) < tolerance );
+
+	// Clearing year 2 overwrites year 0 and leaves year 1
+	proj.pop.clear_year(2);
+	REQUIRE( proj.pop.adult_neg(0, DP::FEMALE, 5, DP::POP_NOSEX) == 0.0 );
+	REQUIRE( proj.pop.adult_neg(1, DP::FEMALE, 5, DP::POP_NOSEX) > 0.0 );
+
+	proj.pop.allocate_storage();
+	REQUIRE( !proj.pop.rolling() );
+	REQUIRE( proj.pop.num_slots() == year_final - year_first + 1 );
+}
+
+// Project the synthetic epidemic with projection type projection_t, and store
+// population sizes by sex and age and new infections by sex, circumcision
+// status, age and risk group in the final year in out
+template<typename projection_t>
+void project_synthetic(const int year_first, const int year_final, const std::string& upd_filename, std::vector<double>& out) {
+	projection_t proj(year_first, year_final);
+	SyntheticInputs inputs(proj.num_years());
+	const int t(year_final - year_first);
+	setup_synthetic_projection(proj, inputs, upd_filename);
+	proj.project(year_final);
+
+	out.clear();
+	for (int s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+		for (int a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+			out.push_back(proj.dat.popsize(t, s, a));
+	for (int u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+		for (int a = DP::AGE_ADULT_MIN; a <= DP::AGE_ADULT_MAX; ++a)
+			for (int r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+				out.push_back(proj.dat.new_hiv_infections(t, u, a, r));
+}
+
+TEST_CASE("test HIV storage layouts", "[population]") {
+	constexpr int year_first(1970), year_final(1985);
+	const std::string upd_filename("test_layouts.upd");
+	typedef DP::ProjectionT<DP::ProjectionOptions<DP::CD4_SCHEME_DEFAULT, DP::INCIDENCE_RUNTIME, 0, true, DP::HIV_LAYOUT_CELL_MAJOR>> cell_major_t;
+	typedef DP::ProjectionT<DP::ProjectionOptions<DP::CD4_SCHEME_DEFAULT, DP::INCIDENCE_RUNTIME, 0, true, DP::HIV_LAYOUT_CARE_MAJOR>> care_major_t;
+	std::vector<double> compartment, cell_major, care_major;
+
+	// Layouts only change where values are stored, so results are identical
+	write_synthetic_upd(upd_filename);
+	project_synthetic<DP::Projection>(year_first, year_final, upd_filename, compartment);
+	project_synthetic<cell_major_t>(year_first, year_final, upd_filename, cell_major);
+	project_synthetic<care_major_t>(year_first, year_final, upd_filename, care_major);
+	std::remove(upd_filename.c_str());
+
+	REQUIRE( std::accumulate(compartment.begin() + DP::N_SEX * DP::N_AGE, compartment.end(), 0.0) > 0.0 );
+	REQUIRE( cell_major == compartment );
+	REQUIRE( care_major == compartment );
+}
+
+// Sum adults living with HIV in year t
+template<typename projection_t>
+double adults_with_hiv(const projection_t& proj, const int t) {
+	double total(0.0);
+	for (int u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+		for (int b = 0; b < DP::N_AGE_ADULT; ++b)
+			for (int r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+				for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+					for (int d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d)
+						total += proj.pop.adult_hiv(t, u, b, r, h, d);
+	return total;
+}
+
+enum projection_total_t {TOTAL_BIRTHS, TOTAL_POPSIZE, TOTAL_PLHIV, TOTAL_ART, TOTAL_NEW_HIV, N_TOTAL};
+
+// Totals in year t of births, population size, adults living with HIV, adults
+// on ART and new adult infections, indexed by projection_total_t
+template<typename projection_t>
+std::vector<double> projection_totals(const projection_t& proj, const int t) {
+	std::vector<double> total(N_TOTAL, 0.0);
+	for (int s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s) {
+		total[TOTAL_BIRTHS] += proj.dat.births(t, s);
+		for (int a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+			total[TOTAL_POPSIZE] += proj.dat.popsize(t, s, a);
+	}
+	total[TOTAL_PLHIV] = adults_with_hiv(proj, t);
+	for (int u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+		for (int r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+			for (int b = 0; b < DP::N_AGE_ADULT; ++b)
+				for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+					for (int d = DP::DTX_ART_MIN; d <= DP::DTX_ART_MAX; ++d)
+						total[TOTAL_ART] += proj.pop.adult_hiv(t, u, b, r, h, d);
+			for (int a = DP::AGE_ADULT_MIN; a <= DP::AGE_ADULT_MAX; ++a)
+				total[TOTAL_NEW_HIV] += proj.dat.new_hiv_infections(t, u, a, r);
+		}
+	return total;
+}
+
+TEST_CASE("test synthetic projection reference values", "[regression]") {
+	constexpr int year_first(1970), year_final(2010);
+	constexpr double tolerance(1e-12); // relative
+	const std::string upd_filename("test_reference.upd");
+
+	// Population size, adults living with HIV, adults on ART and new adult
+	// infections in 1980, 1990, 2000 and 2010, calculated with the projection
+	// code before transmission was cached by year
+	const int years[] = {1980, 1990, 2000, 2010};
+	const double reference[][4] = {
+		{3945732.3097473439, 92716.932653652635, 0.0, 28730.675544367987},
+		{5409955.7997018639, 347011.63864738564, 0.0, 47312.718999414341},
+		{7142955.1856489237, 670342.79298442369, 0.0, 79535.003591942572},
+		{9227892.6482320391, 1049592.5885232619, 220105.5258467306, 92375.620281833137}};
+
+	write_synthetic_upd(upd_filename);
+	DP::Projection proj(year_first, year_final);
+	SyntheticInputs inputs(proj.num_years());
+	setup_synthetic_projection(proj, inputs, upd_filename);
+	std::remove(upd_filename.c_str());
+	proj.project(year_final);
+
+	for (int i = 0; i < 4; ++i) {
+		const std::vector<double> total(projection_totals(proj, years[i] - year_first));
+		const int k[] = {TOTAL_POPSIZE, TOTAL_PLHIV, TOTAL_ART, TOTAL_NEW_HIV};
+		for (int j = 0; j < 4; ++j)
+			REQUIRE( fabs(total[k[j]] - reference[i][j]) <= tolerance * reference[i][j] );
+	}
+}
+
+TEST_CASE("test projection options", "[options]") {
+	constexpr int year_first(1970), year_final(2008), year_seed(1975), steps(4);
+	constexpr int time_final(year_final - year_first), time_seed(year_seed - year_first);
+	constexpr double tolerance(1e-12);
+	const std::string upd_filename("test_options.upd");
+	typedef DP::ProjectionT<DP::ProjectionOptions<DP::CD4_SCHEME_DEFAULT, DP::INCIDENCE_RUNTIME, 0, false>> no_keypops_t;
+	typedef DP::ProjectionT<DP::ProjectionOptions<DP::CD4_SCHEME_DEFAULT, DP::INCIDENCE_RUNTIME, steps>> fixed_steps_t;
+
+	write_synthetic_upd(upd_filename);
+	DP::Projection proj(year_first, year_final);
+	DP::ProjectionSpectrumCD4 proj_spectrum(year_first, year_final);
+	no_keypops_t proj_no_keypops(year_first, year_final);
+	fixed_steps_t proj_fixed(year_first, year_final);
+	DP::Projection proj_runtime(year_first, year_final);
+	SyntheticInputs inputs(proj.num_years()), inputs_spectrum(proj.num_years()), inputs_no_keypops(proj.num_years());
+	SyntheticInputs inputs_fixed(proj.num_years()), inputs_runtime(proj.num_years());
+	setup_synthetic_projection(proj, inputs, upd_filename);
+	setup_synthetic_projection(proj_spectrum, inputs_spectrum, upd_filename);
+	setup_synthetic_projection(proj_no_keypops, inputs_no_keypops, upd_filename);
+	setup_synthetic_projection(proj_fixed, inputs_fixed, upd_filename);
+	setup_synthetic_projection(proj_runtime, inputs_runtime, upd_filename);
+	std::remove(upd_filename.c_str());
+
+	proj.project(year_final);
+	proj_spectrum.project(year_final);
+	proj_no_keypops.project(year_final);
+
+	// The CD4 scheme changes the stages people return to after leaving ART, so
+	// people living with HIV differ once ART starts
+	const double plhiv(adults_with_hiv(proj, time_final)), plhiv_spectrum(adults_with_hiv(proj_spectrum, time_final));
+	REQUIRE( std::isfinite(plhiv_spectrum) );
+	REQUIRE( plhiv_spectrum > 0.0 );
+	REQUIRE( plhiv_spectrum != plhiv );
+	for (int s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+		for (int a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+			REQUIRE( std::isfinite(proj_spectrum.dat.popsize(time_final, s, a)) );
+
+	// Without key populations, nobody enters key population risk groups
+	bool empty(true);
+	for (int t = 0; t <= time_final; ++t)
+		for (int u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+			for (int b = 0; b < DP::N_AGE_ADULT; ++b)
+				for (int r = DP::POP_KEY_MIN; r <= DP::POP_MAX; ++r) {
+					empty = empty && proj_no_keypops.pop.adult_neg(t, u, b, r) == 0.0;
+					for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+						for (int d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d)
+							empty = empty && proj_no_keypops.pop.adult_hiv(t, u, b, r, h, d) == 0.0;
+				}
+	REQUIRE( empty );
+	REQUIRE( adults_with_hiv(proj_no_keypops, time_final) > 0.0 );
+
+	// Key populations only divide adults between risk groups, so population
+	// sizes are the same as with key populations until HIV is seeded
+	for (int s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+		for (int a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+			REQUIRE( fabs(proj_no_keypops.dat.popsize(time_seed - 1, s, a) - proj.dat.popsize(time_seed - 1, s, a)) <= tolerance * proj.dat.popsize(time_seed - 1, s, a) );
+
+	// A fixed number of HIV time steps gives the same results as the same number set at run time
+	proj_runtime.dat.hiv_time_steps(steps);
+	proj_fixed.dat.hiv_time_steps(steps + 1); // ignored
+	REQUIRE( proj_fixed.hiv_time_steps() == steps );
+	REQUIRE_THROWS_AS( proj_runtime.dat.hiv_time_steps(0), std::invalid_argument );
+	REQUIRE_THROWS_AS( proj_runtime.dat.hiv_time_steps(-2), std::invalid_argument );
+	REQUIRE( proj_runtime.dat.hiv_time_steps() == steps );
+	proj_fixed.project(year_final);
+	proj_runtime.project(year_final);
+	REQUIRE( adults_with_hiv(proj_fixed, time_final) == adults_with_hiv(proj_runtime, time_final) );
+	REQUIRE( adults_with_hiv(proj_fixed, time_final) != plhiv );
+	for (int s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+		for (int a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+			REQUIRE( proj_fixed.dat.popsize(time_final, s, a) == proj_runtime.dat.popsize(time_final, s, a) );
+	REQUIRE( proj_fixed.dat.new_hiv_infections(time_final, DP::FEMALE, 20, DP::POP_NEVER) == proj_runtime.dat.new_hiv_infections(time_final, DP::FEMALE, 20, DP::POP_NEVER) );
+}
+
+TEST_CASE("test annual risk group mixing balance", "[transmission]") {
+	constexpr int year_first(1970), year_final(2010), year_from(1980);
+	constexpr double tolerance(0.01); // relative to balancing every step
+	const std::string upd_filename("test_mix_annual.upd");
+
+	write_synthetic_upd(upd_filename);
+	DP::Projection proj(year_first, year_final);
+	DP::Projection annual(year_first, year_final);
+	SyntheticInputs inputs(proj.num_years()), inputs_annual(annual.num_years());
+	setup_synthetic_projection(proj, inputs, upd_filename);
+	setup_synthetic_projection(annual, inputs_annual, upd_filename);
+	std::remove(upd_filename.c_str());
+	annual.dat.mix_balance_annual(true);
+	proj.project(year_final);
+	annual.project(year_final);
+
+	// Balancing risk group mixing once a year changes new infections by about 0.1%
+	for (int t = year_from - year_first; t < proj.num_years(); ++t) {
+		const std::vector<double> total(projection_totals(proj, t)), total_annual(projection_totals(annual, t));
+		for (const int k : {TOTAL_PLHIV, TOTAL_NEW_HIV}) {
+			REQUIRE( std::isfinite(total_annual[k]) );
+			REQUIRE( fabs(total_annual[k] - total[k]) <= tolerance * total[k] );
+		}
+	}
+	REQUIRE( projection_totals(annual, proj.num_years() - 1)[TOTAL_NEW_HIV] != projection_totals(proj, proj.num_years() - 1)[TOTAL_NEW_HIV] );
+}
+
+TEST_CASE("test exponential HIV integrator", "[options]") {
+	constexpr int year_first(1970), year_final(2010), year_from(1990), steps(4);
+	constexpr double tolerance(0.1); // relative to 10 Euler steps per year
+	const std::string upd_filename("test_integrator.upd");
+
+	write_synthetic_upd(upd_filename);
+	DP::Projection proj(year_first, year_final);
+	DP::Projection expo(year_first, year_final);
+	SyntheticInputs inputs(proj.num_years()), inputs_expo(expo.num_years());
+	setup_synthetic_projection(proj, inputs, upd_filename);
+	setup_synthetic_projection(expo, inputs_expo, upd_filename);
+	std::remove(upd_filename.c_str());
+	expo.dat.hiv_integrator(DP::INTEGRATOR_EXPONENTIAL);
+	expo.dat.hiv_time_steps(steps);
+	REQUIRE( proj.dat.hiv_time_steps() == DP::HIV_TIME_STEPS );
+	proj.project(year_final);
+	expo.project(year_final);
+
+	// Every compartment stays finite and non-negative with four exponential steps
+	double value_min(0.0);
+	bool finite(true);
+	for (int t = 0; t < expo.num_years(); ++t)
+		for (int u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+			for (int b = 0; b < DP::N_AGE_ADULT; ++b)
+				for (int r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+					for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+						for (int d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d) {
+							finite = finite && std::isfinite(expo.pop.adult_hiv(t, u, b, r, h, d));
+							value_min = std::min(value_min, expo.pop.adult_hiv(t, u, b, r, h, d));
+						}
+	REQUIRE( finite );
+	REQUIRE( value_min >= 0.0 );
+
+	// Totals are within 10% of the default 10 Euler steps from 1990. The largest
+	// differences in this projection were 5.5% for PLHIV and 4.2% for new infections
+	for (int t = year_from - year_first; t < proj.num_years(); ++t) {
+		const std::vector<double> total(projection_totals(proj, t)), total_expo(projection_totals(expo, t));
+		for (const int k : {TOTAL_POPSIZE, TOTAL_PLHIV, TOTAL_ART, TOTAL_NEW_HIV}) {
+			REQUIRE( std::isfinite(total_expo[k]) );
+			REQUIRE( fabs(total_expo[k] - total[k]) <= tolerance * total[k] );
+		}
+	}
+}
+
+TEST_CASE("test grouped transmission", "[transmission]") {
+	constexpr int year_first(1970), year_final(2010), year_from(1980);
+	constexpr double tolerance_new_hiv(0.02), tolerance_plhiv(0.01); // README: 1.7% and 0.8% with 5-year bands
+	const std::string upd_filename("test_band.upd");
+	std::vector<double> out, out_band;
+
+	write_synthetic_upd(upd_filename);
+	DP::Projection proj(year_first, year_final);
+	DP::Projection band(year_first, year_final);
+	SyntheticInputs inputs(proj.num_years()), inputs_band(band.num_years());
+	setup_synthetic_projection(proj, inputs, upd_filename);
+	setup_synthetic_projection(band, inputs_band, upd_filename);
+	std::remove(upd_filename.c_str());
+	REQUIRE( proj.dat.transmission_age_band() == 1 );
+	proj.project(year_final);
+
+	// 5-year bands stay within the accuracy reported in the README from 1980
+	band.dat.transmission_age_band(5);
+	band.project(year_final);
+	for (int t = year_from - year_first; t < proj.num_years(); ++t) {
+		const std::vector<double> total(projection_totals(proj, t)), total_band(projection_totals(band, t));
+		REQUIRE( fabs(total_band[TOTAL_NEW_HIV] - total[TOTAL_NEW_HIV]) <= tolerance_new_hiv * total[TOTAL_NEW_HIV] );
+		REQUIRE( fabs(total_band[TOTAL_PLHIV] - total[TOTAL_PLHIV]) <= tolerance_plhiv * total[TOTAL_PLHIV] );
+	}
+	REQUIRE( projection_totals(band, proj.num_years() - 1)[TOTAL_NEW_HIV] != projection_totals(proj, proj.num_years() - 1)[TOTAL_NEW_HIV] );
+
+	// Returning to 1-year bands gives the default projection exactly
+	band.dat.transmission_age_band(1);
+	band.project(year_final);
+	for (int t = 0; t < proj.num_years(); ++t) {
+		for (int s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+			for (int a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a) {
+				out.push_back(proj.dat.popsize(t, s, a));
+				out_band.push_back(band.dat.popsize(t, s, a));
+			}
+		for (int u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+			for (int a = DP::AGE_ADULT_MIN; a <= DP::AGE_ADULT_MAX; ++a)
+				for (int r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+					out.push_back(proj.dat.new_hiv_infections(t, u, a, r));
+					out_band.push_back(band.dat.new_hiv_infections(t, u, a, r));
+				}
+	}
+	REQUIRE( out_band == out );
+}
+
+TEST_CASE("test certain transmission per act", "[transmission]") {
+	constexpr int year_first(1970), year_final(1971);
+	const std::string upd_filename("test_transmission.upd");
+	DP::TransmissionCache cache;
+
+	write_synthetic_upd(upd_filename);
+	DP::Projection proj(year_first, year_final);
+	SyntheticInputs inputs(proj.num_years());
+	setup_synthetic_projection(proj, inputs, upd_filename);
+	std::remove(upd_filename.c_str());
+
+	// A per-act risk of 1 gives finite log escape probabilities, so partnerships
+	// without sex acts, or without acts of one kind, do not give NaN
+	proj.dat.hiv_risk_per_act(DP::FEMALE, DP::MALE, DP::STAGE_PRIMARY, DP::VL_OFF_ART, 1.0);
+	proj.dat.effect_condom(1.0);
+	proj.dat.sex_acts(DP::BOND_PAID, 0);
+	proj.dat.condom_freq(0, DP::BOND_CASUAL, 0.0);
+	proj.dat.condom_freq(0, DP::BOND_UNION, 1.0);
+	REQUIRE( std::isfinite(proj.dat.log_escape(DP::FEMALE, DP::MALE, DP::STAGE_PRIMARY, DP::VL_OFF_ART, DP::STI_NONE)) );
+	REQUIRE( std::isfinite(proj.dat.log_escape_condom(DP::FEMALE, DP::MALE, DP::STAGE_PRIMARY, DP::VL_OFF_ART, DP::STI_BOTH)) );
+
+	cache.update(proj.dat, 0);
+	for (int z = 0; z < DP::N_STI; ++z) {
+		REQUIRE( cache.ptransmit(DP::FEMALE, DP::MALE, DP::BOND_PAID, DP::STAGE_PRIMARY, DP::VL_OFF_ART, z) == 0.0 );
+		REQUIRE( cache.ptransmit(DP::FEMALE, DP::MALE, DP::BOND_CASUAL, DP::STAGE_PRIMARY, DP::VL_OFF_ART, z) == 1.0 );
+		REQUIRE( cache.ptransmit(DP::FEMALE, DP::MALE, DP::BOND_UNION, DP::STAGE_PRIMARY, DP::VL_OFF_ART, z) == 1.0 );
+	}
+}
+
+TEST_CASE("test indicator sink", "[outputs]") {
+	constexpr int year_first(1970), year_final(1971), num_years(2);
+	constexpr double tolerance(1e-12), new_hiv(10.0);
+	double hiv_neg_start(0.0), hiv_pos(0.0), hiv_neg(0.0);
+
+	boost::multi_array<double, 4> new_infections(boost::extents[num_years][DP::N_SEX_MC][DP::N_AGE][DP::N_POP]);
+	std::fill_n(new_infections.data(), new_infections.num_elements(), 0.0);
+
+	DP::Projection proj(year_first, year_final);
+	proj.pop.allocate_storage();
+	proj.dat.share_new_infections(new_infections.data());
+	setup_projection(proj);
+	for (int a = DP::AGE_ADULT_MIN; a < 25; ++a)
+		proj.dat.new_hiv_infections(1, DP::FEMALE, a, DP::POP_NOSEX, new_hiv);
+
+	DP::IndicatorSink<DP::Projection> sink(num_years);
+	sink.record(proj, 1);
+	REQUIRE( sink.num_groups() == 4 );
+
+	// Women aged 15-24
+	for (int b = 0; b < 10; ++b) {
+		hiv_neg_start += proj.pop.adult_neg(0, DP::FEMALE, b, DP::POP_NOSEX);
+		hiv_neg += proj.pop.adult_neg(1, DP::FEMALE, b, DP::POP_NOSEX);
+		for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+			for (int d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d)
+				hiv_pos += proj.pop.adult_hiv(1, DP::FEMALE, b, DP::POP_NOSEX, h, d);
+	}
+	REQUIRE( fabs(sink.popsize(1, DP::FEMALE, 0) / (hiv_neg + hiv_pos) - 1.0) < tolerance );
+	REQUIRE( fabs(sink.prevalence(1, DP::FEMALE, 0) - hiv_pos / (hiv_neg + hiv_pos)) < tolerance );
+	REQUIRE( fabs(sink.incidence(1, DP::FEMALE, 0) - 10.0 * new_hiv / hiv_neg_start) < tolerance );
+	REQUIRE( sink.incidence(1, DP::FEMALE, 1) == 0.0 );
+
+	// setup_projection puts 40% of women living with HIV on ART, and no men in the population
+	for (int g = 0; g < 3; ++g)
+		REQUIRE( fabs(sink.art_coverage(1, DP::FEMALE, g) - 0.4) < tolerance );
+	REQUIRE( sink.popsize(1, DP::FEMALE, 3) == 0.0 );
+	REQUIRE( sink.prevalence(1, DP::FEMALE, 3) == 0.0 );
+	REQUIRE( sink.popsize(1, DP::MALE, 0) == 0.0 );
+
+	REQUIRE_THROWS( DP::IndicatorSink<DP::Projection>(num_years, {20, 30}) );
+	REQUIRE_THROWS( DP::IndicatorSink<DP::Projection>(num_years, {15, 30, 30}) );
+}
+
+TEST_CASE("test projection snapshots", "[snapshot]") {
+	constexpr int year_first(1970), year_final(1981), year_snapshot(1978);
+	constexpr int time_snapshot(year_snapshot - year_first), time_final(year_final - year_first);
+	const std::string upd_filename("test_snapshot.upd");
+	std::stringstream snapshot;
+
+	write_synthetic_upd(upd_filename);
+	DP::Projection proj(year_first, year_final);
+	DP::Projection copy(year_first, year_final);
+	DP::Projection restored(year_first, year_final);
+	SyntheticInputs inputs(proj.num_years()), inputs_copy(copy.num_years()), inputs_restored(restored.num_years());
+	setup_synthetic_projection(proj, inputs, upd_filename);
+	setup_synthetic_projection(copy, inputs_copy, upd_filename);
+	setup_synthetic_projection(restored, inputs_restored, upd_filename);
+	std::remove(upd_filename.c_str());
+	copy.pop.allocate_rolling_storage();
+	copy.dth.allocate_rolling_storage();
+
+	REQUIRE( proj.save_snapshot(snapshot) == DP::SNAPSHOT_NOT_PROJECTED );
+	proj.project(year_snapshot);
+	REQUIRE( proj.save_snapshot(snapshot) == DP::SNAPSHOT_OK );
+
+	// Inputs after the snapshot year may differ
+	copy.dat.condom_freq(time_snapshot + 1, DP::BOND_UNION, 0.5);
+	REQUIRE( copy.dat.input_hash(time_snapshot) == proj.dat.input_hash(time_snapshot) );
+	REQUIRE( copy.dat.input_hash(time_final) != proj.dat.input_hash(time_final) );
+	REQUIRE( copy.load_snapshot(snapshot) == DP::SNAPSHOT_OK );
+	REQUIRE( copy.pop.adult_hiv(time_snapshot, DP::FEMALE, 10, DP::POP_NEVER, DP::HIV_GEQ_500, DP::DTX_UNAWARE) > 0.0 );
+	REQUIRE( copy.pop.adult_hiv(time_snapshot, DP::FEMALE, 10, DP::POP_NEVER, DP::HIV_GEQ_500, DP::DTX_UNAWARE)
+	      == proj.pop.adult_hiv(time_snapshot, DP::FEMALE, 10, DP::POP_NEVER, DP::HIV_GEQ_500, DP::DTX_UNAWARE) );
+	REQUIRE( copy.dat.births(time_snapshot, DP::MALE) == proj.dat.births(time_snapshot, DP::MALE) );
+	snapshot.clear();
+	snapshot.seekg(0);
+	REQUIRE( restored.load_snapshot(snapshot) == DP::SNAPSHOT_OK );
+
+	// Resuming from the snapshot gives the same results as resuming in the original projection
+	proj.dat.condom_freq(time_snapshot + 1, DP::BOND_UNION, 0.5);
+	proj.project(year_final);
+	copy.project(year_final);
+	for (int s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+		for (int a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+			REQUIRE( copy.dat.popsize(time_final, s, a) == proj.dat.popsize(time_final, s, a) );
+	REQUIRE( copy.dat.new_hiv_infections(time_final, DP::MALE_U, 25, DP::POP_NEVER) == proj.dat.new_hiv_infections(time_final, DP::MALE_U, 25, DP::POP_NEVER) );
+
+	// Inputs through the snapshot year must match
+	snapshot.clear();
+	snapshot.seekg(0);
+	copy.dat.condom_freq(time_snapshot, DP::BOND_UNION, 0.5);
+	REQUIRE( copy.load_snapshot(snapshot) == DP::SNAPSHOT_INPUT_MISMATCH );
+
+	// Changing inputs in the snapshot year restarts from the first year, since
+	// earlier years were not restored
+	std::stringstream earlier;
+	restored.invalidate(year_snapshot - 1);
+	REQUIRE( restored.save_snapshot(earlier) == DP::SNAPSHOT_NOT_PROJECTED );
+	proj.dat.condom_freq(time_snapshot, DP::BOND_UNION, 0.5);
+	proj.project(year_final);
+	restored.dat.condom_freq(time_snapshot, DP::BOND_UNION, 0.5);
+	restored.dat.condom_freq(time_snapshot + 1, DP::BOND_UNION, 0.5);
+	restored.project(year_final);
+	for (int s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+		for (int a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+			REQUIRE( restored.dat.popsize(time_final, s, a) == proj.dat.popsize(time_final, s, a) );
+	REQUIRE( restored.dat.new_hiv_infections(time_snapshot, DP::MALE_U, 25, DP::POP_NEVER) == proj.dat.new_hiv_infections(time_snapshot, DP::MALE_U, 25, DP::POP_NEVER) );
+	REQUIRE( restored.dat.new_hiv_infections(time_final, DP::MALE_U, 25, DP::POP_NEVER) == proj.dat.new_hiv_infections(time_final, DP::MALE_U, 25, DP::POP_NEVER) );
+
+	// Projection years and storage type must match
+	DP::Projection shorter(year_first, year_final - 1);
+	snapshot.clear();
+	snapshot.seekg(0);
+	REQUIRE( shorter.load_snapshot(snapshot) == DP::SNAPSHOT_INCOMPATIBLE );
+
+	std::stringstream garbage("not a snapshot");
+	REQUIRE( copy.load_snapshot(garbage) == DP::SNAPSHOT_BAD_FORMAT );
+}
+
+TEST_CASE("test input change tracking", "[inputs]") {
+	constexpr int year_first(1970), year_final(1976), year_changed(1973);
+	constexpr int time_changed(year_changed - year_first), time_final(year_final - year_first);
+	const std::string upd_filename("test_changes.upd");
+
+	write_synthetic_upd(upd_filename);
+	DP::Projection proj(year_first, year_final);
+	DP::Projection fresh(year_first, year_final);
+	SyntheticInputs inputs(proj.num_years()), inputs_fresh(fresh.num_years());
+	setup_synthetic_projection(proj, inputs, upd_filename);
+	setup_synthetic_projection(fresh, inputs_fresh, upd_filename);
+	std::remove(upd_filename.c_str());
+
+	REQUIRE( proj.dat.changed_time() == 0 );
+	proj.project(year_final);
+	REQUIRE( proj.dat.changed_time() == DP::ModelData<double>::NO_CHANGE );
+
+	// Setting an input to its current value is not a change
+	proj.dat.condom_freq(time_changed, DP::BOND_UNION, proj.dat.condom_freq(time_changed, DP::BOND_UNION));
+	REQUIRE( proj.dat.changed_time() == DP::ModelData<double>::NO_CHANGE );
+
+	// The earliest changed year is recorded, and inputs without a time index change time 0
+	proj.dat.condom_freq(time_final, DP::BOND_UNION, 0.5);
+	proj.dat.condom_freq(time_changed, DP::BOND_UNION, 0.5);
+	REQUIRE( proj.dat.changed_time() == time_changed );
+	const double effect_condom(proj.dat.effect_condom());
+	proj.dat.effect_condom(0.5 * effect_condom);
+	REQUIRE( proj.dat.changed_time() == 0 );
+	proj.dat.effect_condom(effect_condom);
+	proj.dat.condom_freq(time_changed, DP::BOND_UNION, fresh.dat.condom_freq(time_changed, DP::BOND_UNION));
+	proj.dat.condom_freq(time_final, DP::BOND_UNION, fresh.dat.condom_freq(time_final, DP::BOND_UNION));
+	proj.dat.clear_changes();
+
+	// project() resumes from the changed year and matches a projection from scratch
+	proj.dat.condom_freq(time_changed, DP::BOND_UNION, 0.5);
+	proj.dat.condom_freq(time_final, DP::BOND_UNION, 0.5);
+	fresh.dat.condom_freq(time_changed, DP::BOND_UNION, 0.5);
+	fresh.dat.condom_freq(time_final, DP::BOND_UNION, 0.5);
+	proj.project(year_final);
+	fresh.project(year_final);
+	REQUIRE( proj.dat.changed_time() == DP::ModelData<double>::NO_CHANGE );
+	REQUIRE( proj.dat.new_hiv_infections(time_final, DP::MALE_U, 25, DP::POP_NEVER) > 0.0 );
+	for (int t = time_changed; t <= time_final; ++t)
+		REQUIRE( proj.dat.new_hiv_infections(t, DP::MALE_U, 25, DP::POP_NEVER) == fresh.dat.new_hiv_infections(t, DP::MALE_U, 25, DP::POP_NEVER) );
+	for (int s = DP::SEX_MIN; s <= DP::SEX_MAX; ++s)
+		for (int a = DP::AGE_MIN; a <= DP::AGE_MAX; ++a)
+			REQUIRE( proj.dat.popsize(time_final, s, a) == fresh.dat.popsize(time_final, s, a) );
+}
+
+TEST_CASE("test shared demographic inputs", "[inputs]") {
+	constexpr int year_first(1970), year_final(1980), time_changed(4);
+	const std::string upd_filename("test_demography.upd");
+
+	write_synthetic_upd(upd_filename);
+	auto demography = std::make_shared<DP::DemographyInputs>(year_first, year_final);
+	REQUIRE( demography->initialize(upd_filename) == 0 );
+	DP::ModelData<double> dat_upd(year_first, year_final);
+	dat_upd.initialize(upd_filename);
+	std::remove(upd_filename.c_str());
+
+	DP::ModelData<double> dat1(year_first, year_final), dat2(year_first, year_final);
+	dat1.share_demography(demography);
+	dat2.share_demography(demography);
+	REQUIRE( dat1.demography() == dat2.demography() );
+	REQUIRE( dat1.input_hash(year_final - year_first) == dat_upd.input_hash(year_final - year_first) );
+	REQUIRE( dat1.Sx(time_changed, DP::FEMALE, 30) == dat_upd.Sx(time_changed, DP::FEMALE, 30) );
+
+	// Setting a shared input copies the demography of that ModelData only
+	const double tfr(demography->tfr(time_changed));
+	dat1.clear_changes();
+	dat1.tfr(time_changed, tfr);
+	REQUIRE( dat1.demography() == dat2.demography() );
+	REQUIRE( dat1.changed_time() == DP::ModelData<double>::NO_CHANGE );
+	dat1.tfr(time_changed, tfr + 1.0);
+	REQUIRE( dat1.demography() != dat2.demography() );
+	REQUIRE( dat1.changed_time() == time_changed );
+	REQUIRE( dat1.tfr(time_changed) == tfr + 1.0 );
+	REQUIRE( dat2.tfr(time_changed) == tfr );
+	REQUIRE( demography->tfr(time_changed) == tfr );
+
+	DP::ModelData<double> dat_short(year_first, year_final - 1);
+	REQUIRE_THROWS( dat_short.share_demography(demography) );
+}
+
+TEST_CASE("test ensemble runner", "[ensemble]") {
+	typedef DP::EnsembleRunner<DP::Projection> runner_t;
+	constexpr int year_first(1970), year_final(1976), time_varied(3), num_members(4), num_threads(2);
+	const std::string upd_filename("test_ensemble.upd");
+	const int num_years(year_final - year_first + 1);
+	std::vector<SyntheticInputs> inputs(num_threads, SyntheticInputs(num_years));
+
+	// Members differ in condom use from time_varied onwards
+	auto member = [](DP::Projection& proj, const int m) {
+		for (int t = time_varied; t < proj.num_years(); ++t)
+			proj.dat.condom_freq(t, DP::BOND_CASUAL, 0.1 * m);
+	};
+	auto extract = [](const DP::Projection& proj, const int t, double* out) {
+		out[0] = proj.dat.new_hiv_infections(t, DP::MALE_U, 25, DP::POP_NEVER);
+		out[1] = proj.dat.popsize(t, DP::FEMALE, 30);
+	};
+
+	write_synthetic_upd(upd_filename);
+	runner_t runner(year_first, year_final, 2, [&](DP::Projection& proj, const int w) {
+		setup_synthetic_projection(proj, inputs[w], upd_filename);
+	}, num_threads);
+	REQUIRE( runner.num_threads() == num_threads );
+	runner.run(num_members, member, extract);
+	REQUIRE( runner.num_members() == num_members );
+
+	// Each member matches a projection run on its own
+	DP::Projection proj(year_first, year_final);
+	SyntheticInputs inputs_proj(num_years);
+	setup_synthetic_projection(proj, inputs_proj, upd_filename);
+	std::remove(upd_filename.c_str());
+	for (int m = 0; m < num_members; ++m) {
+		member(proj, m);
+		proj.project(year_final);
+		for (int t = 0; t < num_years; ++t) {
+			REQUIRE( runner.result(m, t, 0) == proj.dat.new_hiv_infections(t, DP::MALE_U, 25, DP::POP_NEVER) );
+			REQUIRE( runner.result(m, t, 1) == proj.dat.popsize(t, DP::FEMALE, 30) );
+		}
+	}
+	REQUIRE( runner.result(0, year_final - year_first, 0) != runner.result(num_members - 1, year_final - year_first, 0) );
+
+	// Populations can be extracted from workers with rolling storage, since each
+	// year is extracted as it is projected
+	auto extract_pop = [](const DP::Projection& proj, const int t, double* out) {
+		out[0] = proj.pop.adult_neg(t, DP::FEMALE, 10, DP::POP_NEVER);
+	};
+	std::vector<SyntheticInputs> inputs_rolling(num_threads, SyntheticInputs(num_years));
+	write_synthetic_upd(upd_filename);
+	runner_t rolling(year_first, year_final, 1, [&](DP::Projection& proj, const int w) {
+		setup_synthetic_projection(proj, inputs_rolling[w], upd_filename);
+		proj.pop.allocate_rolling_storage();
+		proj.dth.allocate_rolling_storage();
+	}, num_threads);
+	std::remove(upd_filename.c_str());
+	rolling.run(num_members, member, extract_pop);
+	for (int m = 0; m < num_members; ++m) {
+		member(proj, m);
+		proj.project(year_final);
+		for (int t = 0; t < num_years; ++t)
+			REQUIRE( rolling.result(m, t, 0) == proj.pop.adult_neg(t, DP::FEMALE, 10, DP::POP_NEVER) );
+	}
+	const runner_t::results_t full_rolling(rolling.results());
+	rolling.run_branches(year_first + time_varied, num_members, member, extract_pop);
+	REQUIRE( rolling.results() == full_rolling );
+
+	// Branching after the shared years gives the same results
+	const runner_t::results_t full(runner.results());
+	runner.run_branches(year_first + time_varied, num_members, member, extract);
+	REQUIRE( runner.results() == full );
+
+	// Exceptions thrown by members are passed to the caller
+	REQUIRE_THROWS( runner.run(num_members, [](DP::Projection&, const int m) {if (m == 2) throw std::runtime_error("member failed");}, extract) );
+	REQUIRE_THROWS_AS( runner.run_branches(year_first + time_varied + 1, num_members, member, extract), std::invalid_argument );
+	REQUIRE_THROWS_AS( runner.run_branches(year_first, num_members, member, extract), std::invalid_argument );
+	REQUIRE_THROWS( runner_t(year_first, year_final, 0, [](DP::Projection&, const int) {}, 1) );
+}
+
+TEST_CASE("test parallel strata", "[threads]") {
+	constexpr int year_first(1970), year_final(1977), num_threads(3);
+	const std::string upd_filename("test_parallel.upd");
+	GB::WorkStealingPool pool(num_threads);
+	REQUIRE( pool.num_threads() == num_threads );
+
+	// Every index is run exactly once, on a valid thread
+	std::vector<int> count(1000, 0);
+	pool.parallel_for(count.size(), [&](const int i, const int thread) {
+		count[i] += (thread >= 0 && thread < num_threads) ? 1 : 100;
+	});
+	REQUIRE( std::count(count.begin(), count.end(), 1) == static_cast<long>(count.size()) );
+
+	// Projections on the pool match serial projections exactly
+	write_synthetic_upd(upd_filename);
+	DP::Projection serial(year_first, year_final), parallel(year_first, year_final);
+	SyntheticInputs inputs_serial(serial.num_years()), inputs_parallel(parallel.num_years());
+	setup_synthetic_projection(serial, inputs_serial, upd_filename);
+	setup_synthetic_projection(parallel, inputs_parallel, upd_filename);
+	std::remove(upd_filename.c_str());
+	parallel.thread_pool(&pool);
+	serial.project(year_final);
+	parallel.project(year_final);
+
+	const int t(year_final - year_first);
+	bool same(true);
+	for (int u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u) {
+		for (int a = DP::AGE_CHILD_MIN; a <= DP::AGE_CHILD_MAX; ++a)
+			same = same && parallel.pop.child_neg(t, u, a) == serial.pop.child_neg(t, u, a);
+		for (int b = 0; b < DP::N_AGE_ADULT; ++b)
+			for (int r = DP::POP_MIN; r <= DP::POP_MAX; ++r) {
+				same = same && parallel.pop.adult_neg(t, u, b, r) == serial.pop.adult_neg(t, u, b, r);
+				for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h)
+					for (int d = DP::DTX_MIN; d <= DP::DTX_MAX; ++d)
+						same = same && parallel.pop.adult_hiv(t, u, b, r, h, d) == serial.pop.adult_hiv(t, u, b, r, h, d)
+						            && parallel.dth.adult_hiv(t, u, b, r, h, d) == serial.dth.adult_hiv(t, u, b, r, h, d);
+			}
+	}
+	REQUIRE( same );
+	REQUIRE( parallel.dat.new_hiv_infections(t, DP::FEMALE, 20, DP::POP_NEVER) > 0.0 );
+	REQUIRE( parallel.dat.new_hiv_infections(t, DP::FEMALE, 20, DP::POP_NEVER) == serial.dat.new_hiv_infections(t, DP::FEMALE, 20, DP::POP_NEVER) );
+
+	// The force of infection is split by blocks of ages, which must also match
+	// serial projections when ages are grouped into mixing bands
+	serial.dat.transmission_age_band(5);
+	parallel.dat.transmission_age_band(5);
+	REQUIRE_THROWS_AS( serial.dat.transmission_age_band(0), std::invalid_argument );
+	REQUIRE( serial.dat.transmission_age_band() == 5 );
+	serial.project(year_final);
+	parallel.project(year_final);
+	for (int u = DP::SEX_MC_MIN; u <= DP::SEX_MC_MAX; ++u)
+		for (int a = DP::AGE_ADULT_MIN; a <= DP::AGE_ADULT_MAX; ++a)
+			for (int r = DP::POP_MIN; r <= DP::POP_MAX; ++r)
+				same = same && parallel.dat.new_hiv_infections(t, u, a, r) == serial.dat.new_hiv_infections(t, u, a, r);
+	REQUIRE( same );
+}
+
+TEST_CASE("test births with single-precision storage", "[births]") {
+	constexpr int year_first(1970), year_final(1971), num_years(2);
+	constexpr double tolerance(1e-6); // relative to double-precision storage
+	double births, births_exposed;
+
+	boost::multi_array<double, 3> child_neg(boost::extents[num_years][DP::N_SEX_MC][DP::N_AGE_CHILD]);
+	boost::multi_array<double, 5> child_hiv(boost::extents[num_years][DP::N_SEX_MC][DP::N_AGE_CHILD][DP::N_HIV][DP::N_DTX]);
+	boost::multi_array<double, 4> adult_neg(boost::extents[num_years][DP::N_SEX_MC][DP::N_AGE_ADULT][DP::N_POP]);
+	boost::multi_array<double, 6> adult_hiv(boost::extents[num_years][DP::N_SEX_MC][DP::N_AGE_ADULT][DP::N_POP][DP::N_HIV][DP::N_DTX]);
+	boost::multi_array<float, 3> child_neg_flt(boost::extents[num_years][DP::N_SEX_MC][DP::N_AGE_CHILD]);
+	boost::multi_array<float, 5> child_hiv_flt(boost::extents[num_years][DP::N_SEX_MC][DP::N_AGE_CHILD][DP::N_HIV][DP::N_DTX]);
+	boost::multi_array<float, 4> adult_neg_flt(boost::extents[num_years][DP::N_SEX_MC][DP::N_AGE_ADULT][DP::N_POP]);
+	boost::multi_array<float, 6> adult_hiv_flt(boost::extents[num_years][DP::N_SEX_MC][DP::N_AGE_ADULT][DP::N_POP][DP::N_HIV][DP::N_DTX]);
+
+	std::fill_n(child_neg.data(), child_neg.num_elements(), 0.0);
+	std::fill_n(child_hiv.data(), child_hiv.num_elements(), 0.0);
+	std::fill_n(adult_neg.data(), adult_neg.num_elements(), 0.0);
+	std::fill_n(adult_hiv.data(), adult_hiv.num_elements(), 0.0);
+	std::fill_n(child_neg_flt.data(), child_neg_flt.num_elements(), 0.0f);
+	std::fill_n(child_hiv_flt.data(), child_hiv_flt.num_elements(), 0.0f);
+	std::fill_n(adult_neg_flt.data(), adult_neg_flt.num_elements(), 0.0f);
+	std::fill_n(adult_hiv_flt.data(), adult_hiv_flt.num_elements(), 0.0f);
+
+	DP::Projection proj(year_first, year_final);
+	proj.pop.share_storage(adult_neg.data(), adult_hiv.data(), child_neg.data(), child_hiv.data());
+	setup_projection(proj);
+	births = proj.calc_births(year_final - year_first);
+	births_exposed = proj.calc_births_hiv_exposed(year_final - year_first);
+
+	DP::ProjectionFloat proj_flt(year_first, year_final);
+	proj_flt.pop.share_storage(adult_neg_flt.data(), adult_hiv_flt.data(), child_neg_flt.data(), child_hiv_flt.data());
+	setup_projection(proj_flt);
+	REQUIRE( fabs(proj_flt.calc_births(year_final - year_first) / births - 1.0) < tolerance );
+	REQUIRE( fabs(proj_flt.calc_births_hiv_exposed(year_final - year_first) / births_exposed - 1.0) < tolerance );
+
+	// Compensated sums recover terms that are lost when added to a large total
+	GB::kahan_sum<float> sum(1e8f);
+	for (int k = 0; k < 1000; ++k)
+		sum += 1.0f;
+	sum -= 1e8f;
+	REQUIRE( sum.value() == 1000.0f );
+}
+
+TEST_CASE("test projection with single-precision storage", "[population]") {
+	constexpr int year_first(1970), year_final(2008);
+	constexpr double tolerance(1e-6); // relative to double-precision storage
+	const std::string upd_filename("test_float.upd");
+
+	write_synthetic_upd(upd_filename);
+	DP::Projection proj(year_first, year_final);
+	DP::ProjectionFloat proj_flt(year_first, year_final);
+	SyntheticInputs inputs(proj.num_years()), inputs_flt(proj_flt.num_years());
+	setup_synthetic_projection(proj, inputs, upd_filename);
+	setup_synthetic_projection(proj_flt, inputs_flt, upd_filename);
+	std::remove(upd_filename.c_str());
+	proj.project(year_final);
+	proj_flt.project(year_final);
+
+	// Births, population size, PLHIV and new infections stay close to double
+	// precision in every year, including while the epidemic grows from its seed
+	for (int t = 0; t < proj.num_years(); ++t) {
+		const std::vector<double> total(projection_totals(proj, t)), total_flt(projection_totals(proj_flt, t));
+		for (const int k : {TOTAL_BIRTHS, TOTAL_POPSIZE, TOTAL_PLHIV, TOTAL_NEW_HIV}) {
+			REQUIRE( std::isfinite(total_flt[k]) );
+			REQUIRE( fabs(total_flt[k] - total[k]) <= tolerance * fabs(total[k]) );
+		}
+	}
+	REQUIRE( projection_totals(proj, proj.num_years() - 1)[TOTAL_NEW_HIV] > 0.0 );
+}
+
+TEST_CASE("test mixing kernels", "[kernels]") {
+	constexpr int nrow(DP::N_AGE_ADULT), ncol(DP::kernel_pad(DP::N_AGE_ADULT));
+	constexpr double tolerance(1e-13);
+	std::vector<double> mat(nrow * ncol, 0.0), x0(ncol, 0.0), x1(ncol, 0.0);
+	std::vector<double> y0(nrow), y1(nrow), z0(nrow), z1(nrow), w0(nrow), w1(nrow);
+
+	for (int i = 0; i < nrow; ++i)
+		for (int j = 0; j < nrow; ++j)
+			mat[i * ncol + j] = 1.0 / (1.0 + i + j);
+	for (int j = 0; j < nrow; ++j) {
+		x0[j] = 0.01 * (j + 1);
+		x1[j] = 1.0 / (j + 1);
+	}
+
+	for (int i = 0; i < nrow; ++i) {
+		z0[i] = z1[i] = 0.0;
+		for (int j = 0; j < nrow; ++j) {
+			z0[i] += mat[i * ncol + j] * x0[j];
+			z1[i] += mat[i * ncol + j] * x1[j];
+		}
+	}
+
+	DP::mixmul_scalar(mat.data(), x0.data(), x1.data(), w0.data(), w1.data(), nrow, ncol);
+	for (int i = 0; i < nrow; ++i) {
+		REQUIRE( fabs(w0[i] - z0[i]) < tolerance * z0[i] );
+		REQUIRE( fabs(w1[i] - z1[i]) < tolerance * z1[i] );
+	}
+
+	// vectorized kernels differ from the scalar kernel only by fused multiply-add rounding
+	for (int isa = DP::KERNEL_AVX2; isa <= DP::KERNEL_AVX512; ++isa) {
+		if (DP::kernel_supported(static_cast<DP::kernel_isa_t>(isa))) {
+			DP::mixmul_kernel(static_cast<DP::kernel_isa_t>(isa))(mat.data(), x0.data(), x1.data(), y0.data(), y1.data(), nrow, ncol);
+			for (int i = 0; i < nrow; ++i) {
+				REQUIRE( fabs(y0[i] - w0[i]) < tolerance * w0[i] );
+				REQUIRE( fabs(y1[i] - w1[i]) < tolerance * w1[i] );
+			}
+		}
+	}
+}
+
+TEST_CASE("test HIV transition operator", "[kernels]") {
+	constexpr double tolerance(1e-14);
+	DP::HivStepRates rates = {};
+	DP::HivOperator op;
+	DP::HivOperator::block_t x, dx;
+	double colsum[DP::N_HIV_CELL] = {};
+
+	// Without HIV-related mortality, flows only move people between cells
+	for (int h = DP::HIV_ADULT_MIN; h <= DP::HIV_ADULT_MAX; ++h) {
+		rates.prog[h] = (h < DP::HIV_ADULT_MAX ? 0.1 * (h + 1) : 0.0);
+		rates.dist[h] = (h == DP::HIV_ADULT_MIN ? 0.0 : 1.0 / (DP::N_HIV_ADULT - 1));
+		rates.off_out[h] = rates.prog[h];
+		rates.uptake[h] = 0.05 * h;
+		for (int k = 0; k < DP::N_ART; ++k)
+			rates.art_out[h][k] = 0.02 + (k < DP::N_ART - 1 ? 2.0 : 0.0);
+	}
+	rates.art_flow[0] = rates.art_flow[1] = 2.0;
+	rates.art_exit = 0.02;
+	op.assemble(rates);
+
+	for (int i = 0; i < DP::N_HIV_CELL; ++i)
+		for (int k = op.row_begin(i); k < op.row_end(i); ++k)
+			colsum[op.col(k)] += op.val(k);
+	for (int i = 0; i < DP::N_HIV_CELL; ++i)
+		REQUIRE( fabs(colsum[i]) < tolerance );
+
+	// apply() matches a dense product in every lane
+	for (int i = 0; i < DP::N_HIV_CELL; ++i)
+		for (int l = 0; l < DP::N_HIV_LANE; ++l)
+			x[i][l] = 1.0 + i + 0.5 * l;
+	op.apply(x, dx, DP::N_HIV_LANE);
+	for (int i = 0; i < DP::N_HIV_CELL; ++i)
+		for (int l = 0; l < DP::N_HIV_LANE; ++l) {
+			double expected(0.0);
+			for (int k = op.row_begin(i); k < op.row_end(i); ++k)
+				expected += op.val(k) * x[op.col(k)][l];
+			REQUIRE( fabs(dx[i][l] - expected) < tolerance * (1.0 + fabs(expected)) );
+		}
+
+	// The exponential integrator conserves population and keeps it non-negative
+	// even when exit rates exceed 1 / step size
+	DP::HivOperator::block_t dth = {};
+	double total_before(0.0), total_after(0.0);
+	for (int i = 0; i < DP::N_HIV_CELL; ++i)
+		total_before += x[i][0];
+	op.update_exposure(1.0, DP::INTEGRATOR_EXPONENTIAL);
+	op.advance(x, dth, DP::N_HIV_LANE);
+	for (int i = 0; i < DP::N_HIV_CELL; ++i) {
+		REQUIRE( x[i][0] >= 0.0 );
+		total_after += x[i][0];
+	}
+	REQUIRE( fabs(total_after - total_before) < tolerance * total_before );
+}